@@ -0,0 +1,176 @@
+/*
+  Trains a model file from a folder of Standard MIDI Files, learning the notes exactly as the
+  plugin learns what is played into it (MidiMarkovProcessor::learnFromMidi), and writes it in
+  the format the plugin's load button reads.
+
+  usage: midi-markov-train <midi folder> <output.modelz> [options]
+    --threads N        files are split into this many shards, trained in parallel and then
+                       merged (default: all cores)
+    --sample-rate SR   iois and durations are learned in samples at this rate (default 44100),
+                       so use the rate the plugin will run at
+    --channel N        only learn from this midi channel, 0 for all (default 0)
+    --min-count C      leave out contexts seen fewer than C times when saving (default 0)
+    --max-order N      leave out contexts longer than N when saving, 0 for no limit (default 0)
+
+  Each shard learns its files in file name order, so the same folder and thread count always
+  give the same model.
+*/
+
+#include "PluginProcessor.h"
+#include "VoiceWorkerPool.h"
+#include <iostream>
+#include <memory>
+#include <atomic>
+
+namespace
+{
+struct ParsedFile
+{
+    bool ok { false };
+    juce::MidiBuffer notes;
+    int lengthSamples { 0 };
+};
+
+/** every note on/off in the file, from all tracks, at its time in samples */
+ParsedFile readMidiFile(const juce::File& file, double sampleRate)
+{
+    ParsedFile parsed;
+    juce::FileInputStream stream(file);
+    juce::MidiFile midiFile;
+    if (!stream.openedOk() || !midiFile.readFrom(stream))
+        return parsed;
+    midiFile.convertTimestampTicksToSeconds();
+
+    juce::MidiMessageSequence merged;
+    for (int t = 0; t < midiFile.getNumTracks(); ++t)
+        merged.addSequence(*midiFile.getTrack(t), 0.0);
+    merged.sort();
+
+    for (const auto* holder : merged)
+    {
+        const juce::MidiMessage& message = holder->message;
+        if (!message.isNoteOnOrOff())
+            continue;
+        const int samplePos = juce::roundToInt(message.getTimeStamp() * sampleRate);
+        parsed.notes.addEvent(message, samplePos);
+        parsed.lengthSamples = juce::jmax(parsed.lengthSamples, samplePos);
+    }
+    parsed.ok = true;
+    return parsed;
+}
+
+bool readOption(int argc, char* argv[], const char* name, double& value)
+{
+    for (int i = 3; i + 1 < argc; ++i)
+    {
+        if (std::string(argv[i]) == name)
+        {
+            value = std::atof(argv[i + 1]);
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cout << "usage: midi-markov-train <midi folder> <output.modelz> [--threads N] [--sample-rate SR] "
+                     "[--channel N] [--min-count C] [--max-order N]" << std::endl;
+        return 2;
+    }
+    const juce::File folder = juce::File::getCurrentWorkingDirectory().getChildFile(argv[1]);
+    const std::string outputFile = argv[2];
+
+    double threads = static_cast<double>(juce::SystemStats::getNumCpus());
+    double sampleRate = 44100.0, channel = 0.0, minCount = 0.0, maxOrder = 0.0;
+    readOption(argc, argv, "--threads", threads);
+    readOption(argc, argv, "--sample-rate", sampleRate);
+    readOption(argc, argv, "--channel", channel);
+    readOption(argc, argv, "--min-count", minCount);
+    readOption(argc, argv, "--max-order", maxOrder);
+    if (sampleRate <= 0.0)
+    {
+        std::cout << "sample rate must be more than 0" << std::endl;
+        return 2;
+    }
+
+    juce::Array<juce::File> files = folder.findChildFiles(juce::File::findFiles, true, "*.mid;*.midi;*.smf");
+    files.sort();
+    if (files.isEmpty())
+    {
+        std::cout << "no midi files found in " << folder.getFullPathName() << std::endl;
+        return 2;
+    }
+
+    const auto start = juce::Time::getHighResolutionTicks();
+    const size_t shardCount = static_cast<size_t>(juce::jlimit(1, files.size(), static_cast<int>(threads)));
+    std::vector<std::unique_ptr<MidiMarkovProcessor::Voice>> shards;
+    for (size_t s = 0; s < shardCount; ++s)
+    {
+        auto voice = std::make_unique<MidiMarkovProcessor::Voice>();
+        // the same chord window the plugin sets up in prepareToPlay
+        voice->chordDetect = ChordDetector(static_cast<unsigned long>(sampleRate * 0.05));
+        voice->inputChannel = juce::jlimit(0, 16, static_cast<int>(channel));
+        shards.push_back(std::move(voice));
+    }
+
+    // files are laid end to end with a gap longer than the longest ioi the models learn,
+    // so the first note of a file is not heard as following on from the last one
+    const unsigned long gapSamples = static_cast<unsigned long>(sampleRate * 2) + 1;
+    std::atomic<int> failed { 0 }, notes { 0 };
+    {
+        VoiceWorkerPool pool { shardCount - 1 };
+        pool.run(shardCount, [&](size_t s)
+        {
+            MidiMarkovProcessor::Voice& voice = *shards[s];
+            // a contiguous run of files each, so neighbouring files still follow on from each other
+            const size_t first = s * static_cast<size_t>(files.size()) / shardCount;
+            const size_t last = (s + 1) * static_cast<size_t>(files.size()) / shardCount;
+            unsigned long fileStart = 0;
+            for (size_t i = first; i < last; ++i)
+            {
+                const juce::File& file = files.getReference(static_cast<int>(i));
+                const ParsedFile parsed = readMidiFile(file, sampleRate);
+                if (!parsed.ok)
+                {
+                    std::cout << ("could not read " + file.getFullPathName() + "\n") << std::flush;
+                    ++failed;
+                    continue;
+                }
+                MidiMarkovProcessor::learnFromMidi(voice, parsed.notes, fileStart, sampleRate, 0, true);
+                voice.learnedIois.clear();
+                notes += parsed.notes.getNumEvents();
+                fileStart += static_cast<unsigned long>(parsed.lengthSamples) + gapSamples;
+            }
+        });
+    }
+    const double learnSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+    // everything ends up in the first shard
+    for (size_t m = 0; m < shards[0]->models().size(); ++m)
+    {
+        std::vector<MarkovManager*> managers;
+        for (auto& shard : shards)
+            managers.push_back(shard->models()[m]);
+        MarkovManager::mergeTree(managers);
+    }
+    MidiMarkovProcessor::Voice& merged = *shards[0];
+
+    MarkovChain::CompactionOptions compaction;
+    compaction.minCount = minCount;
+    compaction.maxOrder = static_cast<unsigned long>(juce::jmax(0.0, maxOrder));
+    if (!MidiMarkovProcessor::saveVoiceModels(merged, outputFile, compaction))
+        return 1;
+
+    const double totalSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+    std::cout << "learned " << notes.load() << " note events from " << (files.size() - failed.load()) << " files ("
+              << failed.load() << " unreadable) on " << shardCount << " threads in " << totalSeconds << "s, " 
+              << learnSeconds << "s of it before merging" << std::endl;
+    std::cout << "pitch model " << merged.pitchModel.getModelSize() << " contexts, ioi model "
+              << merged.iOIModel.getModelSize() << ", duration model " << merged.noteDurationModel.getModelSize()
+              << ". written to " << outputFile << std::endl;
+    return 0;
+}
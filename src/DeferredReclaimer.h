@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <utility>
+
+/**
+ * Hands objects that are expensive to destroy (e.g. a released Markov model) to a background 
+ * thread, so the thread that let go of them doesn't pay for freeing them.
+ * retire is wait free: the object is moved into one of a fixed number of slots and the 
+ * background thread, which polls, destroys it later. T must be cheap to move and its 
+ * moved-from/ default state must be cheap to destroy.
+ */
+template <typename T, size_t Slots = 32>
+class DeferredReclaimer{
+    public:
+        DeferredReclaimer() : worker([this]{ run(); })
+        {
+        }
+        ~DeferredReclaimer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(wakeMutex);
+                running = false;
+            }
+            wake.notify_one();
+            worker.join();
+            reclaim();
+        }
+        DeferredReclaimer(const DeferredReclaimer&) = delete;
+        DeferredReclaimer& operator=(const DeferredReclaimer&) = delete;
+        /**
+         * @brief give item to the background thread to destroy. 
+         * If every slot is taken, item is left alone and the caller still owns it.
+         *
+         * @return true if the item was taken 
+         */
+        bool retire(T&& item)
+        {
+            for (Slot& slot : slots)
+            {
+                int expected = slotFree;
+                if (!slot.state.compare_exchange_strong(expected, slotWriting, std::memory_order_acquire))
+                    continue;
+                slot.item = std::move(item);
+                slot.state.store(slotFull, std::memory_order_release);
+                return true;
+            }
+            return false;
+        }
+        /** number of retired items not destroyed yet */
+        size_t pending() const
+        {
+            size_t count = 0;
+            for (const Slot& slot : slots)
+                if (slot.state.load(std::memory_order_acquire) != slotFree) ++count;
+            return count;
+        }
+    private:
+        enum : int { slotFree, slotWriting, slotFull };
+        struct Slot {
+            std::atomic<int> state { slotFree };
+            T item {};
+        };
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            while (running)
+            {
+                lock.unlock();
+                reclaim();
+                lock.lock();
+                wake.wait_for(lock, std::chrono::milliseconds(50), [this]{ return !running; });
+            }
+        }
+        void reclaim()
+        {
+            for (Slot& slot : slots)
+            {
+                if (slot.state.load(std::memory_order_acquire) != slotFull)
+                    continue;
+                {
+                    T dead = std::move(slot.item);
+                    slot.item = T{};
+                    slot.state.store(slotFree, std::memory_order_release);
+                } // dead is destroyed here
+            }
+        }
+
+        std::array<Slot, Slots> slots;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        bool running { true };
+        std::thread worker;
+};
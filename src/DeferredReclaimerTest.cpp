@@ -0,0 +1,52 @@
+#include "DeferredReclaimer.h"
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <assert.h>
+
+// remembers which thread destroyed the last live Tracker
+static std::atomic<bool> destroyedOffMain { false };
+static std::thread::id mainThread;
+
+struct Tracker
+{
+    std::unique_ptr<int> payload;
+    Tracker() = default;
+    Tracker(Tracker&&) = default;
+    Tracker& operator=(Tracker&&) = default;
+    ~Tracker()
+    {
+        if (payload && std::this_thread::get_id() != mainThread)
+            destroyedOffMain = true;
+    }
+};
+
+int main()
+{
+    mainThread = std::this_thread::get_id();
+    {
+        DeferredReclaimer<Tracker, 4> reclaimer;
+        Tracker t;
+        t.payload = std::make_unique<int>(1);
+        assert(reclaimer.retire(std::move(t)));
+        while (reclaimer.pending() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        assert(destroyedOffMain);
+    }
+
+    // all slots taken: the caller keeps the item
+    {
+        DeferredReclaimer<std::map<int, std::string>, 2> reclaimer;
+        int taken = 0;
+        for (int i = 0; i < 10; ++i)
+        {
+            std::map<int, std::string> m { {i, "x"} };
+            if (reclaimer.retire(std::move(m))) ++taken;
+            else assert(m.size() == 1);
+        }
+        assert(taken >= 2);
+    } // destructor reclaims whatever is still pending
+
+    std::cout << "DeferredReclaimer tests passed" << std::endl;
+}
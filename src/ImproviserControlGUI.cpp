@@ -25,6 +25,8 @@ ImproviserControlGUI::ImproviserControlGUI(
   loadModelButton.addListener(this);
   saveModelButton.addListener(this);
   resetModelButton.addListener(this); // Add this line
+  undoModelButton.addListener(this);
+  redoModelButton.addListener(this);
 
   // Apply custom look and feel to all buttons
   playingToggle.setLookAndFeel(&customLookAndFeel);
@@ -66,6 +68,8 @@ ImproviserControlGUI::ImproviserControlGUI(
   loadModelButton.setLookAndFeel(&customLookAndFeel);
   saveModelButton.setLookAndFeel(&customLookAndFeel);
   resetModelButton.setLookAndFeel(&customLookAndFeel);
+  undoModelButton.setLookAndFeel(&customLookAndFeel);
+  redoModelButton.setLookAndFeel(&customLookAndFeel);
   defaultLoadButtonColour = loadModelButton.findColour(juce::TextButton::buttonColourId);
   defaultSaveButtonColour = saveModelButton.findColour(juce::TextButton::buttonColourId);
 
@@ -161,6 +165,8 @@ ImproviserControlGUI::ImproviserControlGUI(
   addAndMakeVisible(loadModelButton);
   addAndMakeVisible(saveModelButton);
   addAndMakeVisible(resetModelButton); // Add this line
+  addAndMakeVisible(undoModelButton);
+  addAndMakeVisible(redoModelButton);
 
   addAndMakeVisible(quantGroup);
   addAndMakeVisible(quantiseToggle);
@@ -290,6 +296,8 @@ ImproviserControlGUI::~ImproviserControlGUI() {
   loadModelButton.removeListener(this);
   saveModelButton.removeListener(this);
   resetModelButton.removeListener(this); // Add this line
+  undoModelButton.removeListener(this);
+  redoModelButton.removeListener(this);
   bpmSlider.removeListener(this);
   probabilitySlider.removeListener(this);
   divisionCombo.removeListener(this);
@@ -310,6 +318,8 @@ ImproviserControlGUI::~ImproviserControlGUI() {
   loadModelButton.setLookAndFeel(nullptr);
   saveModelButton.setLookAndFeel(nullptr);
   resetModelButton.setLookAndFeel(nullptr);
+  undoModelButton.setLookAndFeel(nullptr);
+  redoModelButton.setLookAndFeel(nullptr);
 
   quantiseToggle.setLookAndFeel(nullptr);
   hostClockToggle.setLookAndFeel(nullptr);
@@ -554,6 +564,9 @@ void ImproviserControlGUI::resized() {
   loadModelButton.setBounds(cellBounds(2, 0));
   saveModelButton.setBounds(cellBounds(3, 0));
   resetModelButton.setBounds(cellBounds(4, 0));
+  auto historyArea = cellBounds(5, 0);
+  undoModelButton.setBounds(historyArea.removeFromTop(historyArea.getHeight() / 2).reduced(0, 1));
+  redoModelButton.setBounds(historyArea.reduced(0, 1));
 
   quantGroup.setBounds(cellBounds(0, 1, 2, 2).reduced(4));
   auto quantArea = quantGroup.getBounds().reduced(10);
@@ -785,6 +798,8 @@ void ImproviserControlGUI::configureChunkyControls() {
   saveModelButton.setTooltip("Save the current model to disk");
   resetModelButton.setTooltip(
       "Reset the model to initial state"); // Add tooltip
+  undoModelButton.setTooltip("Undo the last reset, load or feedback on the model");
+  redoModelButton.setTooltip("Redo the last undone model change");
   quantiseToggle.setTooltip("Toggle quatisation on model output");
   hostClockToggle.setTooltip("Sync quantisation to the host transport clock");
   bpmSlider.setTooltip("Beats per minute (60-240)");
@@ -910,6 +925,18 @@ void ImproviserControlGUI::buttonClicked(juce::Button *button)
     return;
   }
 
+  if (button == &undoModelButton)
+  {
+    controlListener.undoModelChange();
+    return;
+  }
+
+  if (button == &redoModelButton)
+  {
+    controlListener.redoModelChange();
+    return;
+  }
+
   for (size_t i = 0; i < divisionButtons.size(); ++i)
   {
       if (button == divisionButtons[i].get())
@@ -120,6 +120,12 @@ public:
 
     /** Reset to defaults or clear state. */
     virtual void resetModel()  = 0;
+
+    /** Go back to the model as it was before the last reset, load or feedback. */
+    virtual void undoModelChange() = 0;
+
+    /** Go forward again after undoModelChange. */
+    virtual void redoModelChange() = 0;
 };
 
 class ImproviserControlGUI : public juce::Component,
@@ -187,6 +193,8 @@ private:
     juce::TextButton loadModelButton { "load model" };
     juce::TextButton saveModelButton { "save model" };
     juce::TextButton resetModelButton { "reset model" }; // Add this line
+    juce::TextButton undoModelButton { "undo" };
+    juce::TextButton redoModelButton { "redo" };
 
     juce::GroupComponent quantGroup { {}, "Quantisation" };
     juce::ToggleButton quantiseToggle { "Quantise" };
@@ -0,0 +1,70 @@
+#include "LightweightSemaphore.h"
+#include <algorithm>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#elif defined(__APPLE__)
+    #include <dispatch/dispatch.h>
+#else
+    #include <semaphore.h>
+    #include <cerrno>
+#endif
+
+#if defined(_WIN32)
+struct LightweightSemaphore::Native
+{
+    HANDLE handle { CreateSemaphoreW(nullptr, 0, MAXLONG, nullptr) };
+    ~Native() { CloseHandle(handle); }
+    void post(int n) { ReleaseSemaphore(handle, n, nullptr); }
+    void wait() { WaitForSingleObject(handle, INFINITE); }
+};
+#elif defined(__APPLE__)
+struct LightweightSemaphore::Native
+{
+    dispatch_semaphore_t handle { dispatch_semaphore_create(0) };
+    ~Native() { dispatch_release(handle); }
+    void post(int n) { while (n-- > 0) dispatch_semaphore_signal(handle); }
+    void wait() { dispatch_semaphore_wait(handle, DISPATCH_TIME_FOREVER); }
+};
+#else
+struct LightweightSemaphore::Native
+{
+    sem_t handle;
+    Native() { sem_init(&handle, 0, 0); }
+    ~Native() { sem_destroy(&handle); }
+    void post(int n) { while (n-- > 0) sem_post(&handle); }
+    void wait() { while (sem_wait(&handle) != 0 && errno == EINTR) {} }
+};
+#endif
+
+LightweightSemaphore::LightweightSemaphore(int max) : maxCount{max}, native{std::make_unique<Native>()}
+{
+}
+
+LightweightSemaphore::~LightweightSemaphore() = default;
+
+void LightweightSemaphore::post(int n)
+{
+    int old = count.load(std::memory_order_relaxed);
+    int next;
+    do
+    {
+        next = std::min(old + n, maxCount);
+        if (next <= old)
+            return;
+    } while (!count.compare_exchange_weak(old, next, std::memory_order_release, std::memory_order_relaxed));
+    // only the threads that are asleep need the operating system
+    const int sleeping = std::min(-old, next - old);
+    if (sleeping > 0)
+        native->post(sleeping);
+}
+
+void LightweightSemaphore::wait()
+{
+    if (count.fetch_sub(1, std::memory_order_acquire) > 0)
+        return;
+    native->wait();
+}
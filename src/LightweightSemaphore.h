@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+/**
+ * A counting semaphore that is safe to post from the audio thread. post only touches an atomic
+ * unless a thread is asleep, and then makes one call to the operating system's semaphore, which
+ * doesn't take a lock. The count stops at maxCount, so posting when nobody is waiting doesn't
+ * build up a backlog of wake ups.
+ */
+class LightweightSemaphore{
+    public:
+        explicit LightweightSemaphore(int maxCount);
+        ~LightweightSemaphore();
+        LightweightSemaphore(const LightweightSemaphore&) = delete;
+        LightweightSemaphore& operator=(const LightweightSemaphore&) = delete;
+        /** add up to n to the count, waking as many sleeping threads as that allows */
+        void post(int n = 1);
+        /** take one from the count, sleeping until there is one */
+        void wait();
+    private:
+        struct Native;
+        const int maxCount;
+        /** below zero while threads are asleep, minus how many */
+        std::atomic<int> count { 0 };
+        std::unique_ptr<Native> native;
+};
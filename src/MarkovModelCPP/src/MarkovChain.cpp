@@ -14,6 +14,10 @@
 #include <limits>
 #include <algorithm>
 #include <functional>
+#include <cmath>
+#include <unordered_map>
+#include <utility>
+#include <atomic>
 
 namespace
 {
@@ -38,11 +42,58 @@ inline bool readUint32(const std::string& src, size_t& offset, uint32_t& value)
   offset += 4;
   return true;
 }
+
+// v2 blobs start with this, v1 blobs start with a little-endian entry count
+constexpr char binaryMagic[4] = { 'M', 'K', 'C', 'B' };
+constexpr uint64_t binaryVersion = 2;
+
+inline void appendVarint(std::string& dest, uint64_t value)
+{
+  while (value >= 0x80u)
+  {
+    dest.push_back(static_cast<char>((value & 0x7Fu) | 0x80u));
+    value >>= 7;
+  }
+  dest.push_back(static_cast<char>(value));
 }
 
-MarkovChain::MarkovChain(unsigned long  _maxOrder) : maxOrder{_maxOrder}, orderOfLastMatch{0}
+inline bool readVarint(const std::string& src, size_t& offset, uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    if (offset >= src.size())
+      return false;
+    const auto byte = static_cast<uint64_t>(static_cast<unsigned char>(src[offset++]));
+    value |= (byte & 0x7Fu) << shift;
+    if ((byte & 0x80u) == 0)
+      return true;
+  }
+  return false;
+}
+
+/** splits a "n,a,b," key into its tokens, false if it does not look like one */
+inline bool splitKey(const std::string& key, std::vector<std::string>& tokens)
+{
+  tokens.clear();
+  const size_t firstComma = key.find(',');
+  if (firstComma == std::string::npos || key.back() != ',')
+    return false;
+  size_t start = firstComma + 1;
+  while (start < key.size())
+  {
+    const size_t end = key.find(',', start);
+    if (end == start)
+      return false;
+    tokens.emplace_back(key, start, end - start);
+    start = end + 1;
+  }
+  return !tokens.empty() && key.compare(0, firstComma, std::to_string(tokens.size())) == 0;
+}
+}
+
+MarkovChain::MarkovChain(unsigned long  _maxOrder) : table{emptyModel()}, maxOrder{_maxOrder}, aliasThreshold{16}, rng{std::random_device{}()}, orderOfLastMatch{0}
 {
-  srand((int)time(NULL));
 }
 
 MarkovChain::~MarkovChain()
@@ -64,35 +115,325 @@ void MarkovChain::addObservation(const state_sequence& prevState, state_single c
     return; 
   }
   state_single key = stateSequenceToString(prevState);
-  // do we have this key already
-  bool have_key = true;
-  try
+  makeModelPrivate();
+  // creates the key if we have not seen it before
+  Successors& succ = entryForKey(key);
+  succ.lastUsed = ++useClock;
+  normaliseEntry(succ);
+  const size_t added = addToSuccessors(succ, currentState, weightUnit);
+  if (added > 0) countObservation(currentState);
+  modelBytes += added;
+}
+
+size_t MarkovChain::addToSuccessors(Successors& succ, const state_single& obs, double count)
+{
+  if (count <= 0) return 0;
+  size_t addedBytes = 0;
+  size_t index = 0;
+  size_t rank = 0;
+  auto it = std::find(succ.observations.begin(), succ.observations.end(), obs);
+  if (it == succ.observations.end())
   {
-    model.at(key);
+    index = succ.observations.size();
+    succ.observations.push_back(obs);
+    succ.counts.push_back(count);
+    rank = succ.byCount.size();
+    succ.byCount.push_back(static_cast<uint32_t>(index));
+    addedBytes = estimateObservationBytes(obs);
   }
-  catch (const std::out_of_range& oor)
+  else
   {
-    have_key = false;
+    index = static_cast<size_t>(it - succ.observations.begin());
+    succ.counts[index] += count;
+    rank = static_cast<size_t>(std::find(succ.byCount.begin(), succ.byCount.end(), index) - succ.byCount.begin());
   }
-  // if we have this key, we are adding the new obs on that key
-  if (have_key)
+  // the count only went up, so it can only move towards the front
+  while (rank > 0 && succ.counts[succ.byCount[rank - 1]] < succ.counts[index])
   {
-    model[key].push_back(currentState);
+    std::swap(succ.byCount[rank - 1], succ.byCount[rank]);
+    --rank;
   }
-  else{// new key - create a new next state sequence
-    state_sequence seq = {currentState};
-    model[key] = seq;
+  succ.total += count;
+  succ.aliasValid = false;
+  return addedBytes;
+}
+
+void MarkovChain::rankSuccessors(Successors& succ)
+{
+  succ.byCount.resize(succ.observations.size());
+  for (size_t i = 0; i < succ.byCount.size(); ++i)
+    succ.byCount[i] = static_cast<uint32_t>(i);
+  std::stable_sort(succ.byCount.begin(), succ.byCount.end(),
+    [&succ](uint32_t a, uint32_t b) { return succ.counts[a] > succ.counts[b]; });
+}
+
+MarkovChain::Successors& MarkovChain::entryForKey(const state_single& key)
+{
+  auto inserted = table->try_emplace(key);
+  Successors& succ = table->edit(inserted.first);
+  if (inserted.second)
+  {
+    succ.order = orderFromKey(key);
+    succ.decayEpoch = decayEpoch;
+    modelBytes += estimateKeyBytes(key);
   }
+  return succ;
+}
+
+unsigned long MarkovChain::orderFromKey(const state_single& key)
+{
+  unsigned long order = 0;
+  for (char c : key)
+  {
+    if (c < '0' || c > '9') break;
+    order = order * 10 + static_cast<unsigned long>(c - '0');
+  }
+  return order;
+}
+
+size_t MarkovChain::estimateKeyBytes(const state_single& key)
+{
+  // map node (3 pointers + colour, padded) + the key + the value struct
+  constexpr size_t mapNodeOverhead = 48;
+  const size_t keyHeap = key.size() > 15 ? key.size() + 1 : 0; // short strings live inline
+  return mapNodeOverhead + sizeof(state_single) + keyHeap + sizeof(Successors);
+}
+
+size_t MarkovChain::estimateObservationBytes(const state_single& obs)
+{
+  const size_t obsHeap = obs.size() > 15 ? obs.size() + 1 : 0;
+  return sizeof(state_single) + obsHeap + sizeof(double) + sizeof(uint32_t);
+}
+
+void MarkovChain::recalculateMemoryUsage()
+{
+  modelBytes = 0;
+  observationContexts.clear();
+  for (auto it = table->begin(); it != table->end(); ++it)
+  {
+    table->edit(it).order = orderFromKey(it->first);
+    modelBytes += estimateKeyBytes(it->first);
+    for (const state_single& obs : it->second.observations)
+    {
+      modelBytes += estimateObservationBytes(obs);
+      ++observationContexts[obs];
+    }
+  }
+  observationContextsValid = true;
+}
+
+void MarkovChain::countObservation(const state_single& obs)
+{
+  if (observationContextsValid) ++observationContexts[obs];
+}
+
+void MarkovChain::uncountObservation(const state_single& obs)
+{
+  if (!observationContextsValid) return;
+  auto found = observationContexts.find(obs);
+  if (found != observationContexts.end() && --found->second == 0)
+    observationContexts.erase(found);
+}
+
+void MarkovChain::updateObservationContexts()
+{
+  if (observationContextsValid) return;
+  observationContexts.clear();
+  for (const auto& kv : *table)
+    for (const state_single& obs : kv.second.observations)
+      ++observationContexts[obs];
+  observationContextsValid = true;
+}
+
+void MarkovChain::setMemoryBudget(size_t maxBytes)
+{
+  memoryBudget = maxBytes;
+}
+
+size_t MarkovChain::getApproxMemoryUsage() const
+{
+  return modelBytes;
+}
+
+MarkovChain::ModelStorage::const_iterator MarkovChain::eraseEntry(ModelStorage::const_iterator it)
+{
+  size_t bytes = estimateKeyBytes(it->first);
+  for (const state_single& obs : it->second.observations)
+  {
+    bytes += estimateObservationBytes(obs);
+    uncountObservation(obs);
+  }
+  modelBytes -= std::min(bytes, modelBytes);
+  return table->erase(it);
+}
+
+void MarkovChain::evictIncrementally(size_t maxVisits)
+{
+  if (memoryBudget == 0 || modelBytes <= memoryBudget)
+  {
+    // back under budget - next time we go over, start strict again
+    sweepMinOrder = 0;
+    return;
+  }
+
+  if (sweepMinOrder == 0)
+  {
+    // new sweep: only the highest order singletons not touched since now
+    sweepMinOrder = std::max<unsigned long>(1, maxOrder);
+    sweepMaxCount = 1;
+    sweepStartClock = useClock;
+    evictionCursor.clear();
+  }
+
+  auto it = table->lower_bound(evictionCursor);
+  for (size_t visited = 0; visited < maxVisits && modelBytes > memoryBudget; ++visited)
+  {
+    if (it == table->end())
+    {
+      // completed a pass and still over budget. relax: lower orders first, then higher counts
+      if (sweepMinOrder > 1) sweepMinOrder = std::max<unsigned long>(1, sweepMinOrder / 2);
+      else sweepMaxCount = sweepMaxCount * 2;
+      sweepStartClock = useClock;
+      it = table->begin();
+      if (it == table->end()) break;
+    }
+
+    const Successors& succ = it->second;
+    const bool cold = succ.lastUsed <= sweepStartClock;
+    const double count = succ.total * effectiveScale(succ);
+    if (cold && succ.order >= sweepMinOrder && count <= static_cast<double>(sweepMaxCount))
+    {
+      it = eraseEntry(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  evictionCursor = (it == table->end()) ? state_single{} : it->first;
+}
+
+void MarkovChain::setDecay(double perStep, double pruneEpsilon)
+{
+  decayPerStep = std::clamp(perStep, 1.0e-6, 1.0);
+  decayPruneEpsilon = std::max(0.0, pruneEpsilon);
+}
+
+void MarkovChain::advanceDecay(double steps)
+{
+  if (decayPerStep >= 1.0 || steps <= 0.0) return;
+  weightUnit /= std::pow(decayPerStep, steps);
+  if (weightUnit < 1.0e100) return;
+
+  // time for a new epoch. the sweep has had ~1e100 worth of decay to get round
+  // everything from the last rollover, but if it somehow hasn't, finish it now
+  makeModelPrivate();
+  for (auto it = table->begin(); it != table->end(); ++it) 
+  {
+    if (it->second.decayEpoch != decayEpoch) normaliseEntry(table->edit(it));
+  }
+  previousEpochUnit = weightUnit;
+  weightUnit = 1.0;
+  ++decayEpoch;
+}
+
+double MarkovChain::effectiveScale(const Successors& succ) const
+{
+  if (succ.decayEpoch == decayEpoch) return 1.0 / weightUnit;
+  return 1.0 / (previousEpochUnit * weightUnit);
+}
+
+void MarkovChain::normaliseEntry(Successors& succ)
+{
+  if (succ.decayEpoch == decayEpoch) return;
+  // scaling every weight by the same amount keeps the alias table valid
+  for (double& c : succ.counts) c /= previousEpochUnit;
+  succ.total /= previousEpochUnit;
+  succ.decayEpoch = decayEpoch;
+}
+
+unsigned long MarkovChain::expandedCount(double effectiveCount)
+{
+  if (effectiveCount <= 0.0) return 0;
+  return std::max<unsigned long>(1, static_cast<unsigned long>(std::llround(effectiveCount)));
+}
+
+void MarkovChain::decaySweepIncrementally(size_t maxVisits)
+{
+  if (decayPerStep >= 1.0 || table->empty()) return;
+
+  auto it = table->lower_bound(decayCursor);
+  for (size_t visited = 0; visited < maxVisits; ++visited)
+  {
+    if (it == table->end())
+    {
+      it = table->begin();
+      if (it == table->end()) break;
+    }
+
+    // most visits change nothing, and editing would unshare the page from any snapshot
+    const Successors& current = it->second;
+    const double currentScale = effectiveScale(current);
+    bool needsWrite = current.decayEpoch != decayEpoch || current.observations.empty();
+    for (size_t i = 0; i < current.counts.size() && !needsWrite; ++i)
+      needsWrite = current.counts[i] * currentScale < decayPruneEpsilon;
+    if (!needsWrite)
+    {
+      ++it;
+      continue;
+    }
+
+    Successors& succ = table->edit(it);
+    normaliseEntry(succ);
+    const double scale = effectiveScale(succ);
+    bool changed = false;
+    for (size_t i = 0; i < succ.observations.size();)
+    {
+      if (succ.counts[i] * scale < decayPruneEpsilon)
+      {
+        modelBytes -= std::min(estimateObservationBytes(succ.observations[i]), modelBytes);
+        uncountObservation(succ.observations[i]);
+        succ.total -= succ.counts[i];
+        succ.observations.erase(succ.observations.begin() + static_cast<std::ptrdiff_t>(i));
+        succ.counts.erase(succ.counts.begin() + static_cast<std::ptrdiff_t>(i));
+        changed = true;
+      }
+      else ++i;
+    }
+    if (changed)
+    {
+      // recount rather than trust a long run of float subtractions
+      succ.total = 0;
+      for (double c : succ.counts) succ.total += c;
+      succ.aliasValid = false;
+      rankSuccessors(succ);
+    }
+
+    if (succ.observations.empty())
+    {
+      it = eraseEntry(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  decayCursor = (it == table->end()) ? state_single{} : it->first;
 }
 
 void MarkovChain::addObservationAllOrders(const state_sequence& prevState, state_single currentState)
 {
+  makeModelPrivate();
   std::vector<state_sequence> allPrevs = breakStateIntoAllOrders(prevState);
   for (state_sequence& seq : allPrevs)
   {
     //std::cout << "MarkovChain::addObservationAllOrders adding obs for " << this->stateSequenceToString(seq) << " to " << currentState <<  std::endl; 
     addObservation(seq, currentState);
   } 
+  // keep the work per call bounded - roughly a couple of visits per key we may have added
+  advanceDecay(1.0);
+  decaySweepIncrementally(allPrevs.size() * 2 + 16);
+  evictIncrementally(allPrevs.size() * 2 + 16);
 }
 
 std::vector<state_sequence>  MarkovChain::breakStateIntoAllOrders(const state_sequence& prevState)
@@ -112,7 +453,7 @@ std::vector<state_sequence>  MarkovChain::breakStateIntoAllOrders(const state_se
 }
 
 
-std::string MarkovChain::stateSequenceToString(const state_sequence& sequence)
+std::string MarkovChain::stateSequenceToString(const state_sequence& sequence) const
 {
   std::string str = std::to_string(sequence.size()); // write the order first
   str.append(",");
@@ -123,7 +464,7 @@ std::string MarkovChain::stateSequenceToString(const state_sequence& sequence)
   } 
   return str;
 }
-std::string MarkovChain::stateSequenceToString(const state_sequence& sequence, long unsigned int maxOrder)
+std::string MarkovChain::stateSequenceToString(const state_sequence& sequence, long unsigned int maxOrder) const
 {
   if (maxOrder >= sequence.size()){ 
     // max order is higher pr == than the order we have
@@ -151,14 +492,27 @@ std::string MarkovChain::stateSequenceToString(const state_sequence& sequence, l
 }
 
 state_single MarkovChain::generateObservation(const state_sequence& prevState, int maxOrderWanted, bool needChoice)
+{
+  return generateFiltered(prevState, maxOrderWanted, needChoice, nullptr);
+}
+
+state_single MarkovChain::generateObservation(const state_sequence& prevState, int maxOrderWanted, bool needChoice, const ObservationFilter& filter)
+{
+  return generateFiltered(prevState, maxOrderWanted, needChoice, &filter);
+}
+
+state_single MarkovChain::generateFiltered(const state_sequence& prevState, int maxOrderWanted, bool needChoice, const ObservationFilter* filter)
 {
   // check for empty model
-  if (model.size() == 0)
+  if (table->size() == 0)
     return "0";
 
   if (maxOrderWanted > static_cast<int>(this->maxOrder))
       maxOrderWanted = static_cast<int>(this->maxOrder);
 
+  if (blend.mode != BlendOptions::off)
+      return generateBlended(prevState, maxOrderWanted, filter);
+
   auto countUsableOrder = [&](const state_sequence& seq, int order) -> int
   {
       const int usableLen = std::max(0, order);
@@ -176,22 +530,20 @@ state_single MarkovChain::generateObservation(const state_sequence& prevState, i
   {
       const int effectiveOrder = countUsableOrder(prevState, orderLimit);
       state_single key = stateSequenceToString(prevState, orderLimit);
-      state_sequence poss_next_states{};
-      bool have_key = true;
-      try
-      {
-          poss_next_states = model.at(key);
-          if (needChoice && poss_next_states.size() < 2)
-              have_key = false;
-      }
-      catch (const std::out_of_range&)
-      {
+      auto found = table->find(key);
+      bool have_key = (found != table->end());
+      if (have_key && needChoice && found->second.total * effectiveScale(found->second) < 2.0)
+          have_key = false;
+
+      state_single obs;
+      // a context with nothing allowed is treated as if it wasn't there
+      if (have_key && filter != nullptr && !sampleAllowed(found->second, *filter, obs))
           have_key = false;
-      }
 
       if (have_key)
       {
-          state_single obs = pickRandomObservation(poss_next_states);
+          markUsed(found);
+          if (filter == nullptr) obs = sampleContext(found);
           matchedOrder = effectiveOrder;
           lastMatch = state_and_observation{ key, obs };
           return obs;
@@ -201,7 +553,7 @@ state_single MarkovChain::generateObservation(const state_sequence& prevState, i
           return recurse(orderLimit - 1, matchedOrder);
 
       matchedOrder = 0;
-      state_single obs = zeroOrderSample();
+      obs = filter == nullptr ? zeroOrderSample() : zeroOrderSampleAllowed(*filter);
       lastMatch = state_and_observation{ "0", obs };
       return obs;
   };
@@ -212,23 +564,47 @@ state_single MarkovChain::generateObservation(const state_sequence& prevState, i
   return result;
 }
 
+MarkovChain::PredictionResult MarkovChain::predict(const state_sequence& context, size_t k) const
+{
+  PredictionResult result;
+  const unsigned long highest = std::min<unsigned long>(maxOrder, context.size());
+  for (unsigned long order = highest; order >= 1; --order)
+  {
+    state_single key = stateSequenceToString(context, order);
+    auto found = table->find(key);
+    if (found == table->end() || found->second.total <= 0) continue;
+
+    // the decay scale is the same for every successor, so it cancels out of the probabilities
+    const Successors& succ = found->second;
+    const size_t count = std::min(k, succ.byCount.size());
+    result.successors.reserve(count);
+    for (size_t r = 0; r < count; ++r)
+    {
+      const uint32_t i = succ.byCount[r];
+      result.successors.push_back(Prediction{ succ.observations[i], succ.counts[i] / succ.total });
+    }
+    result.order = static_cast<int>(order);
+    result.context = std::move(key);
+    break;
+  }
+  return result;
+}
+
 state_single MarkovChain::zeroOrderSample()
 {
 
-  state_sequence poss_next_states{};
   // no key - choose something at random from all next observed states
-  int randInd = 0;
-  if (model.size() > 1) randInd = rand() % model.size();
+  size_t randInd = 0;
+  if (table->size() > 1) randInd = std::uniform_int_distribution<size_t>(0, table->size() - 1)(rng);
   //std::cout << "MarkovChain::zeroOrderSample rand " << randInd << " from " << model.size() << std::endl; 
-  int ind = 0;
+  size_t ind = 0;
   state_single state = "0"; // start on the default state
   // iterate the map until we teach our random index
   // have to do this as skips are not possible
-  for (std::map<std::string,state_sequence>::iterator it=model.begin();it!=model.end(); ++it)
+  for (auto it=table->begin();it!=table->end(); ++it)
   {
     if (ind == randInd){
-      poss_next_states = (it->second);
-      state = pickRandomObservation(poss_next_states);
+      state = sampleContext(it);
       break;// jump down to the return statement 
     }
     else {
@@ -240,38 +616,512 @@ state_single MarkovChain::zeroOrderSample()
 }
 
 
+void MarkovChain::setBlending(const BlendOptions& options)
+{
+  blend = options;
+}
+
+bool MarkovChain::isBlending() const
+{
+  return blend.mode != BlendOptions::off;
+}
+
+state_single MarkovChain::generateBlended(const state_sequence& prevState, int maxOrderWanted, const ObservationFilter* filter)
+{
+  const size_t highest = std::min(static_cast<size_t>(std::max(0, maxOrderWanted)), prevState.size());
+  // the most recent states, oldest first, written once. the key for order o is 
+  // "o," followed by the tail of this from the start of the o-th most recent state
+  state_single& tail = blendTail;
+  tail.clear();
+  blendStateStarts.clear();
+  for (size_t i = prevState.size() - highest; i < prevState.size(); ++i)
+  {
+    blendStateStarts.push_back(tail.size());
+    tail.append(prevState[i]);
+    tail.push_back(',');
+  }
+
+  blendContexts.clear();
+  for (size_t order = 1; order <= highest; ++order)
+  {
+    // a blank state means the context isn't known this far back
+    if (prevState[prevState.size() - order] == "0") break;
+    blendKey.assign(std::to_string(order));
+    blendKey.push_back(',');
+    blendKey.append(tail, blendStateStarts[highest - order], std::string::npos);
+    auto found = table->find(blendKey);
+    if (found == table->end()) break;
+    blendContexts.push_back(found);
+  }
+
+  if (blendContexts.empty())
+  {
+    orderOfLastMatch = 0;
+    state_single obs = filter == nullptr ? zeroOrderSample() : zeroOrderSampleAllowed(*filter);
+    lastMatch = state_and_observation{ "0", obs };
+    return obs;
+  }
+
+  // blendWeights[o - 1] is the weight of order o
+  const size_t found = blendContexts.size();
+  blendWeights.assign(found, 0.0);
+  if (blend.mode == BlendOptions::escape)
+  {
+    double remaining = 1.0;
+    for (size_t o = found; o > 1; --o)
+    {
+      const Successors& succ = blendContexts[o - 1]->second;
+      const double seen = succ.total * effectiveScale(succ);
+      const double distinct = static_cast<double>(succ.observations.size());
+      if (seen <= 0) continue;
+      blendWeights[o - 1] = remaining * seen / (seen + distinct);
+      remaining -= blendWeights[o - 1];
+    }
+    blendWeights[0] = remaining;
+  }
+  else
+  {
+    const std::vector<double>& weights = blend.orderWeights;
+    for (size_t o = 0; o < found; ++o)
+      blendWeights[o] = weights.empty() ? 1.0 : std::max(0.0, weights[std::min(o, weights.size() - 1)]);
+  }
+  double sum = 0;
+  for (size_t o = 0; o < found; ++o)
+  {
+    if (blendContexts[o]->second.total <= 0) blendWeights[o] = 0;
+    sum += blendWeights[o];
+  }
+
+  size_t picked = found - 1;
+  if (sum > 0)
+  {
+    double target = std::uniform_real_distribution<double>(0.0, sum)(rng);
+    for (size_t o = 0; o < found; ++o)
+    {
+      if (target < blendWeights[o]) { picked = o; break; }
+      target -= blendWeights[o];
+    }
+  }
+
+  state_single obs;
+  size_t order = picked + 1;
+  if (filter != nullptr)
+  {
+    // nothing allowed at the picked order: back off from there, as generateObservation would
+    while (order > 0 && !sampleAllowed(blendContexts[order - 1]->second, *filter, obs)) --order;
+    if (order == 0)
+    {
+      orderOfLastMatch = 0;
+      obs = zeroOrderSampleAllowed(*filter);
+      lastMatch = state_and_observation{ "0", obs };
+      return obs;
+    }
+  }
+  ModelStorage::const_iterator context = blendContexts[order - 1];
+  markUsed(context);
+  if (filter == nullptr) obs = sampleContext(context);
+  orderOfLastMatch = order;
+  lastMatch = state_and_observation{ context->first, obs };
+  return obs;
+}
+
+state_single MarkovChain::zeroOrderSampleAllowed(const ObservationFilter& filter)
+{
+  updateObservationContexts();
+  // the same reservoir pick as sampleAllowed, over the distinct observations rather than the
+  // contexts, each weighted by how many contexts it follows
+  double allowedTotal = 0;
+  const state_single* picked = nullptr;
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  for (const auto& kv : observationContexts)
+  {
+    if (!filter.allows(kv.first)) continue;
+    const double contexts = static_cast<double>(kv.second);
+    allowedTotal += contexts;
+    if (picked == nullptr || unit(rng) * allowedTotal < contexts)
+      picked = &kv.first;
+  }
+  return picked == nullptr ? "0" : *picked;
+}
+
+bool MarkovChain::sampleAllowed(const Successors& succ, const ObservationFilter& filter, state_single& obs)
+{
+  // each allowed successor replaces the pick so far with probability count / allowed total so far,
+  // which leaves every one picked in proportion to its count
+  double allowedTotal = 0;
+  const state_single* picked = nullptr;
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  for (size_t i = 0; i < succ.observations.size(); ++i)
+  {
+    const double count = succ.counts[i];
+    if (count <= 0 || !filter.allows(succ.observations[i])) continue;
+    allowedTotal += count;
+    if (picked == nullptr || unit(rng) * allowedTotal < count)
+      picked = &succ.observations[i];
+  }
+  if (picked == nullptr) return false;
+  obs = *picked;
+  return true;
+}
+
+bool MarkovChain::NoteMask::allows(const state_single& observation) const
+{
+  if (observation == "0") return false;
+  int note = -1;
+  bool any = false;
+  for (const char c : observation)
+  {
+    if (c >= '0' && c <= '9')
+    {
+      note = (note < 0 ? 0 : note * 10) + (c - '0');
+      if (note > 127) return false;
+      continue;
+    }
+    if (note >= 0 && !notes.test(static_cast<size_t>(note))) return false;
+    any = any || note >= 0;
+    note = -1;
+  }
+  if (note >= 0 && !notes.test(static_cast<size_t>(note))) return false;
+  return any || note >= 0;
+}
+
+MarkovChain::NoteMask MarkovChain::NoteMask::forScale(uint16_t pitchClasses, int root)
+{
+  NoteMask mask;
+  for (int note = 0; note < 128; ++note)
+  {
+    const int degree = ((note - root) % 12 + 12) % 12;
+    if ((pitchClasses >> degree) & 1)
+      mask.notes.set(static_cast<size_t>(note));
+  }
+  return mask;
+}
+
 state_single MarkovChain::pickRandomObservation(const state_sequence& seq)
 {
   if (seq.size() == 0) // they key existed but there';s nothing there.
   {
     return "0";
   } 
-  auto ind = 0;
-  if (seq.size() > 1) ind = rand() % seq.size();  
+  size_t ind = 0;
+  if (seq.size() > 1) ind = std::uniform_int_distribution<size_t>(0, seq.size() - 1)(rng);
   return seq.at(ind);
   //return "0";
 }
 
+void MarkovChain::seed(unsigned int seedValue)
+{
+  rng.seed(seedValue);
+}
+
+void MarkovChain::mergeFrom(const MarkovChain& other)
+{
+  if (&other == this)
+  {
+    const MarkovChain copy = other;
+    mergeFrom(copy);
+    return;
+  }
+
+  makeModelPrivate();
+  const unsigned long touched = ++useClock;
+  auto it = table->begin();
+  for (const auto& kv : (*other.table))
+  {
+    // walk both sorted tables together, so keys we already have are found without a fresh search
+    while (it != table->end() && it->first < kv.first) ++it;
+    if (it == table->end() || it->first != kv.first)
+    {
+      it = table->try_emplace(kv.first).first;
+      Successors& added = table->edit(it);
+      added.order = orderFromKey(kv.first);
+      added.decayEpoch = decayEpoch;
+      modelBytes += estimateKeyBytes(kv.first);
+    }
+    Successors& succ = table->edit(it);
+    succ.lastUsed = touched;
+    normaliseEntry(succ);
+    // from the other chain's stored weights to real counts, then to ours
+    const double scale = other.effectiveScale(kv.second) * weightUnit;
+    for (size_t i = 0; i < kv.second.observations.size(); ++i)
+    {
+      const size_t added = addToSuccessors(succ, kv.second.observations[i], kv.second.counts[i] * scale);
+      if (added > 0) countObservation(kv.second.observations[i]);
+      modelBytes += added;
+    }
+    ++it;
+  }
+  evictIncrementally(other.table->size() * 2 + 16);
+}
+
+void MarkovChain::setAliasThreshold(size_t minDistinctSuccessors)
+{
+  aliasThreshold = minDistinctSuccessors;
+  makeModelPrivate();
+  for (auto it = table->begin(); it != table->end(); ++it)
+  {
+    if (!it->second.aliasValid && it->second.aliasProbability.empty()) continue;
+    Successors& succ = table->edit(it);
+    succ.aliasValid = false;
+    succ.aliasProbability.clear();
+    succ.aliasIndex.clear();
+  }
+}
+
+state_single MarkovChain::sampleContext(ModelStorage::const_iterator it)
+{
+  // contexts on shared pages only use the alias tables that were there already, and 
+  // fall back to the cumulative scan otherwise
+  const Successors& succ = it->second;
+  if (succ.observations.size() > aliasThreshold && !succ.aliasValid && canWriteInPlace(it))
+    buildAliasTable(table->edit(it));
+  return sampleSuccessors(it->second);
+}
+
+void MarkovChain::markUsed(ModelStorage::const_iterator it)
+{
+  // a context that is skipped here may be evicted sooner, but only until something is learned
+  // on its page. a shared table is never evicted from at all
+  if (canWriteInPlace(it)) table->edit(it).lastUsed = ++useClock;
+}
+
+bool MarkovChain::canWriteInPlace(ModelStorage::const_iterator it) const
+{
+  return !isModelShared() && !table->isShared(it);
+}
+
+state_single MarkovChain::sampleSuccessors(const Successors& succ)
+{
+  if (succ.total <= 0 || succ.observations.empty()) // they key existed but there's nothing there.
+    return "0";
+
+  const size_t n = succ.observations.size();
+  if (n == 1)
+    return succ.observations[0];
+
+  if (n > aliasThreshold && succ.aliasValid)
+  {
+    const size_t column = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+    const float coin = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+    if (coin < succ.aliasProbability[column])
+      return succ.observations[column];
+    return succ.observations[succ.aliasIndex[column]];
+  }
+
+  // narrow context - a cumulative scan is cheaper than keeping a table around
+  double target = std::uniform_real_distribution<double>(0.0, succ.total)(rng);
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (target < succ.counts[i])
+      return succ.observations[i];
+    target -= succ.counts[i];
+  }
+  return succ.observations.back();
+}
+
+void MarkovChain::buildAliasTable(Successors& succ)
+{
+  // Vose's method: split the scaled probabilities into under- and over-full
+  // columns, then top each small column up from a large one
+  const size_t n = succ.observations.size();
+  succ.aliasProbability.assign(n, 1.0f);
+  succ.aliasIndex.resize(n);
+
+  std::vector<double> scaled(n);
+  std::vector<uint32_t> small;
+  std::vector<uint32_t> large;
+  small.reserve(n);
+  large.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    scaled[i] = static_cast<double>(succ.counts[i]) * static_cast<double>(n) / static_cast<double>(succ.total);
+    succ.aliasIndex[i] = static_cast<uint32_t>(i);
+    if (scaled[i] < 1.0) small.push_back(static_cast<uint32_t>(i));
+    else large.push_back(static_cast<uint32_t>(i));
+  }
+
+  while (!small.empty() && !large.empty())
+  {
+    const uint32_t s = small.back(); small.pop_back();
+    const uint32_t l = large.back();
+    succ.aliasProbability[s] = static_cast<float>(scaled[s]);
+    succ.aliasIndex[s] = l;
+    scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+    if (scaled[l] < 1.0)
+    {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // whatever is left over is full, give or take rounding error
+  for (uint32_t i : large) succ.aliasProbability[i] = 1.0f;
+  for (uint32_t i : small) succ.aliasProbability[i] = 1.0f;
+  succ.aliasValid = true;
+}
+
 std::string MarkovChain::toString()
 {
   //std::cout << "MarkovChain::toString model size " << model.size() << std::endl;
   std::string s{""};
-  for(auto const& kv_pair: model){
+  for(auto const& kv_pair: *table){
     s += kv_pair.first + ":";
-    s += this->stateSequenceToString(model[kv_pair.first]);
+    s += this->stateSequenceToString(getOptionsForSequenceKey(kv_pair.first));
     s += "\n";
   }
   return s;
 }
 
 std::string MarkovChain::toStringBinary() const
+{
+  return toStringBinary(CompactionOptions{}, nullptr);
+}
+
+std::string MarkovChain::toStringBinaryV1() const
+{
+  return writeBinaryV1(CompactionOptions{}, nullptr);
+}
+
+std::string MarkovChain::toStringBinary(const CompactionOptions& options, CompactionStats* stats) const
+{
+  std::string buffer = writeBinaryV2(options, stats);
+  // keys that did not come from stateSequenceToString cannot be split into symbols
+  if (buffer.empty() && !table->empty())
+    return writeBinaryV1(options, stats);
+  return buffer;
+}
+
+std::string MarkovChain::writeBinaryV2(const CompactionOptions& options, CompactionStats* stats) const
+{
+  CompactionStats counted;
+  counted.contextsBefore = table->size();
+  counted.bytesBefore = 4;
+
+  // gather the surviving contexts as symbol ids, most recent state first,
+  // so contexts that extend each other share a prefix
+  struct Context
+  {
+    std::vector<uint32_t> symbols;
+    size_t firstSuccessor;
+    const Successors* succ;
+  };
+  std::vector<Context> contexts;
+  std::vector<uint32_t> successorIds;
+  std::vector<unsigned long long> successorCounts;
+  std::unordered_map<std::string, uint32_t> symbolIds;
+  std::vector<const std::string*> symbols;
+  std::vector<unsigned long long> symbolUses;
+  std::vector<std::string> tokens;
+
+  auto intern = [&](const std::string& symbol) -> uint32_t
+  {
+    auto inserted = symbolIds.emplace(symbol, static_cast<uint32_t>(symbols.size()));
+    if (inserted.second)
+    {
+      symbols.push_back(&inserted.first->first);
+      symbolUses.push_back(0);
+    }
+    ++symbolUses[inserted.first->second];
+    return inserted.first->second;
+  };
+
+  for (const auto& kv : *table)
+  {
+    unsigned long long expandedTotal = 0;
+    counted.bytesBefore += serialisedEntryBytes(kv.first, kv.second, expandedTotal);
+    counted.observationsBefore += expandedTotal;
+
+    if (!keepForCompaction(kv.second, options))
+      continue;
+    if (!splitKey(kv.first, tokens))
+      return {};
+
+    counted.observationsAfter += expandedTotal;
+    Context context;
+    context.firstSuccessor = successorIds.size();
+    context.succ = &kv.second;
+    context.symbols.reserve(tokens.size());
+    for (auto it = tokens.rbegin(); it != tokens.rend(); ++it)
+      context.symbols.push_back(intern(*it));
+
+    const double scale = effectiveScale(kv.second);
+    for (size_t i = 0; i < kv.second.observations.size(); ++i)
+    {
+      successorIds.push_back(intern(kv.second.observations[i]));
+      successorCounts.push_back(expandedCount(kv.second.counts[i] * scale));
+    }
+    contexts.push_back(std::move(context));
+  }
+
+  // frequent symbols get the small ids, which are the one byte varints
+  std::vector<uint32_t> byUse(symbols.size());
+  for (uint32_t i = 0; i < byUse.size(); ++i) byUse[i] = i;
+  std::stable_sort(byUse.begin(), byUse.end(), [&](uint32_t a, uint32_t b) { return symbolUses[a] > symbolUses[b]; });
+  std::vector<uint32_t> remap(symbols.size());
+  for (uint32_t i = 0; i < byUse.size(); ++i) remap[byUse[i]] = i;
+  for (auto& context : contexts)
+    for (auto& id : context.symbols) id = remap[id];
+  for (auto& id : successorIds) id = remap[id];
+
+  std::sort(contexts.begin(), contexts.end(), [](const Context& a, const Context& b) { return a.symbols < b.symbols; });
+
+  std::string buffer;
+  buffer.reserve(contexts.size() * 8 + symbols.size() * 4 + successorIds.size() * 2);
+  buffer.append(binaryMagic, sizeof(binaryMagic));
+  appendVarint(buffer, binaryVersion);
+
+  appendVarint(buffer, symbols.size());
+  for (uint32_t oldId : byUse)
+  {
+    appendVarint(buffer, symbols[oldId]->size());
+    buffer.append(*symbols[oldId]);
+  }
+
+  appendVarint(buffer, contexts.size());
+  const std::vector<uint32_t>* previous = nullptr;
+  for (const auto& context : contexts)
+  {
+    size_t shared = 0;
+    if (previous != nullptr)
+      while (shared < previous->size() && shared < context.symbols.size() && (*previous)[shared] == context.symbols[shared])
+        ++shared;
+    appendVarint(buffer, shared);
+    appendVarint(buffer, context.symbols.size() - shared);
+    for (size_t i = shared; i < context.symbols.size(); ++i)
+      appendVarint(buffer, context.symbols[i]);
+
+    const size_t successorCount = context.succ->observations.size();
+    appendVarint(buffer, successorCount);
+    for (size_t i = context.firstSuccessor; i < context.firstSuccessor + successorCount; ++i)
+    {
+      appendVarint(buffer, successorIds[i]);
+      appendVarint(buffer, successorCounts[i]);
+    }
+    previous = &context.symbols;
+  }
+
+  if (stats != nullptr)
+  {
+    counted.contextsAfter = contexts.size();
+    counted.bytesAfter = buffer.size();
+    *stats = counted;
+  }
+  return buffer;
+}
+
+std::string MarkovChain::writeBinaryV1(const CompactionOptions& options, CompactionStats* stats) const
 {
   std::string buffer;
-  buffer.reserve(model.size() * 32);
+  buffer.reserve(table->size() * 32);
+
+  CompactionStats counted;
+  counted.contextsBefore = table->size();
+  counted.bytesBefore = 4;
 
-  appendUint32(buffer, static_cast<uint32_t>(model.size()));
+  // entry count is patched in at the end once we know how many contexts were kept
+  appendUint32(buffer, 0);
+  uint32_t written = 0;
 
-  for (const auto& kv : model)
+  for (const auto& kv : *table)
   {
     const auto& key = kv.first;
     const auto& values = kv.second;
@@ -279,26 +1129,105 @@ std::string MarkovChain::toStringBinary() const
     if (key.size() > std::numeric_limits<uint32_t>::max())
       return {};
 
-    appendUint32(buffer, static_cast<uint32_t>(key.size()));
-    buffer.append(key.data(), key.size());
+    // v1 stores one entry per observation, so expand the counts back out
+    const double scale = effectiveScale(values);
+    unsigned long long expandedTotal = 0;
+    const size_t entryBytes = serialisedEntryBytes(key, values, expandedTotal);
+    counted.observationsBefore += expandedTotal;
+    counted.bytesBefore += entryBytes;
 
-    if (values.size() > std::numeric_limits<uint32_t>::max())
+    if (!keepForCompaction(values, options))
+      continue;
+
+    if (expandedTotal > std::numeric_limits<uint32_t>::max())
       return {};
 
-    appendUint32(buffer, static_cast<uint32_t>(values.size()));
-    for (const auto& obs : values)
+    counted.observationsAfter += expandedTotal;
+    ++written;
+    appendUint32(buffer, static_cast<uint32_t>(key.size()));
+    buffer.append(key.data(), key.size());
+
+    appendUint32(buffer, static_cast<uint32_t>(expandedTotal));
+    for (size_t i = 0; i < values.observations.size(); ++i)
     {
+      const auto& obs = values.observations[i];
       if (obs.size() > std::numeric_limits<uint32_t>::max())
         return {};
 
-      appendUint32(buffer, static_cast<uint32_t>(obs.size()));
-      buffer.append(obs.data(), obs.size());
+      const unsigned long repeats = expandedCount(values.counts[i] * scale);
+      for (unsigned long c = 0; c < repeats; ++c)
+      {
+        appendUint32(buffer, static_cast<uint32_t>(obs.size()));
+        buffer.append(obs.data(), obs.size());
+      }
     }
   }
 
+  buffer[0] = static_cast<char>(written & 0xFFu);
+  buffer[1] = static_cast<char>((written >> 8) & 0xFFu);
+  buffer[2] = static_cast<char>((written >> 16) & 0xFFu);
+  buffer[3] = static_cast<char>((written >> 24) & 0xFFu);
+
+  if (stats != nullptr)
+  {
+    counted.contextsAfter = written;
+    counted.bytesAfter = buffer.size();
+    *stats = counted;
+  }
   return buffer;
 }
 
+size_t MarkovChain::serialisedEntryBytes(const state_single& key, const Successors& succ, unsigned long long& expandedTotal) const
+{
+  const double scale = effectiveScale(succ);
+  size_t bytes = 4 + key.size() + 4;
+  expandedTotal = 0;
+  for (size_t i = 0; i < succ.observations.size(); ++i)
+  {
+    const unsigned long repeats = expandedCount(succ.counts[i] * scale);
+    expandedTotal += repeats;
+    bytes += repeats * (4 + succ.observations[i].size());
+  }
+  return bytes;
+}
+
+bool MarkovChain::keepForCompaction(const Successors& succ, const CompactionOptions& options) const
+{
+  if (options.maxOrder > 0 && succ.order > options.maxOrder)
+    return false;
+  if (succ.order >= options.minCountFromOrder && succ.total * effectiveScale(succ) < options.minCount)
+    return false;
+  return true;
+}
+
+MarkovChain::CompactionStats MarkovChain::compact(const CompactionOptions& options)
+{
+  // bytes are measured in the v1 format so the numbers match what a save would see
+  CompactionStats stats;
+  stats.contextsBefore = table->size();
+  stats.bytesBefore = 4;
+  stats.bytesAfter = 4;
+
+  makeModelPrivate();
+  for (auto it = table->begin(); it != table->end();)
+  {
+    unsigned long long expanded = 0;
+    const size_t bytes = serialisedEntryBytes(it->first, it->second, expanded);
+    stats.observationsBefore += expanded;
+    stats.bytesBefore += bytes;
+    if (keepForCompaction(it->second, options))
+    {
+      stats.observationsAfter += expanded;
+      stats.bytesAfter += bytes;
+      ++it;
+      continue;
+    }
+    it = eraseEntry(it);
+  }
+  stats.contextsAfter = table->size();
+  return stats;
+}
+
 bool MarkovChain::validateStateToObservationsString(const std::string& data)
 {
 //    * super basic: minimal string is '1,a:2,b'-> length >= 7  
@@ -477,6 +1406,105 @@ bool MarkovChain::fromStringFast(const std::string& savedModel)
 }
 
 bool MarkovChain::fromStringBinary(const std::string& savedModel)
+{
+  if (savedModel.size() >= sizeof(binaryMagic) && savedModel.compare(0, sizeof(binaryMagic), binaryMagic, sizeof(binaryMagic)) == 0)
+    return readBinaryV2(savedModel);
+  return readBinaryV1(savedModel);
+}
+
+bool MarkovChain::readBinaryV2(const std::string& savedModel)
+{
+  size_t offset = sizeof(binaryMagic);
+  uint64_t version = 0;
+  if (!readVarint(savedModel, offset, version) || version != binaryVersion)
+    return false;
+
+  // every symbol, context and successor takes at least a byte, which bounds the counts
+  uint64_t symbolCount = 0;
+  if (!readVarint(savedModel, offset, symbolCount) || symbolCount > savedModel.size() - offset)
+    return false;
+
+  std::vector<state_single> symbols;
+  symbols.reserve(static_cast<size_t>(symbolCount));
+  for (uint64_t i = 0; i < symbolCount; ++i)
+  {
+    uint64_t length = 0;
+    if (!readVarint(savedModel, offset, length) || length > savedModel.size() - offset)
+      return false;
+    symbols.emplace_back(savedModel.data() + offset, static_cast<size_t>(length));
+    offset += static_cast<size_t>(length);
+  }
+
+  uint64_t contextCount = 0;
+  if (!readVarint(savedModel, offset, contextCount) || contextCount > savedModel.size() - offset)
+    return false;
+
+  ModelStorage::Page parsed;
+  std::vector<uint32_t> context; // most recent state first
+  state_single key;
+
+  for (uint64_t c = 0; c < contextCount; ++c)
+  {
+    uint64_t shared = 0;
+    uint64_t added = 0;
+    if (!readVarint(savedModel, offset, shared) || !readVarint(savedModel, offset, added))
+      return false;
+    if (shared > context.size() || added > savedModel.size() - offset)
+      return false;
+
+    context.resize(static_cast<size_t>(shared));
+    for (uint64_t i = 0; i < added; ++i)
+    {
+      uint64_t id = 0;
+      if (!readVarint(savedModel, offset, id) || id >= symbols.size())
+        return false;
+      context.push_back(static_cast<uint32_t>(id));
+    }
+    if (context.empty())
+      return false;
+
+    key = std::to_string(context.size());
+    key.push_back(',');
+    for (auto it = context.rbegin(); it != context.rend(); ++it)
+    {
+      key.append(symbols[*it]);
+      key.push_back(',');
+    }
+
+    uint64_t successorCount = 0;
+    if (!readVarint(savedModel, offset, successorCount) || successorCount > savedModel.size() - offset)
+      return false;
+
+    Successors values;
+    values.decayEpoch = decayEpoch;
+    values.observations.reserve(static_cast<size_t>(successorCount));
+    values.counts.reserve(static_cast<size_t>(successorCount));
+    for (uint64_t s = 0; s < successorCount; ++s)
+    {
+      uint64_t id = 0;
+      uint64_t count = 0;
+      if (!readVarint(savedModel, offset, id) || id >= symbols.size() || !readVarint(savedModel, offset, count))
+        return false;
+      // the writer never repeats a successor, so no need to search for it
+      values.observations.push_back(symbols[id]);
+      values.counts.push_back(static_cast<double>(count) * weightUnit);
+      values.total += values.counts.back();
+    }
+    rankSuccessors(values);
+
+    parsed.emplace(key, std::move(values));
+  }
+
+  table = std::make_shared<ModelStorage>(std::move(parsed));
+  lineage = newLineage();
+  recalculateMemoryUsage();
+  evictionCursor.clear();
+  decayCursor.clear();
+  sweepMinOrder = 0;
+  return true;
+}
+
+bool MarkovChain::readBinaryV1(const std::string& savedModel)
 {
   size_t offset = 0;
   uint32_t entryCount = 0;
@@ -484,7 +1512,8 @@ bool MarkovChain::fromStringBinary(const std::string& savedModel)
   if (!readUint32(savedModel, offset, entryCount))
     return false;
 
-  std::map<state_single, state_sequence> parsed;
+  ModelStorage::Page parsed;
+  state_single obs;
 
   for (uint32_t i = 0; i < entryCount; ++i)
   {
@@ -502,8 +1531,8 @@ bool MarkovChain::fromStringBinary(const std::string& savedModel)
     if (!readUint32(savedModel, offset, valueCount))
       return false;
 
-    state_sequence values;
-    values.reserve(valueCount);
+    Successors values;
+    values.decayEpoch = decayEpoch;
 
     for (uint32_t v = 0; v < valueCount; ++v)
     {
@@ -514,20 +1543,138 @@ bool MarkovChain::fromStringBinary(const std::string& savedModel)
       if (offset + obsSize > savedModel.size())
         return false;
 
-      values.emplace_back(savedModel.data() + offset, obsSize);
+      obs.assign(savedModel.data() + offset, obsSize);
+      addToSuccessors(values, obs, weightUnit);
       offset += obsSize;
     }
 
     parsed.emplace(std::move(key), std::move(values));
   }
 
-  model.swap(parsed);
+  table = std::make_shared<ModelStorage>(std::move(parsed));
+  lineage = newLineage();
+  recalculateMemoryUsage();
+  evictionCursor.clear();
+  decayCursor.clear();
+  sweepMinOrder = 0;
   return true;
 }
 
 void MarkovChain::reset()
 {
-    model.clear();
+    if (isModelShared())
+        table = emptyModel();
+    else
+        table->clear();
+    lineage = newLineage();
+    modelBytes = 0;
+    observationContexts.clear();
+    observationContextsValid = true;
+    evictionCursor.clear();
+    decayCursor.clear();
+    sweepMinOrder = 0;
+}
+
+MarkovChain::SharedModel MarkovChain::releaseModel()
+{
+    // the empty table is shared by everyone, so this doesn't allocate
+    SharedModel released = std::exchange(table, emptyModel());
+    reset();
+    return released;
+}
+
+MarkovChain::SharedModel MarkovChain::emptyModel()
+{
+    static const SharedModel empty = std::make_shared<ModelStorage>();
+    return empty;
+}
+
+unsigned long MarkovChain::newLineage()
+{
+    static std::atomic<unsigned long> lineages { 0 };
+    return ++lineages;
+}
+
+bool MarkovChain::isModelShared() const
+{
+    return table.use_count() > 1;
+}
+
+size_t MarkovChain::pagesNotSharedWith(const MarkovChain& other) const
+{
+  return table->pagesNotIn(*other.table);
+}
+
+void MarkovChain::makeModelPrivate()
+{
+    if (isModelShared())
+        table = std::make_shared<ModelStorage>(*table);
+}
+
+void MarkovChain::prepareForSharing()
+{
+    makeModelPrivate();
+    // alias tables are normally built on first use, which a shared table can't do
+    for (auto it = table->begin(); it != table->end(); ++it)
+    {
+        if (it->second.observations.size() > aliasThreshold && !it->second.aliasValid)
+            buildAliasTable(table->edit(it));
+    }
+    // and so is the observation summary, which is copied along with the table
+    updateObservationContexts();
+}
+
+void MarkovChain::shareModelFrom(const MarkovChain& other)
+{
+    restoreVersion(other.saveVersion());
+    if (other.observationContextsValid)
+    {
+        observationContexts = other.observationContexts;
+        observationContextsValid = true;
+    }
+}
+
+MarkovChain::ModelVersion MarkovChain::saveVersion() const
+{
+    ModelVersion version;
+    version.table = table;
+    version.modelBytes = modelBytes;
+    version.weightUnit = weightUnit;
+    version.previousEpochUnit = previousEpochUnit;
+    version.decayEpoch = decayEpoch;
+    version.lineage = lineage;
+    return version;
+}
+
+void MarkovChain::restoreVersion(ModelVersion version)
+{
+    lineage = version.table ? version.lineage : newLineage();
+    table = version.table ? std::move(version.table) : emptyModel();
+    modelBytes = version.modelBytes;
+    // the stored weights are relative to the decay clock they were saved with
+    weightUnit = version.weightUnit;
+    previousEpochUnit = version.previousEpochUnit;
+    decayEpoch = version.decayEpoch;
+    // rebuilt from the table the next time it's needed
+    observationContextsValid = false;
+    evictionCursor.clear();
+    decayCursor.clear();
+    sweepMinOrder = 0;
+}
+
+size_t MarkovChain::unsharedBytes(const ModelVersion& version, const ModelVersion& newer)
+{
+  if (!version.table || version.table->pageCount() == 0) return 0;
+  const size_t pages = version.table->pageCount();
+  size_t unshared = pages;
+  if (newer.table && newer.lineage == version.lineage)
+  {
+    // whichever was copied from the other has copied a page for every page it doesn't share
+    const size_t copies = version.table->pageCopies();
+    const size_t newerCopies = newer.table->pageCopies();
+    unshared = std::min(pages, copies > newerCopies ? copies - newerCopies : newerCopies - copies);
+  }
+  return version.modelBytes / pages * unshared;
 }
 
 int MarkovChain::getOrderOfLastMatch()
@@ -542,66 +1689,63 @@ state_and_observation MarkovChain::getLastMatch()
 
 void  MarkovChain::removeMapping(state_single state_key, state_single unwanted_option)
 {
-  if (model.size() ==0 ) return; 
-  state_sequence current_options{};
-  bool have_key = true;
-  try
-  {
-    current_options = model.at(state_key);
-  }
-  catch (const std::out_of_range& oor)
-  {
-    have_key = false; // nothing to do as we don't even have the state_key 
-  }
-  if (have_key) // we have seen this state_key
-  {
-    // create a new set of possible 
-    state_sequence updated_options{};
-    for (const state_single& obs : current_options)
-    {
-      if (obs != unwanted_option)
-      {
-        updated_options.push_back(obs);
-      }
-    }
-    this->model[state_key] = updated_options;
-  }
+  if (table->size() ==0 ) return; 
+  makeModelPrivate();
+  auto found = table->find(state_key);
+  if (found == table->end()) return; // nothing to do as we don't even have the state_key 
+
+  // the key stays, even if it ends up with no observations
+  Successors& succ = table->edit(found);
+  auto it = std::find(succ.observations.begin(), succ.observations.end(), unwanted_option);
+  if (it == succ.observations.end()) return;
+  const size_t index = static_cast<size_t>(it - succ.observations.begin());
+  succ.total -= succ.counts[index];
+  modelBytes -= std::min(estimateObservationBytes(*it), modelBytes);
+  uncountObservation(*it);
+  succ.observations.erase(it);
+  succ.counts.erase(succ.counts.begin() + static_cast<std::ptrdiff_t>(index));
+  if (succ.observations.empty()) succ.total = 0;
+  succ.aliasValid = false;
+  rankSuccessors(succ);
 }
 
 void MarkovChain::amplifyMapping(state_single state_key, state_single wanted_option)
 {
-  if (model.size() ==0 ) return; 
-  state_sequence options = getOptionsForSequenceKey(state_key);
-  if (options.size() == 0) // nothing mapped to this key... easy! 
+  if (table->size() ==0 ) return; 
+  makeModelPrivate();
+  Successors& succ = entryForKey(state_key);
+  normaliseEntry(succ);
+  if (succ.total <= 0) // nothing mapped to this key... easy! 
   {
-    options.push_back(wanted_option);
-    this->model[state_key] = options; 
+    const size_t added = addToSuccessors(succ, wanted_option, weightUnit);
+    if (added > 0) countObservation(wanted_option);
+    modelBytes += added;
     return; 
   }
   // how many of the wanted option are there, relative to the total?
-  float wanted = 0;
-  float othermappings = 0;
-  for (const state_single& s : options) {
-    if (s == wanted_option) wanted ++;
-    else othermappings ++;
-  }
+  double wanted = 0;
+  auto it = std::find(succ.observations.begin(), succ.observations.end(), wanted_option);
+  if (it != succ.observations.end())
+    wanted = succ.counts[static_cast<size_t>(it - succ.observations.begin())];
+  const double othermappings = succ.total - wanted;
   // basically match the number of othermappings
   // to make this mapping as likely as any other
-  for (auto i=0;i<othermappings;i++) model[state_key].push_back(wanted_option);
+  const size_t added = addToSuccessors(succ, wanted_option, othermappings);
+  if (added > 0) countObservation(wanted_option);
+  modelBytes += added;
 }
 
 
 state_sequence MarkovChain::getOptionsForSequenceKey(state_single seqAsKey)
 {
   state_sequence options{};
-  try
-  {
-    options = model.at(seqAsKey);
-  }
-  catch (const std::out_of_range& oor)
-  {
-    // that's ok...we caught it :) 
-  }
+  auto found = table->find(seqAsKey);
+  if (found == table->end()) return options; // that's ok
+
+  const Successors& succ = found->second;
+  const double scale = effectiveScale(succ);
+  for (size_t i = 0; i < succ.observations.size(); ++i)
+    options.insert(options.end(), expandedCount(succ.counts[i] * scale), succ.observations[i]);
   return options; 
 }
 
@@ -628,7 +1772,7 @@ std::vector<std::string> MarkovChain::tokenise(const std::string& input, char se
 
 long MarkovChain::size()
 {
-  return model.size();
+  return table->size();
 }
 
 bool MarkovChain::validateStateSequence(const state_sequence& seq)
@@ -646,5 +1790,5 @@ bool MarkovChain::validateStateSequence(const state_sequence& seq)
 
 size_t MarkovChain::getModelSize()
 {
-  return this->model.size();
+  return table->size();
 }
@@ -10,9 +10,12 @@
 */
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 #include <random>
 #include <cstdint>
+#include <bitset>
+#include "PagedMap.h"
 
 #pragma once
 
@@ -25,6 +28,31 @@ typedef std::pair<state_single, state_single> state_and_observation;
  */
 class MarkovChain {
   public:
+    /**
+     * Controls which contexts survive compaction. A context is dropped if it was seen 
+     * fewer than minCount times and its order is at least minCountFromOrder, or if its
+     * order is above maxOrder. The defaults keep everything.
+     */
+    struct CompactionOptions
+    {
+      double minCount { 0 };
+      unsigned long minCountFromOrder { 2 };
+      unsigned long maxOrder { 0 }; // 0 = no limit
+    };
+    /** 
+     * What compaction removed. compact() measures bytes in the v1 binary format. 
+     * toStringBinary measures bytesBefore in v1 too, and bytesAfter is what it actually wrote,
+     * so the difference covers both compaction and the v2 encoding.
+     */
+    struct CompactionStats
+    {
+      size_t contextsBefore { 0 };
+      size_t contextsAfter { 0 };
+      unsigned long long observationsBefore { 0 };
+      unsigned long long observationsAfter { 0 };
+      size_t bytesBefore { 0 };
+      size_t bytesAfter { 0 };
+    };
     MarkovChain(unsigned long _maxOrder=100);
     ~MarkovChain();
     /** 
@@ -67,7 +95,7 @@ class MarkovChain {
    * @param state_sequence: a vector of strings 
    */
 
-    std::string stateSequenceToString(const state_sequence& sequence);
+    std::string stateSequenceToString(const state_sequence& sequence) const;
   /**
    * stateSequenceToString 
    * Converts a state_sequence into a string that can be used as a key
@@ -78,7 +106,7 @@ class MarkovChain {
    * @param max_order:an int representing which limits how much of the sequence we use 
    */
 
-    std::string stateSequenceToString(const state_sequence& sequence, long unsigned int maxOrder);
+    std::string stateSequenceToString(const state_sequence& sequence, long unsigned int maxOrder) const;
     /**
      * generateObservation: generate a new observation from the chain. Tries to get highest possible 
      * order match to the incoming sequence by recursively testing sequences at length len(sequence) -> 1
@@ -93,10 +121,119 @@ class MarkovChain {
      * @return a state sampled from the model
      */
     state_single generateObservation(const state_sequence& prevState, int maxOrderWanted, bool needChoice=false);
+  /**
+   * How generateObservation picks the order to sample from. off is strict backoff: the highest
+   * order that matches. The blending modes mix the successors of every order that matches instead,
+   * PPM style. escape weights each order by the chance that the next order up would not have
+   * predicted the observation: a context seen T times with n distinct successors keeps T/(T+n) of
+   * what reaches it and escapes the rest downwards, and order 1 keeps whatever is left. weighted
+   * mixes the orders in proportion to orderWeights instead.
+   */
+    struct BlendOptions
+    {
+      enum Mode { off, escape, weighted };
+      Mode mode { off };
+      /** weighted only: the weight of order 1, 2 and so on. orders past the end use the last weight */
+      std::vector<double> orderWeights;
+    };
+  /**
+   * choose between backoff and blending. When blending, needChoice is ignored, as a context with
+   * a single successor already leaves room for the lower orders
+   */
+    void setBlending(const BlendOptions& options);
+    bool isBlending() const;
+  /** says which observations constrained generation may return */
+    class ObservationFilter
+    {
+    public:
+      virtual ~ObservationFilter() = default;
+      virtual bool allows(const state_single& observation) const = 0;
+    };
+  /**
+   * A filter for observations that are lists of midi note numbers, e.g. "60-64-67-" as the plugin's
+   * pitch model stores chords. An observation is allowed if every note in it is in the mask.
+   * "0", the blank state, never is. Checking one doesn't allocate
+   */
+    class NoteMask : public ObservationFilter
+    {
+    public:
+      std::bitset<128> notes;
+      bool allows(const state_single& observation) const override;
+      /**
+       * every note whose pitch class is in the scale. bit n of pitchClasses is n semitones 
+       * above root, which is 0 for C to 11 for B
+       */
+      static NoteMask forScale(uint16_t pitchClasses, int root);
+    };
+  /**
+   * generateObservation, but only returning observations the filter allows. At each order the 
+   * matched context's allowed successors are sampled in proportion to their counts, in one pass 
+   * and without allocating. If the context has none, it falls back to a lower order. At order 0 it 
+   * picks from the allowed observations the model knows, and returns "0" if none is allowed
+   */
+    state_single generateObservation(const state_sequence& prevState, int maxOrderWanted, bool needChoice, const ObservationFilter& filter);
+  /** one of the successors returned by predict */
+    struct Prediction
+    {
+      state_single observation;
+      double probability { 0 };
+    };
+  /** what predict found: the most probable successors first, and the order of the context they follow */
+    struct PredictionResult
+    {
+      std::vector<Prediction> successors;
+      int order { 0 };
+      state_single context;
+    };
+  /**
+   * predict: the k most probable observations to follow the sent context, with their probabilities,
+   * without sampling or changing anything. The context is matched the way generateObservation matches
+   * it, highest order first. Each context keeps its successors ranked by count as it learns, so this
+   * costs a lookup per order tried plus k, not a scan of the successors. If nothing matches at order
+   * 1 or above, the result is empty and its order is 0.
+   * @param context - the lookup state, most recent state last
+   * @param k - how many successors to return at most
+   */
+    PredictionResult predict(const state_sequence& context, size_t k) const;
   /**
    * Picks a random observation from the sent sequence. 
    */
     state_single pickRandomObservation(const state_sequence& seq);
+  /**
+   * Contexts with more distinct successors than this get a Walker/Vose alias
+   * table the first time they are sampled, so sampling is O(1) instead of a
+   * cumulative scan over the counts. 
+   */
+    void setAliasThreshold(size_t minDistinctSuccessors);
+  /** restart the random number generator from the sent seed, so generation can be repeated exactly */
+    void seed(unsigned int seedValue);
+  /**
+   * add the other chain's transition counts to this one, context by context. Both tables are 
+   * sorted, so it is one linear pass over the two of them. Counts carry over with any forgetting 
+   * the other chain has applied, and merged contexts count as just used for the memory budget.
+   */
+    void mergeFrom(const MarkovChain& other);
+  /**
+   * Cap the approximate memory used by the transition table. 0 means no limit.
+   * Once over budget, each call to addObservationAllOrders evicts a bounded number
+   * of contexts: high order, low count contexts that have not been used since the 
+   * current eviction sweep started go first. The criteria relax on each full sweep
+   * that fails to get under budget, so it never does a big pause.
+   */
+    void setMemoryBudget(size_t maxBytes);
+  /** returns the estimated number of bytes used by the transition table */
+    size_t getApproxMemoryUsage() const;
+  /**
+   * Make the chain forget. Every decay step multiplies all existing transition weights 
+   * by decayPerStep (0-1, 1 means never forget). This is applied lazily by growing the 
+   * weight given to new observations rather than by touching old ones.
+   * Observations whose weight falls below pruneEpsilon are dropped by a background sweep,
+   * a few contexts at a time.
+   * addObservationAllOrders advances one step, so by default this is event based. 
+   */
+    void setDecay(double decayPerStep, double pruneEpsilon=0.05);
+  /** advance the decay clock by the sent number of steps, e.g. for time based forgetting */
+    void advanceDecay(double steps);
   /**
    * toString: convert the current model into a string for saving etc.
    * Example: 
@@ -108,8 +245,25 @@ class MarkovChain {
      * @return a string that can be sent to 'fromString' to recreate the model later
      */
     std::string toString();
-    /** Serialise the model into a compact binary blob (little-endian length-prefixed). */
+    /** 
+     * Serialise the model into a compact binary blob (format v2): a magic/version header,
+     * a dictionary of every state written once, then each context as varint symbol ids 
+     * sharing a prefix with the one before, and its successors as varint (id, count) pairs.
+     * Decayed counts are rounded to whole numbers.
+     */
     std::string toStringBinary() const;
+    /** The original binary format: little-endian length-prefixed, one entry per observation. */
+    std::string toStringBinaryV1() const;
+    /**
+     * Serialise only the contexts that pass the sent compaction options, leaving the 
+     * model itself untouched. If stats is not null, it is filled in with what was left out.
+     */
+    std::string toStringBinary(const CompactionOptions& options, CompactionStats* stats) const;
+    /**
+     * Permanently remove the contexts that fail the sent compaction options
+     * @return what was removed 
+     */
+    CompactionStats compact(const CompactionOptions& options);
     /**
      * fromString: recreate the model from the sent string
      * @param savedModel: the model we want
@@ -120,7 +274,7 @@ class MarkovChain {
      * Faster parser that minimises temporary allocations while rebuilding the model.
      */
     bool fromStringFast(const std::string& savedModel);
-    /** Deserialise a blob produced by toStringBinary(). */
+    /** Deserialise a blob produced by toStringBinary() or toStringBinaryV1(). */
     bool fromStringBinary(const std::string& savedModel);
 
     /** Yank the chain, as it were. 
@@ -166,9 +320,185 @@ class MarkovChain {
   /** returns the number of keys in the model's transition table */
     size_t getModelSize();
 private:
+/**
+ * The observations seen after a given key. Each distinct observation is stored once
+ * with a count of how many times it was seen. The alias table is only built for 
+ * contexts above aliasThreshold and is thrown away whenever the counts change.
+ */
+    struct Successors
+    {
+      state_sequence observations;
+      // weights are stored relative to weightUnit at the time the entry was last touched
+      // see effectiveScale
+      std::vector<double> counts;
+      double total { 0 };
+      // indices into observations, most seen first. ties keep the order they were first seen in
+      std::vector<uint32_t> byCount;
+      std::vector<float> aliasProbability;
+      std::vector<uint32_t> aliasIndex;
+      bool aliasValid { false };
+      unsigned long order { 0 };
+      unsigned long lastUsed { 0 };
+      unsigned long decayEpoch { 0 };
+    };
+public:
+/**
+ * The transition table. Only exposed so that releaseModel and shareModelFrom can hand it out.
+ * Chains share tables copy-on-write: a shared table is never written to, and any change
+ * first gives the chain its own copy. The copy is of the table's short list of page directories,
+ * and each directory and page is only copied when it is written to (see PagedMap), so copying a 
+ * chain is cheap
+ */
+    using ModelStorage = PagedMap<state_single,Successors>;
+    using SharedModel = std::shared_ptr<ModelStorage>;
+/**
+ * Same as reset, but the old transition table is handed back instead of being freed, 
+ * so the caller can destroy it somewhere the cost doesn't matter (i.e. not the audio thread)
+ */
+    SharedModel releaseModel();
+/** true if another chain is using the same transition table */
+    bool isModelShared() const;
+/** how many pages of this chain's transition table the other chain doesn't share */
+    size_t pagesNotSharedWith(const MarkovChain& other) const;
+/** 
+ * take a private copy of the transition table if it is shared, so it can be changed. 
+ * this copies the list of page directories, not the contexts; see ModelStorage 
+ */
+    void makeModelPrivate();
+/** 
+ * build everything generation would otherwise build lazily, so the table can be shared and 
+ * generated from by several chains (on several threads) without being written to 
+ */
+    void prepareForSharing();
+/** 
+ * use the other chain's transition table, without copying it, until something changes it. 
+ * the other chain should have been through prepareForSharing 
+ */
+    void shareModelFrom(const MarkovChain& other);
+/**
+ * A saved state of the model: the transition table, and the decay clock its weights are 
+ * relative to. Taking and restoring one shares the table rather than copying it
+ */
+    struct ModelVersion
+    {
+      SharedModel table;
+      size_t modelBytes { 0 };
+      double weightUnit { 1.0 };
+      double previousEpochUnit { 1.0 };
+      unsigned long decayEpoch { 0 };
+      // versions with the same lineage have tables that were copied from one another. 
+      // a reset or a load starts a new one
+      unsigned long lineage { 0 };
+    };
+    ModelVersion saveVersion() const;
+/** put the model back to a saved version. the rest of the chain's settings are kept */
+    void restoreVersion(ModelVersion version);
+/**
+ * roughly what keeping version costs when newer is kept anyway: the bytes on the pages of its
+ * table that newer's doesn't use, costing each page at the version's average bytes per page. 
+ * The pages are counted as they are copied (see PagedMap::pageCopies) rather than compared, so 
+ * this doesn't depend on the size of the table. Everything counts if they are not the same lineage
+ */
+    static size_t unsharedBytes(const ModelVersion& version, const ModelVersion& newer);
+private:
+/** the table every new or reset chain starts with */
+    static SharedModel emptyModel();
+/** a lineage no other table has had, for a table that wasn't copied from the last one */
+    static unsigned long newLineage();
+/**
+ * add count observations of obs to the sent successors 
+ * returns the number of bytes that added to the estimated model size
+ */
+    static size_t addToSuccessors(Successors& succ, const state_single& obs, double count);
+/** rebuild byCount from scratch, e.g. after successors were removed */
+    static void rankSuccessors(Successors& succ);
+/**
+ * find or create the entry for the sent key, keeping the memory estimate up to date
+ */
+    Successors& entryForKey(const state_single& key);
+/** parses the order prefix from a key made by stateSequenceToString */
+    static unsigned long orderFromKey(const state_single& key);
+/** rough heap + node cost of a key or observation, used for the memory budget */
+    static size_t estimateKeyBytes(const state_single& key);
+    static size_t estimateObservationBytes(const state_single& obs);
+/** size of one context in the v1 binary format, with the number of observations it expands to */
+    size_t serialisedEntryBytes(const state_single& key, const Successors& succ, unsigned long long& expandedTotal) const;
+/** the two binary writers. v2 returns an empty string if a key cannot be split into states */
+    std::string writeBinaryV1(const CompactionOptions& options, CompactionStats* stats) const;
+    std::string writeBinaryV2(const CompactionOptions& options, CompactionStats* stats) const;
+    bool readBinaryV1(const std::string& savedModel);
+    bool readBinaryV2(const std::string& savedModel);
+/** true if the sent context should survive compaction with the sent options */
+    bool keepForCompaction(const Successors& succ, const CompactionOptions& options) const;
+/** recompute order and the memory estimate for everything, e.g. after a bulk load */
+    void recalculateMemoryUsage();
+/**
+ * visit at most maxVisits contexts from the eviction cursor, removing cold ones
+ * until we are back under the memory budget
+ */
+    void evictIncrementally(size_t maxVisits);
+/** remove a context, keeping the memory estimate up to date. returns the context after it */
+    ModelStorage::const_iterator eraseEntry(ModelStorage::const_iterator it);
+/** the multiplier that turns the stored weights of succ into decayed counts */
+    double effectiveScale(const Successors& succ) const;
+/** bring an entry from the previous decay epoch into the current one */
+    void normaliseEntry(Successors& succ);
+/** how many times to write an observation out in the v1 formats which have no counts */
+    static unsigned long expandedCount(double effectiveCount);
+/** visit at most maxVisits contexts from the decay cursor, normalising and pruning */
+    void decaySweepIncrementally(size_t maxVisits);
+/** the body of both generateObservations. filter can be null */
+    state_single generateFiltered(const state_sequence& prevState, int maxOrderWanted, bool needChoice, const ObservationFilter* filter);
+/**
+ * generation when blending. finds the contexts for order 1 up in one walk, stopping at the first
+ * order that isn't in the table (everything is learned at all orders, so nothing above it is 
+ * either), picks one of them with its blend weight and samples from it. Picking an order and 
+ * then a successor gives the same distribution as summing the weighted distributions, without 
+ * building the sum. filter can be null
+ */
+    state_single generateBlended(const state_sequence& prevState, int maxOrderWanted, const ObservationFilter* filter);
+/**
+ * weighted sample from the successors the filter allows, renormalised over just those in a single
+ * pass (reservoir style). returns false, leaving obs alone, if none are allowed
+ */
+    bool sampleAllowed(const Successors& succ, const ObservationFilter& filter, state_single& obs);
+/**
+ * zeroOrderSample for a filter. picks from the allowed observations in observationContexts, so it
+ * costs one filter check per distinct observation however many contexts there are. "0" if no 
+ * context has an allowed successor
+ */
+    state_single zeroOrderSampleAllowed(const ObservationFilter& filter);
+/** keep observationContexts up to date as obs is added to or removed from a context */
+    void countObservation(const state_single& obs);
+    void uncountObservation(const state_single& obs);
+/** rebuild observationContexts from the table if a restored version left it out of date */
+    void updateObservationContexts();
+/**
+ * weighted sample from the sent successors. uses the alias table if it has been built,
+ * otherwise a cumulative scan over the counts
+ */
+    state_single sampleSuccessors(const Successors& succ);
+/**
+ * weighted sample from the context at it. builds the alias table first if the context 
+ * is wide enough and that can be done without copying anything
+ */
+    state_single sampleContext(ModelStorage::const_iterator it);
+/** note that the context at it was used for generation, if that can be done without copying anything */
+    void markUsed(ModelStorage::const_iterator it);
+/** 
+ * true if writing to the context at it won't copy the table or its page. generation only writes 
+ * caches (recency, alias tables), which are not worth a copy: copying would allocate on the 
+ * audio thread and stop the page being shared with snapshots and other chains
+ */
+    bool canWriteInPlace(ModelStorage::const_iterator it) const;
+/**
+ * (re)build the Walker/Vose alias table for the sent successors 
+ */
+    static void buildAliasTable(Successors& succ);
 /**
  * returns the available states that follow the sent key, where the sent key 
- * is derived from stateSequenceToString 
+ * is derived from stateSequenceToString. Duplicates are expanded so the result
+ * matches the observation list format used by toString
  */
     state_sequence getOptionsForSequenceKey(state_single seqAsKey);
 
@@ -180,11 +510,43 @@ private:
  */
 static bool validateStateToObservationsString(const std::string& s);
 /**
- * Maps from string keys to list of possible next states
+ * Maps from string keys to list of possible next states. never null
  * 
  */
-    std::map<state_single,state_sequence> model;
+    SharedModel table;
+    unsigned long lineage { newLineage() };
     unsigned long maxOrder; 
+    size_t aliasThreshold;
+    std::mt19937 rng;
+    unsigned long useClock { 0 };
+    size_t memoryBudget { 0 };
+    size_t modelBytes { 0 };
+    // eviction sweep state. the cursor is a key rather than an iterator so that
+    // copying the chain doesn't leave it pointing into someone else's map
+    state_single evictionCursor;
+    unsigned long sweepMinOrder { 0 };
+    unsigned long sweepMaxCount { 1 };
+    unsigned long sweepStartClock { 0 };
+    // forgetting. new observations are worth weightUnit, which grows by 1/decayPerStep 
+    // each step, so older weights shrink relative to it. When it gets huge we start a 
+    // new epoch; entries still in the old one are rescaled when next touched or swept
+    double decayPerStep { 1.0 };
+    double decayPruneEpsilon { 0.05 };
+    double weightUnit { 1.0 };
+    double previousEpochUnit { 1.0 };
+    unsigned long decayEpoch { 0 };
+    state_single decayCursor;
+    BlendOptions blend;
+    // reused by generateBlended so a steady stream of events doesn't allocate
+    std::string blendTail;
+    std::string blendKey;
+    std::vector<size_t> blendStateStarts;
+    std::vector<ModelStorage::const_iterator> blendContexts;
+    std::vector<double> blendWeights;
+    // the order 0 summary: each distinct observation and how many contexts it follows.
+    // not stored with versions, so restoring one marks it out of date
+    std::map<state_single, size_t> observationContexts;
+    bool observationContextsValid { true };
     unsigned long orderOfLastMatch;
     state_and_observation lastMatch;
 };
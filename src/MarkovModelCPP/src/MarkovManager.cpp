@@ -12,6 +12,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <thread>
 
 MarkovManager::MarkovManager(unsigned long maxOrder, unsigned long chainEventMemoryLength) 
   : maxChainEventMemory{chainEventMemoryLength}, 
@@ -29,13 +30,25 @@ MarkovManager::~MarkovManager()
 void MarkovManager::reset()
 {
   mtx.lock();  
+  pushUndoVersion();
   inputMemory.assign(inputMemory.size(), "0");
   outputMemory.assign(outputMemory.size(), "0");
   lastGeneratedOrder = -1;
   sameOrderRepeatCount = 0;
   chain.reset();
+  publishStatus();
   mtx.unlock();
 }
+MarkovChain::SharedModel MarkovManager::resetAndRelease()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  pushUndoVersion();
+  resetGenerationMemory();
+  // if the history is on, it still holds the old table, so handing it out frees nothing
+  MarkovChain::SharedModel released = chain.releaseModel();
+  publishStatus();
+  return released;
+}
 void MarkovManager::putEvent(state_single event)
 {
   mtx.lock();
@@ -44,11 +57,17 @@ void MarkovManager::putEvent(state_single event)
   // note that when we are boostrapping, i.e. filling up the input memory
   // we should not pass states in that include the "0"
   chain.addObservationAllOrders(inputMemory, event);
+  // redoing now would throw away what was just learned
+  dropVersions(redoVersions);
+  // learning unshares pages from the history, so it grows between checkpoints too
+  if (++eventsSinceHistoryCheck >= historyCheckInterval)
+    trimHistoryToBudget();
   // update the input memory
   addStateToStateSequence(inputMemory, event);
   }catch(...){// put this here as my JUCE thing crashes due to lack of thread-safeness
     std::cout << "MarkovManager::putEvent crashed... catching" << std::endl;
   }  
+  publishStatus();
   mtx.unlock();
 }
 
@@ -60,16 +79,35 @@ void MarkovManager::observeContextOnly(state_single event)
 state_single MarkovManager::getEvent(bool needChoices, bool useInputAsContext)
 {
   mtx.lock();
+  state_single event = generateEvent(needChoices, useInputAsContext);
+  publishStatus();
+  mtx.unlock();
+  return event;
+}
+
+void MarkovManager::getEvents(state_sequence& out, size_t count, bool needChoices, bool useInputAsContext)
+{
+  out.clear();
+  out.reserve(count);
+  std::lock_guard<std::mutex> lock(mtx);
+  for (size_t i = 0; i < count; ++i)
+    out.push_back(generateEvent(needChoices, useInputAsContext));
+  publishStatus();
+}
+
+state_single MarkovManager::generateEvent(bool needChoices, bool useInputAsContext)
+{
   state_single event{""};
 
   try{
     // get an observation
-    if (useInputAsContext){// non -auto-regressive - instead, use inputMemory as input state
-      event = chain.generateObservation(inputMemory, outputMemory.size(), needChoices);
-    }
-    else{// default , old style auto-regressive behaviour where it 'continues' on its own output 
-      event = chain.generateObservation(outputMemory, outputMemory.size(), needChoices);
-    }
+    // non -auto-regressive - instead, use inputMemory as input state
+    // default , old style auto-regressive behaviour where it 'continues' on its own output 
+    const state_sequence& context = useInputAsContext ? inputMemory : outputMemory;
+    if (observationFilter != nullptr)
+      event = chain.generateObservation(context, outputMemory.size(), needChoices, *observationFilter);
+    else
+      event = chain.generateObservation(context, outputMemory.size(), needChoices);
     // check the output
     // update the outputMemory
     addStateToStateSequence(outputMemory, event);
@@ -78,7 +116,11 @@ state_single MarkovManager::getEvent(bool needChoices, bool useInputAsContext)
     rememberChainEvent(chain.getLastMatch());
 
     const int order = chain.getOrderOfLastMatch();
-    if (order == lastGeneratedOrder)
+    if (chain.isBlending())
+    {
+        lastGeneratedOrder = order;
+    }
+    else if (order == lastGeneratedOrder)
     {
         sameOrderRepeatCount++;
         if (sameOrderRepeatCount >= maxSameOrderRepeats && maxSameOrderRepeats > 0)
@@ -95,7 +137,6 @@ state_single MarkovManager::getEvent(bool needChoices, bool useInputAsContext)
     std::cout << "MarkovManager::getEvent crashed... catching" << std::endl;
     event = "0";
   }
-  mtx.unlock();
   return event;
 }
 
@@ -117,12 +158,89 @@ int MarkovManager::getOrderOfLastEvent()
   return order;
 }
 
+void MarkovManager::setBlending(const MarkovChain::BlendOptions& options)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  chain.setBlending(options);
+  sameOrderRepeatCount = 0;
+}
+
+void MarkovManager::setObservationFilter(const MarkovChain::ObservationFilter* filter)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  observationFilter = filter;
+}
+
 void MarkovManager::setMaxSameOrderRepeats(unsigned int maxRepeats)
 {
   std::lock_guard<std::mutex> lock(mtx);
   maxSameOrderRepeats = maxRepeats;
 }
 
+void MarkovManager::setMemoryBudget(size_t maxBytes)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  chain.setMemoryBudget(maxBytes);
+  memoryBudget = maxBytes;
+  trimHistoryToBudget();
+}
+
+size_t MarkovManager::getApproxMemoryUsage()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return chain.getApproxMemoryUsage();
+}
+
+void MarkovManager::setDecay(double decayPerEvent, double pruneEpsilon)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  chain.setDecay(decayPerEvent, pruneEpsilon);
+}
+
+void MarkovManager::seed(unsigned int seedValue)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  chain.seed(seedValue);
+}
+
+void MarkovManager::mergeFrom(MarkovManager& other)
+{
+  if (&other == this)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    pushUndoVersion();
+    chain.mergeFrom(chain);
+    publishStatus();
+    return;
+  }
+  // locks both without deadlocking against a merge the other way round
+  std::scoped_lock lock(mtx, other.mtx);
+  pushUndoVersion();
+  chain.mergeFrom(other.chain);
+  publishStatus();
+}
+
+void MarkovManager::mergeTree(const std::vector<MarkovManager*>& managers)
+{
+  // round by round: 1 into 0, 3 into 2..., then 2 into 0, 6 into 4... until it is all in 0
+  for (size_t stride = 1; stride < managers.size(); stride *= 2)
+  {
+    std::vector<std::thread> merges;
+    for (size_t i = 0; i + stride < managers.size(); i += stride * 2)
+    {
+      MarkovManager* into = managers[i];
+      MarkovManager* from = managers[i + stride];
+      // the last pair of the round runs on this thread
+      if (i + stride * 3 >= managers.size())
+        into->mergeFrom(*from);
+      else
+        merges.emplace_back([into, from]() { into->mergeFrom(*from); });
+    }
+    for (std::thread& merge : merges)
+      merge.join();
+  }
+}
+
 void MarkovManager::resetGenerationMemory()
 {
   inputMemory.assign(inputMemory.size(), "0");
@@ -150,11 +268,13 @@ void MarkovManager::rememberChainEvent(state_and_observation sObs)
 void MarkovManager::giveNegativeFeedback()
 {
   mtx.lock();
+  pushUndoVersion();
   // remove all recently used mappings
   for (state_and_observation& so : chainEvents)
   {
     chain.removeMapping(so.first, so.second);
   }
+  publishStatus();
   mtx.unlock();
 }
 
@@ -162,11 +282,13 @@ void MarkovManager::giveNegativeFeedback()
 void MarkovManager::givePositiveFeedback()
 {
   mtx.lock();
+  pushUndoVersion();
   // amplify all recently used mappings
   for (state_and_observation& so : chainEvents)
   {
     chain.amplifyMapping(so.first, so.second);
   }
+  publishStatus();
   mtx.unlock();
 }
 
@@ -179,9 +301,10 @@ bool MarkovManager::loadModel(const std::string& filename)
     std::string data = sstr.str();
     in.close();
     mtx.lock();
+    pushUndoVersion();
     // const bool result = chain.fromString(data);
     const bool result = chain.fromStringFast(data);
-    
+    publishStatus();
     mtx.unlock();
     return result;
   }
@@ -200,7 +323,9 @@ bool MarkovManager::loadModelBinary(const std::string& filename)
     in.close();
 
     mtx.lock();
+    pushUndoVersion();
     const bool result = chain.fromStringBinary(data);
+    publishStatus();
     mtx.unlock();
     return result;
   }
@@ -212,10 +337,8 @@ bool MarkovManager::loadModelBinary(const std::string& filename)
 
 bool MarkovManager::saveModel(const std::string& filename)
 {
-    std::string data;
-    mtx.lock();
-    data = chain.toString();
-    mtx.unlock();
+    // serialise from a snapshot, so the audio thread isn't kept waiting for the lock
+    std::string data = getCopyOfModel().toString();
 
     if (std::ofstream ofs{filename}){
       ofs << data;
@@ -230,12 +353,9 @@ bool MarkovManager::saveModel(const std::string& filename)
 
 bool MarkovManager::saveModelBinary(const std::string& filename)
 {
-    std::string data;
-    bool wasEmpty = false;
-    mtx.lock();
-    data = chain.toStringBinary();
-    wasEmpty = (chain.getModelSize() == 0);
-    mtx.unlock();
+    MarkovChain snapshot = getCopyOfModel();
+    std::string data = snapshot.toStringBinary();
+    const bool wasEmpty = (snapshot.getModelSize() == 0);
 
     if (data.empty() && !wasEmpty)
     {
@@ -258,24 +378,34 @@ bool MarkovManager::saveModelBinary(const std::string& filename)
 
 std::string MarkovManager::getModelAsString()
 {
-  mtx.lock();
-  auto data = chain.toString();
-  mtx.unlock();
-  return data;
+  return getCopyOfModel().toString();
 }
 
 std::string MarkovManager::getModelAsBinaryString()
 {
-  mtx.lock();
-  auto data = chain.toStringBinary();
-  mtx.unlock();
-  return data;
+  return getCopyOfModel().toStringBinary();
+}
+
+std::string MarkovManager::getModelAsBinaryString(const MarkovChain::CompactionOptions& options, MarkovChain::CompactionStats* stats)
+{
+  return getCopyOfModel().toStringBinary(options, stats);
+}
+
+MarkovChain::CompactionStats MarkovManager::compactModel(const MarkovChain::CompactionOptions& options)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  pushUndoVersion();
+  const auto stats = chain.compact(options);
+  publishStatus();
+  return stats;
 }
 
 bool MarkovManager::setupModelFromString(const std::string& modelData)
 {
   mtx.lock();
+  pushUndoVersion();
   const bool result = chain.fromString(modelData);
+  publishStatus();
   mtx.unlock();
   return result;
 }
@@ -283,7 +413,9 @@ bool MarkovManager::setupModelFromString(const std::string& modelData)
 bool MarkovManager::setupModelFromBinaryString(const std::string& modelData)
 {
   mtx.lock();
+  pushUndoVersion();
   const bool result = chain.fromStringBinary(modelData);
+  publishStatus();
   mtx.unlock();
   return result;
 }
@@ -296,6 +428,27 @@ MarkovChain MarkovManager::getCopyOfModel()
   return copy;
 }
 
+void MarkovManager::shareModelFrom(const MarkovChain& prototype)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  pushUndoVersion();
+  resetGenerationMemory();
+  chain.shareModelFrom(prototype);
+  publishStatus();
+}
+
+bool MarkovManager::isModelShared()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return chain.isModelShared();
+}
+
+void MarkovManager::makeModelPrivate()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  chain.makeModelPrivate();
+}
+
 size_t MarkovManager::getModelSize()
 {
   mtx.lock();
@@ -309,3 +462,160 @@ int MarkovManager::getLastOrderOfMatch()
   std::lock_guard<std::mutex> lock(mtx);
   return chain.getOrderOfLastMatch();
 }
+
+MarkovChain::PredictionResult MarkovManager::predictNext(size_t k, bool useInputAsContext)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return chain.predict(useInputAsContext ? inputMemory : outputMemory, k);
+}
+
+MarkovManager::Status MarkovManager::getStatus() const
+{
+  return Status{publishedModelSize.load(std::memory_order_relaxed),
+                publishedLastOrder.load(std::memory_order_relaxed)};
+}
+
+void MarkovManager::publishStatus()
+{
+  publishedModelSize.store(chain.getModelSize(), std::memory_order_relaxed);
+  publishedLastOrder.store(chain.getOrderOfLastMatch(), std::memory_order_relaxed);
+}
+
+void MarkovManager::setUndoDepth(size_t depth)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  dropVersions(undoVersions);
+  dropVersions(redoVersions);
+  // sized once here, so pushing a version never allocates
+  undoVersions.slots.assign(depth, {});
+  redoVersions.slots.assign(depth, {});
+}
+
+void MarkovManager::checkpoint()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  pushUndoVersion();
+}
+
+bool MarkovManager::undo()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  if (undoVersions.count == 0) return false;
+  retireVersion(redoVersions.push(chain.saveVersion()));
+  chain.restoreVersion(undoVersions.pop());
+  publishStatus();
+  return true;
+}
+
+bool MarkovManager::redo()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  if (redoVersions.count == 0) return false;
+  retireVersion(undoVersions.push(chain.saveVersion()));
+  chain.restoreVersion(redoVersions.pop());
+  publishStatus();
+  return true;
+}
+
+size_t MarkovManager::getUndoCount()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return undoVersions.count;
+}
+
+size_t MarkovManager::getRedoCount()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return redoVersions.count;
+}
+
+void MarkovManager::setRetiredVersionHandler(std::function<void(MarkovChain::SharedModel&&)> handler)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  retiredVersionHandler = std::move(handler);
+}
+
+void MarkovManager::pushUndoVersion()
+{
+  if (undoVersions.slots.empty()) return;
+  retireVersion(undoVersions.push(chain.saveVersion()));
+  // a new change, so what was undone can't be redone any more
+  dropVersions(redoVersions);
+  trimHistoryToBudget();
+}
+
+void MarkovManager::trimHistoryToBudget()
+{
+  eventsSinceHistoryCheck = 0;
+  if (memoryBudget == 0 || undoVersions.count + redoVersions.count == 0) return;
+
+  // each version costs what the next one towards the live model doesn't share, the newest on 
+  // each stack what the live model doesn't. each cost is O(1), see MarkovChain::unsharedBytes
+  const MarkovChain::ModelVersion live = chain.saveVersion();
+  auto cost = [&](const VersionStack& stack, size_t age) {
+    return MarkovChain::unsharedBytes(stack.fromNewest(age), age == 0 ? live : stack.fromNewest(age - 1));
+  };
+  size_t used = chain.getApproxMemoryUsage();
+  for (size_t age = 0; age < undoVersions.count; ++age)
+    used += cost(undoVersions, age);
+  for (size_t age = 0; age < redoVersions.count; ++age)
+    used += cost(redoVersions, age);
+
+  while (used > memoryBudget && undoVersions.count > 0)
+  {
+    used -= std::min(used, cost(undoVersions, undoVersions.count - 1));
+    retireVersion(undoVersions.dropOldest());
+  }
+  while (used > memoryBudget && redoVersions.count > 0)
+  {
+    used -= std::min(used, cost(redoVersions, redoVersions.count - 1));
+    retireVersion(redoVersions.dropOldest());
+  }
+}
+
+void MarkovManager::dropVersions(VersionStack& stack)
+{
+  while (stack.count > 0)
+    retireVersion(std::move(stack.pop().table));
+}
+
+void MarkovManager::retireVersion(MarkovChain::SharedModel&& table)
+{
+  if (table && retiredVersionHandler)
+    retiredVersionHandler(std::move(table));
+  table.reset();
+}
+
+MarkovChain::SharedModel MarkovManager::VersionStack::push(MarkovChain::ModelVersion version)
+{
+  MarkovChain::SharedModel pushedOut;
+  if (slots.empty()) return version.table;
+  // top is the slot after the newest. when full, that is the oldest
+  if (count == slots.size())
+    pushedOut = std::move(slots[top].table);
+  else
+    ++count;
+  slots[top] = std::move(version);
+  top = (top + 1) % slots.size();
+  return pushedOut;
+}
+
+MarkovChain::SharedModel MarkovManager::VersionStack::dropOldest()
+{
+  const size_t oldest = (top + slots.size() - count) % slots.size();
+  --count;
+  slots[oldest].modelBytes = 0;
+  return std::move(slots[oldest].table);
+}
+
+const MarkovChain::ModelVersion& MarkovManager::VersionStack::fromNewest(size_t age) const
+{
+  return slots[(top + slots.size() - 1 - age) % slots.size()];
+}
+
+MarkovChain::ModelVersion MarkovManager::VersionStack::pop()
+{
+  top = (top + slots.size() - 1) % slots.size();
+  --count;
+  return std::move(slots[top]);
+}
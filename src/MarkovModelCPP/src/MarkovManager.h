@@ -11,6 +11,9 @@
 #pragma once
 #include "MarkovChain.h"
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
 
 
 /**
@@ -35,6 +38,17 @@ class MarkovManager {
       * @param useInputAsContext: if true, use the current input state for the model as the 'context' for the generation, as opposed to using the previous output state (when false)
       */
       state_single getEvent(bool needChoices = true, bool useInputAsContext = false);
+      /**
+       * same as calling getEvent count times, but the model is only locked once. 
+       * events are written to out, which is cleared first, so its capacity can be reused
+       */
+      void getEvents(state_sequence& out, size_t count, bool needChoices = true, bool useInputAsContext = false);
+      /**
+       * only generate observations the filter allows, see MarkovChain::generateObservation. 
+       * the filter is not copied, so keep it alive until it is replaced or cleared with nullptr, 
+       * and don't change it while another thread might be generating
+       */
+      void setObservationFilter(const MarkovChain::ObservationFilter* filter);
       /**
        * returns the order of the model that generated the last event 
        * calls 
@@ -46,6 +60,21 @@ class MarkovManager {
        * wipe the underlying model and reset short term input and output memory. 
        */
       void reset();
+      /**
+       * same as reset, but the old model is handed back rather than freed. 
+       * destroying a big model takes a while, so the caller can do it on another thread
+       */
+      MarkovChain::SharedModel resetAndRelease();
+      /**
+       * replace the model with the prototype's, sharing its transition table rather than copying it. 
+       * the table is copied the first time this manager changes it, e.g. when it learns. 
+       * the short term memory is reset too
+       */
+      void shareModelFrom(const MarkovChain& prototype);
+      /** true while the model is still shared with another manager or chain */
+      bool isModelShared();
+      /** copy a shared model now, so the next event learned doesn't have to. see shareModelFrom */
+      void makeModelPrivate();
 
       /**
        * Rotates the sent seq and pops the sent item on the end
@@ -88,6 +117,13 @@ class MarkovManager {
        * returns a binary representation of the model suitable for saving
        */
       std::string getModelAsBinaryString();
+      /**
+       * returns a binary representation of the model with contexts that fail the 
+       * compaction options left out. The live model is not changed. 
+       */
+      std::string getModelAsBinaryString(const MarkovChain::CompactionOptions& options, MarkovChain::CompactionStats* stats);
+      /** permanently drop contexts from the model that fail the compaction options */
+      MarkovChain::CompactionStats compactModel(const MarkovChain::CompactionOptions& options);
       /** tries to convert the sent string into a model by calling model.fromString */
       bool setupModelFromString(const std::string&);
       /**
@@ -97,17 +133,122 @@ class MarkovManager {
 
 
 
-      /** returns a copy of the model */
+      /** 
+       * returns a snapshot of the model. this only copies the table's list of page directories, and 
+       * learning afterwards copies just the pages it writes to, so it's cheap to call while playing 
+       */
       MarkovChain getCopyOfModel();
       /** calls getSize on the model  */
       size_t getModelSize();
       /** returns the order used for the last generated event */
       int getLastOrderOfMatch();
+      /**
+       * the k most probable next events and their probabilities, without generating anything.
+       * the context is picked the way getEvent picks it. see MarkovChain::predict
+       */
+      MarkovChain::PredictionResult predictNext(size_t k, bool useInputAsContext = false);
+      /** model size and the order used for the last generated event */
+      struct Status
+      {
+        size_t modelSize;
+        int lastOrder;
+      };
+      /**
+       * lock free version of getModelSize and getLastOrderOfMatch, safe to poll from the 
+       * audio thread. The values are published whenever the model changes or generates, 
+       * so they may be one operation behind a call that is running right now.
+       */
+      Status getStatus() const;
+      /** 
+       * blend the orders when generating rather than backing off. see MarkovChain::BlendOptions. 
+       * blending already mixes in the lower orders, so while it is on, generation memory is not 
+       * reset after repeated orders (see setMaxSameOrderRepeats)
+       */
+      void setBlending(const MarkovChain::BlendOptions& options);
       /** set how many repeated orders we tolerate before resetting generation memory */
       void setMaxSameOrderRepeats(unsigned int maxRepeats);
+      /** 
+       * cap the approximate memory used by the chain, 0 for no limit. see MarkovChain::setMemoryBudget. 
+       * the undo history counts too: what its versions don't share with the live model (or with each 
+       * other) is added on, and the oldest versions are dropped while the total is over budget 
+       */
+      void setMemoryBudget(size_t maxBytes);
+      /** returns the chain's estimated memory use in bytes */
+      size_t getApproxMemoryUsage();
+      /** make the chain forget old material. see MarkovChain::setDecay */
+      void setDecay(double decayPerEvent, double pruneEpsilon=0.05);
+      /** seed the chain's random number generator. see MarkovChain::seed */
+      void seed(unsigned int seedValue);
+      /**
+       * add everything the other manager's chain has learned to this one. see MarkovChain::mergeFrom. 
+       * the short term input and output memories are left as they are
+       */
+      void mergeFrom(MarkovManager& other);
+      /**
+       * merge every manager into managers[0], pairing them up in rounds so that half of the 
+       * remaining merges run in parallel each round. managers should all be different and 
+       * there should be around one per core, e.g. the shards of a corpus trained in parallel
+       */
+      static void mergeTree(const std::vector<MarkovManager*>& managers);
+      /**
+       * keep up to depth earlier versions of the model to undo back to, and as many to redo. 
+       * versions share pages with each other and with the live model, so each one only costs 
+       * the pages that changed after it. 0, the default, turns the history off and drops it
+       */
+      void setUndoDepth(size_t depth);
+      /**
+       * remember the model as it is now, so undo can come back to it. reset, feedback, loading, 
+       * compacting and merging do this themselves. anything kept for redo is dropped
+       */
+      void checkpoint();
+      /** go back to the version saved by the last checkpoint. false if there is nothing to undo */
+      bool undo();
+      /** 
+       * go forward to the version the last undo left. false if there is nothing to redo, 
+       * which is also the case once anything new has been learned 
+       */
+      bool redo();
+      size_t getUndoCount();
+      size_t getRedoCount();
+      /**
+       * called with each version that is dropped from the history. without one, old versions 
+       * are destroyed by whichever call dropped them, which could be on the audio thread
+       */
+      void setRetiredVersionHandler(std::function<void(MarkovChain::SharedModel&&)> handler);
   private:
+      /** a fixed size stack of versions that forgets its oldest when pushed while full */
+      struct VersionStack
+      {
+        std::vector<MarkovChain::ModelVersion> slots;
+        size_t top { 0 };
+        size_t count { 0 };
+        /** returns the table of the version that was pushed out, if any */
+        MarkovChain::SharedModel push(MarkovChain::ModelVersion version);
+        MarkovChain::ModelVersion pop();
+        /** returns the table of the oldest version, which is removed */
+        MarkovChain::SharedModel dropOldest();
+        /** the version age steps from the newest, 0 being the newest */
+        const MarkovChain::ModelVersion& fromNewest(size_t age) const;
+      };
+      /** the history is measured against the budget after this many events are learned */
+      static constexpr unsigned int historyCheckInterval = 256;
+      /** 
+       * drop the oldest versions until the live model and the history fit the memory budget. 
+       * O(depth), as the pages each version holds on to are counted as they are copied. 
+       * call with mtx held 
+       */
+      void trimHistoryToBudget();
+      /** checkpoint with mtx held */
+      void pushUndoVersion();
+      /** clear a stack, handing each version to retireVersion. call with mtx held */
+      void dropVersions(VersionStack& stack);
+      void retireVersion(MarkovChain::SharedModel&& table);
+      /** the body of getEvent. call with mtx held */
+      state_single generateEvent(bool needChoices, bool useInputAsContext);
       void rememberChainEvent(state_and_observation event);
       void resetGenerationMemory();
+      /** copy size and last order into the atomics read by getStatus. call with mtx held */
+      void publishStatus();
       
       state_sequence inputMemory;
       state_sequence outputMemory;
@@ -120,4 +261,12 @@ class MarkovManager {
       int lastGeneratedOrder { -1 };
       unsigned int sameOrderRepeatCount { 0 };
       unsigned int maxSameOrderRepeats { 10 };
+      std::atomic<size_t> publishedModelSize { 0 };
+      std::atomic<int> publishedLastOrder { 0 };
+      VersionStack undoVersions;
+      VersionStack redoVersions;
+      std::function<void(MarkovChain::SharedModel&&)> retiredVersionHandler;
+      const MarkovChain::ObservationFilter* observationFilter { nullptr };
+      size_t memoryBudget { 0 };
+      unsigned int eventsSinceHistoryCheck { 0 };
 };
@@ -11,6 +11,10 @@
 #include <chrono>
 #include <cstdlib>
 #include <iterator>
+#include <algorithm>
+#include <memory>
+#include <cmath>
+#include <filesystem>
 
 /**
  * helper function to print result of a test
@@ -21,6 +25,14 @@ void log(std::string test, bool result)
     std::cout << test << " : " << result << std::endl;
 }
 
+/**
+ * where tests save their model files, so they don't end up in the source tree
+ */
+std::string tempTestFile(const std::string& name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
 
 // 1
 bool emptyChainReturnsNull()
@@ -805,7 +817,7 @@ bool saveModel1()
     for (auto i=0; i<10000; ++i){
         man.putEvent("s_"+std::to_string(i));
     }
-    bool res = man.saveModel("testbig.txt");
+    bool res = man.saveModel(tempTestFile("testbig.txt"));
     return res;
 }
 bool saveModel2()
@@ -817,7 +829,7 @@ bool saveModel2()
     man.putEvent("d");
     man.putEvent("e");
         
-    bool res = man.saveModel("test.txt");
+    bool res = man.saveModel(tempTestFile("test.txt"));
     return res;
 }
 
@@ -829,9 +841,9 @@ bool loadModel1()
     man.putEvent("c");
     man.putEvent("d");
     man.putEvent("e");
-    man.saveModel("test.txt");
+    man.saveModel(tempTestFile("test.txt"));
     //bool res = man.loadModel("midi_model.txt");
-    bool res = man.loadModel("test.txt");
+    bool res = man.loadModel(tempTestFile("test.txt"));
 
     return res;
 }
@@ -845,9 +857,9 @@ bool loadModel2()
     man.putEvent("d");
     man.putEvent("e");
     std::string before = man.getModelAsString();
-    man.saveModel("test.txt");
+    man.saveModel(tempTestFile("test.txt"));
     //bool res = man.loadModel("midi_model.txt");
-    man.loadModel("test.txt");
+    man.loadModel(tempTestFile("test.txt"));
     std::string after = man.getModelAsString();
     return after == before; 
 }
@@ -923,6 +935,684 @@ bool allSame(){
     else return true; 
 }
 
+bool aliasSamplingMatchesCounts()
+{
+    // wide enough context that the alias table gets used
+    MarkovChain chain{};
+    chain.setAliasThreshold(4);
+    state_sequence prevState = {"a"};
+    for (int i = 0; i < 32; ++i)
+        chain.addObservation(prevState, std::to_string(i));
+    // make "heavy" 32 times as likely as each of the others
+    for (int i = 0; i < 32; ++i)
+        chain.addObservation(prevState, "heavy");
+
+    int heavyCount = 0;
+    const int draws = 20000;
+    for (int i = 0; i < draws; ++i)
+    {
+        if (chain.generateObservation(prevState, 1) == "heavy")
+            heavyCount ++;
+    }
+    // expect about half
+    const double ratio = static_cast<double>(heavyCount) / draws;
+    if (ratio > 0.45 && ratio < 0.55) return true;
+    std::cout << "aliasSamplingMatchesCounts: heavy ratio " << ratio << std::endl;
+    return false;
+}
+
+bool memoryBudgetBoundsModel()
+{
+    MarkovManager man{};
+    // "0" is in the input, so the last check only holds for some seeds
+    man.seed(1);
+    const size_t budget = 1024 * 1024;
+    man.setMemoryBudget(budget);
+    size_t peak = 0;
+    std::mt19937 rng(1);
+    // random input means nearly every high order context is a singleton
+    // unbounded, this grows to about 40MB
+    for (auto i=0; i<3000; ++i){
+        man.putEvent(std::to_string(rng() % 40));
+        peak = std::max(peak, man.getApproxMemoryUsage());
+    }
+    // eviction is incremental so allow some overshoot, but not unbounded growth
+    if (man.getApproxMemoryUsage() > budget * 2 || peak > budget * 4)
+    {
+        std::cout << "memoryBudgetBoundsModel: usage " << man.getApproxMemoryUsage() << " peak " << peak << std::endl;
+        return false;
+    }
+    // low order contexts should survive
+    return man.getEvent(false) != "0";
+}
+
+bool decayForgetsOldMaterial()
+{
+    MarkovChain chain{};
+    // half life of about 23 steps
+    chain.setDecay(0.97, 0.05);
+    state_sequence prevState = {"a"};
+    for (int i = 0; i < 200; ++i)
+        chain.addObservationAllOrders(prevState, "old");
+    for (int i = 0; i < 200; ++i)
+        chain.addObservationAllOrders(prevState, "new");
+
+    int oldCount = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        if (chain.generateObservation(prevState, 1) == "old")
+            oldCount ++;
+    }
+    // without decay this would be about half
+    if (oldCount > 50)
+    {
+        std::cout << "decayForgetsOldMaterial: old still picked " << oldCount << " of 1000" << std::endl;
+        return false;
+    }
+    // keep going with only new material and the old observation should get swept away
+    for (int i = 0; i < 600; ++i)
+        chain.addObservationAllOrders(prevState, "new");
+    return chain.toString().find("old") == std::string::npos;
+}
+
+bool compactionDropsSingletonContexts()
+{
+    MarkovManager man{};
+    std::mt19937 rng(7);
+    for (auto i=0; i<500; ++i)
+        man.putEvent(std::to_string(rng() % 12));
+
+    MarkovChain::CompactionOptions options;
+    options.minCount = 2;
+    MarkovChain::CompactionStats stats;
+    std::string compacted = man.getModelAsBinaryString(options, &stats);
+    std::string full = man.getModelAsBinaryString();
+
+    MarkovChain reloaded;
+    if (!reloaded.fromStringBinary(compacted)) return false;
+    std::cout << "compactionDropsSingletonContexts: " << stats.contextsBefore << " -> " << stats.contextsAfter
+              << " contexts, " << stats.bytesBefore << " -> " << stats.bytesAfter << " bytes" << std::endl;
+    // the stats should describe exactly what we got, measured against an uncompacted v1 save
+    MarkovChain fullChain;
+    if (!fullChain.fromStringBinary(full)) return false;
+    if (stats.bytesBefore != fullChain.toStringBinaryV1().size() || stats.bytesAfter != compacted.size()) return false;
+    if (static_cast<size_t>(reloaded.size()) != stats.contextsAfter) return false;
+    // all 12 order 1 contexts survive, almost all of the high order ones do not
+    return stats.contextsAfter >= 12 && stats.bytesAfter * 4 < stats.bytesBefore;
+}
+
+bool binaryV2RoundTripAndReadsV1()
+{
+    MarkovManager man{};
+    std::mt19937 rng(11);
+    for (auto i=0; i<600; ++i)
+        man.putEvent(std::to_string(48 + rng() % 24) + "-" + std::to_string(rng() % 3));
+
+    MarkovChain original;
+    if (!original.fromStringBinary(man.getModelAsBinaryString())) return false;
+    const std::string text = original.toString();
+    const std::string v1 = original.toStringBinaryV1();
+    const std::string v2 = original.toStringBinary();
+
+    MarkovChain fromV1;
+    MarkovChain fromV2;
+    if (!fromV1.fromStringBinary(v1) || !fromV2.fromStringBinary(v2)) return false;
+    std::cout << "binaryV2RoundTripAndReadsV1: v1 " << v1.size() << " bytes, v2 " << v2.size() << " bytes" << std::endl;
+    if (fromV1.toString() != text || fromV2.toString() != text) return false;
+    // truncated blobs should be rejected, not half loaded
+    MarkovChain broken;
+    if (broken.fromStringBinary(v2.substr(0, v2.size() / 2))) return false;
+    return v2.size() * 4 < v1.size();
+}
+
+bool statusTracksPutAndGet()
+{
+    MarkovManager man{};
+    if (man.getStatus().modelSize != 0) return false;
+    for (auto i=0; i<50; ++i)
+        man.putEvent(std::to_string(i % 5));
+    if (man.getStatus().modelSize != man.getModelSize()) return false;
+    man.getEvent();
+    if (man.getStatus().lastOrder != man.getLastOrderOfMatch()) return false;
+    man.reset();
+    return man.getStatus().modelSize == 0;
+}
+
+bool resetAndReleaseHandsBackModel()
+{
+    MarkovManager man{};
+    for (auto i=0; i<50; ++i)
+        man.putEvent(std::to_string(i % 5));
+    size_t sizeBefore = man.getModelSize();
+    MarkovChain::SharedModel released = man.resetAndRelease();
+    if (released->size() != sizeBefore) return false;
+    if (man.getModelSize() != 0 || man.getStatus().modelSize != 0) return false;
+    // still learns after the reset
+    man.putEvent("1");
+    man.putEvent("2");
+    return man.getModelSize() > 0;
+}
+
+bool getEventsMatchesRepeatedGetEvent()
+{
+    MarkovManager man{};
+    // a deterministic sequence, so there is only one way to continue it
+    for (auto i=0; i<60; ++i)
+        man.putEvent(std::to_string(i % 6));
+    state_sequence batch;
+    man.getEvents(batch, 12);
+    if (batch.size() != 12) return false;
+    for (const state_single& event : batch)
+        if (event.empty()) return false;
+    // the output memory carries on from the batch
+    state_single next = man.getEvent();
+    state_single last = batch.back();
+    if (last != "0" && next != "0" && std::stoi(next) != (std::stoi(last) + 1) % 6) return false;
+    return man.getStatus().lastOrder == man.getLastOrderOfMatch();
+}
+
+bool seededManagersGenerateTheSame()
+{
+    MarkovManager a{}, b{};
+    // plenty of choices so the rng matters
+    for (auto i=0; i<200; ++i)
+    {
+        state_single s = std::to_string((i * 7 + i / 3) % 5);
+        a.putEvent(s);
+        b.putEvent(s);
+    }
+    a.seed(1234);
+    b.seed(1234);
+    for (auto i=0; i<50; ++i)
+        if (a.getEvent() != b.getEvent()) return false;
+    return true;
+}
+
+bool mergeFromAddsCounts()
+{
+    MarkovChain a{}, b{}, both{};
+    a.addObservation({"1"}, "2");
+    a.addObservation({"1"}, "2");
+    b.addObservation({"1"}, "3");
+    b.addObservation({"5"}, "6");
+    both.addObservation({"1"}, "2");
+    both.addObservation({"1"}, "2");
+    both.addObservation({"1"}, "3");
+    both.addObservation({"5"}, "6");
+    a.mergeFrom(b);
+    if (a.getModelSize() != 2) return false;
+    if (a.toString() != both.toString()) return false;
+    // merging into itself doubles everything
+    a.mergeFrom(a);
+    both.mergeFrom(both);
+    return a.toString() == both.toString() && a.toString().find(":6,") != std::string::npos;
+}
+
+bool mergeTreeMatchesSequentialMerge()
+{
+    std::vector<std::unique_ptr<MarkovManager>> tree, sequential;
+    for (int m = 0; m < 5; ++m)
+    {
+        tree.push_back(std::make_unique<MarkovManager>());
+        sequential.push_back(std::make_unique<MarkovManager>());
+        for (int i = 0; i < 40; ++i)
+        {
+            state_single s = std::to_string((i * (m + 2)) % 7);
+            tree.back()->putEvent(s);
+            sequential.back()->putEvent(s);
+        }
+    }
+    std::vector<MarkovManager*> managers;
+    for (auto& mm : tree) managers.push_back(mm.get());
+    MarkovManager::mergeTree(managers);
+    for (size_t m = 1; m < sequential.size(); ++m)
+        sequential[0]->mergeFrom(*sequential[m]);
+    return tree[0]->getModelAsString() == sequential[0]->getModelAsString()
+        && tree[0]->getModelSize() > tree[1]->getModelSize();
+}
+
+bool sharedModelCopiesOnWrite()
+{
+    MarkovChain prototype{};
+    prototype.addObservation({"1"}, "2");
+    prototype.addObservation({"2"}, "1");
+    prototype.prepareForSharing();
+    const std::string before = prototype.toString();
+
+    MarkovManager a{}, b{};
+    a.shareModelFrom(prototype);
+    b.shareModelFrom(prototype);
+    if (!a.isModelShared() || !b.isModelShared()) return false;
+    if (a.getModelSize() != 2) return false;
+    // learning in one manager doesn't show up in the prototype or the other manager
+    a.putEvent("3");
+    a.putEvent("4");
+    if (a.isModelShared() || !b.isModelShared()) return false;
+    if (prototype.toString() != before) return false;
+    return b.getCopyOfModel().toString() == before && a.getModelSize() > 2;
+}
+
+bool sharedModelGenerates()
+{
+    MarkovChain prototype{};
+    for (int i = 0; i < 50; ++i)
+        prototype.addObservation({"1"}, std::to_string(i % 40));
+    prototype.prepareForSharing();
+    const std::string before = prototype.toString();
+
+    MarkovManager man{};
+    man.shareModelFrom(prototype);
+    for (int i = 0; i < 100; ++i)
+    {
+        state_single event = man.getEvent(false);
+        if (event == "") return false;
+    }
+    // generating doesn't write to the shared table
+    return man.isModelShared() && prototype.toString() == before;
+}
+
+bool pagedMapMatchesStdMap()
+{
+    PagedMap<std::string, int> paged;
+    std::map<std::string, int> reference;
+    std::mt19937 rng{7};
+    std::vector<PagedMap<std::string, int>> snapshots;
+    std::vector<std::map<std::string, int>> snapshotReferences;
+    for (int i = 0; i < 5000; ++i)
+    {
+        const std::string key = std::to_string(std::uniform_int_distribution<int>(0, 999)(rng));
+        if (std::uniform_int_distribution<int>(0, 3)(rng) == 0)
+        {
+            auto found = paged.find(key);
+            if ((found == paged.end()) != (reference.count(key) == 0)) return false;
+            if (found != paged.end()) paged.erase(found);
+            reference.erase(key);
+        }
+        else
+        {
+            auto inserted = paged.try_emplace(key);
+            if (inserted.first->first != key) return false;
+            paged.edit(inserted.first) += i;
+            reference[key] += i;
+        }
+        if (i % 1000 == 0)
+        {
+            snapshots.push_back(paged);
+            snapshotReferences.push_back(reference);
+        }
+    }
+    auto same = [](const PagedMap<std::string, int>& a, const std::map<std::string, int>& b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), b.end());
+    };
+    if (!same(paged, reference) || paged.pageCount() < 2) return false;
+    // writing to the map after a copy doesn't change the copy
+    for (size_t i = 0; i < snapshots.size(); ++i)
+        if (!same(snapshots[i], snapshotReferences[i])) return false;
+    auto from = paged.lower_bound("5");
+    return from != paged.end() && from->first == reference.lower_bound("5")->first;
+}
+
+bool copyOfModelIsASnapshot()
+{
+    MarkovManager man{};
+    for (int i = 0; i < 2000; ++i)
+        man.putEvent(std::to_string((i * 7919) % 113));
+    MarkovChain snapshot = man.getCopyOfModel();
+    const std::string before = snapshot.toString();
+    const size_t sizeBefore = snapshot.getModelSize();
+    for (int i = 0; i < 500; ++i)
+        man.putEvent(std::to_string((i * 31) % 200));
+    if (man.getModelSize() <= sizeBefore) return false;
+    if (snapshot.toString() != before) return false;
+    // and the other way round
+    snapshot.addObservation({"1000"}, "1001");
+    return man.getCopyOfModel().toString().find("1,1000,") == std::string::npos;
+}
+
+bool undoRestoresFeedbackAndReset()
+{
+    MarkovManager man{};
+    man.setUndoDepth(4);
+    for (int i = 0; i < 200; ++i)
+        man.putEvent(std::to_string(i % 5));
+    const std::string learned = man.getModelAsString();
+    for (int i = 0; i < 10; ++i)
+        man.getEvent(false);
+    man.giveNegativeFeedback();
+    const std::string afterFeedback = man.getModelAsString();
+    if (afterFeedback == learned) return false;
+    man.reset();
+    if (man.getModelSize() != 0) return false;
+
+    if (!man.undo() || man.getModelAsString() != afterFeedback) return false;
+    if (!man.undo() || man.getModelAsString() != learned) return false;
+    if (man.getUndoCount() != 0 || man.undo()) return false;
+    if (!man.redo() || man.getModelAsString() != afterFeedback) return false;
+    if (!man.undo()) return false;
+    // learning after an undo still works, and means there is nothing to redo
+    for (int i = 0; i < 20; ++i)
+        man.putEvent(std::to_string(i % 7));
+    if (man.getRedoCount() != 0 || man.redo()) return false;
+    return man.getModelAsString() != learned;
+}
+
+bool undoHistoryIsBounded()
+{
+    MarkovManager man{};
+    size_t retired = 0;
+    man.setUndoDepth(2);
+    man.setRetiredVersionHandler([&retired](MarkovChain::SharedModel&& table) { if (table) ++retired; });
+    for (int i = 0; i < 5; ++i)
+    {
+        man.putEvent(std::to_string(i));
+        man.checkpoint();
+    }
+    if (man.getUndoCount() != 2 || retired != 3) return false;
+    const size_t sizeNow = man.getModelSize();
+    man.putEvent("99");
+    if (!man.undo() || man.getModelSize() != sizeNow) return false;
+    if (!man.undo() || man.getModelSize() >= sizeNow) return false;
+    if (man.undo()) return false;
+    // turning the history off hands everything back
+    man.setUndoDepth(0);
+    man.checkpoint();
+    return retired == 5 && man.getUndoCount() == 0 && man.getRedoCount() == 0;
+}
+
+bool predictRanksSuccessors()
+{
+    MarkovChain chain{};
+    const state_sequence after_a{"a"};
+    for (int i = 0; i < 3; ++i) chain.addObservation(after_a, "b");
+    chain.addObservation(after_a, "c");
+    for (int i = 0; i < 2; ++i) chain.addObservation(after_a, "d");
+    chain.addObservation({"x", "a"}, "e");
+
+    MarkovChain::PredictionResult top = chain.predict({"y", "a"}, 2);
+    if (top.order != 1 || top.successors.size() != 2) return false;
+    if (top.successors[0].observation != "b" || top.successors[1].observation != "d") return false;
+    if (std::abs(top.successors[0].probability - 0.5) > 1e-9) return false;
+    // the highest order that matches wins
+    top = chain.predict({"x", "a"}, 5);
+    if (top.order != 2 || top.successors.size() != 1 || top.successors[0].observation != "e") return false;
+    if (chain.predict({"nope"}, 3).order != 0 || !chain.predict({"nope"}, 3).successors.empty()) return false;
+
+    // the ranking follows learning, removal and a save/load round trip
+    for (int i = 0; i < 3; ++i) chain.addObservation(after_a, "c");
+    top = chain.predict(after_a, 3);
+    if (top.successors[0].observation != "c" || std::abs(top.successors[0].probability - 4.0 / 9.0) > 1e-9) return false;
+    chain.removeMapping(chain.stateSequenceToString(after_a), "c");
+    top = chain.predict(after_a, 3);
+    if (top.successors.size() != 2 || top.successors[0].observation != "b") return false;
+    MarkovChain loaded{};
+    if (!loaded.fromStringBinary(chain.toStringBinary())) return false;
+    top = loaded.predict(after_a, 3);
+    return top.successors.size() == 2 && top.successors[0].observation == "b" && top.successors[1].observation == "d";
+}
+
+bool constrainedSamplingStaysInScale()
+{
+    const MarkovChain::NoteMask cMajor = MarkovChain::NoteMask::forScale(0xAB5, 0);
+    if (!cMajor.allows("60-64-67-") || cMajor.allows("60-61-") || cMajor.allows("0") || cMajor.allows("128-") || cMajor.allows("")) return false;
+    if (!MarkovChain::NoteMask::forScale(0xAB5, 2).allows("61-")) return false; // C# is in D major
+
+    MarkovChain chain{};
+    chain.seed(7);
+    const state_sequence after{"60-"};
+    for (int i = 0; i < 5; ++i) chain.addObservation(after, "62-");
+    for (int i = 0; i < 5; ++i) chain.addObservation(after, "61-");
+    for (int i = 0; i < 2; ++i) chain.addObservation(after, "64-67-");
+    chain.addObservation(after, "61-64-");
+    int d = 0;
+    for (int i = 0; i < 7000; ++i)
+    {
+        const state_single obs = chain.generateObservation(after, 1, false, cMajor);
+        if (obs == "62-") ++d;
+        else if (obs != "64-67-") return false;
+    }
+    // renormalised over what is allowed: 5 in 7
+    if (std::abs(d / 7000.0 - 5.0 / 7.0) > 0.03) return false;
+
+    // nothing allowed at order 2, so it backs off to order 1
+    chain.addObservationAllOrders({"60-", "61-"}, "63-");
+    chain.addObservation({"61-"}, "65-");
+    if (chain.generateObservation({"60-", "61-"}, 2, false, cMajor) != "65-" || chain.getOrderOfLastMatch() != 1) return false;
+    // and nothing allowed anywhere
+    return chain.generateObservation(after, 1, false, MarkovChain::NoteMask{}) == "0";
+}
+
+bool blendedGenerationMixesOrders()
+{
+    MarkovChain chain{};
+    chain.seed(11);
+    for (int i = 0; i < 4; ++i) chain.addObservationAllOrders({"a", "b"}, "x");
+    for (int i = 0; i < 4; ++i) chain.addObservationAllOrders({"c", "b"}, "y");
+    // order 2 after a,b only ever saw x. order 1 after b saw x and y equally
+    auto chanceOfX = [&chain](const state_sequence& context)
+    {
+        int x = 0;
+        for (int i = 0; i < 8000; ++i)
+            if (chain.generateObservation(context, 2) == "x") ++x;
+        return x / 8000.0;
+    };
+    if (chanceOfX({"a", "b"}) != 1.0) return false;
+
+    MarkovChain::BlendOptions weighted;
+    weighted.mode = MarkovChain::BlendOptions::weighted;
+    weighted.orderWeights = {1.0, 1.0};
+    chain.setBlending(weighted);
+    if (std::abs(chanceOfX({"a", "b"}) - 0.75) > 0.02) return false;
+
+    // order 2 keeps 4/(4+1) of the weight, order 1 the other 0.2, which is half x
+    MarkovChain::BlendOptions escape;
+    escape.mode = MarkovChain::BlendOptions::escape;
+    chain.setBlending(escape);
+    if (std::abs(chanceOfX({"a", "b"}) - 0.9) > 0.02) return false;
+    // the walk stops at a blank state, so this is order 1 alone
+    if (std::abs(chanceOfX({"0", "b"}) - 0.5) > 0.03 || chain.getOrderOfLastMatch() != 1) return false;
+    // and an unknown context samples from everything
+    return chain.generateObservation({"q"}, 2) != "0" && chain.getOrderOfLastMatch() == 0;
+}
+
+bool chainsDrawIndependentNumbers()
+{
+    // built in the same instant, as the models of a voice are, so a clock seed would match
+    MarkovChain first{};
+    MarkovChain second{};
+    for (int i = 0; i < 20; ++i)
+    {
+        first.addObservation({"a"}, std::to_string(i));
+        second.addObservation({"a"}, std::to_string(i));
+    }
+    int same = 0;
+    for (int i = 0; i < 200; ++i)
+        if (first.generateObservation({"a"}, 1) == second.generateObservation({"a"}, 1)) ++same;
+    // 1 in 20 by chance
+    return same < 50;
+}
+
+bool sharedModelManagersDiffer()
+{
+    MarkovChain prototype{};
+    for (int i = 0; i < 400; ++i)
+        prototype.addObservationAllOrders({std::to_string(i % 7)}, std::to_string((i * 13) % 11));
+    prototype.prepareForSharing();
+    // as the plugin's voices are when one file is loaded into all of them
+    MarkovManager first{};
+    MarkovManager second{};
+    first.shareModelFrom(prototype);
+    second.shareModelFrom(prototype);
+    int same = 0;
+    for (int i = 0; i < 200; ++i)
+        if (first.getEvent(false) == second.getEvent(false)) ++same;
+    return same < 150;
+}
+
+bool decaySweepKeepsSnapshotShared()
+{
+    MarkovChain chain{};
+    for (int i = 0; i < 20000; ++i)
+        chain.addObservationAllOrders({std::to_string(i % 97), std::to_string((i * 7) % 89)}, std::to_string((i * 13) % 101));
+    // forgets, but too slowly to prune anything
+    chain.setDecay(0.99999, 1e-9);
+    const MarkovChain snapshot = chain;
+    for (int i = 0; i < 1000; ++i)
+        chain.addObservationAllOrders({"1", "2"}, std::to_string(i % 5));
+    // only the pages holding "1,2," and "2,1,2," were written to
+    return snapshot.pagesNotSharedWith(chain) <= 2;
+}
+
+bool undoHistoryStaysSharedAndInBudget()
+{
+    // a version keeps sharing pages with the live model while it learns with decay on
+    MarkovChain chain{};
+    for (int i = 0; i < 20000; ++i)
+        chain.addObservationAllOrders({std::to_string(i % 97), std::to_string((i * 7) % 89)}, std::to_string((i * 13) % 101));
+    chain.setDecay(0.99999, 1e-9);
+    const MarkovChain::ModelVersion version = chain.saveVersion();
+    for (int i = 0; i < 1000; ++i)
+        chain.addObservationAllOrders({"1", "2"}, std::to_string(i % 5));
+    if (MarkovChain::unsharedBytes(version, chain.saveVersion()) * 20 > version.modelBytes) return false;
+
+    // the history counts against the memory budget, oldest versions going first
+    MarkovManager man{};
+    for (int i = 0; i < 3000; ++i)
+        man.putEvent(std::to_string((i * 7919) % 211));
+    const size_t learned = man.getApproxMemoryUsage();
+    man.setUndoDepth(8);
+    man.setMemoryBudget(learned * 3 / 2);
+    man.reset();
+    // the model from before the reset fits alongside the empty one
+    if (man.getUndoCount() != 1) return false;
+    for (int i = 0; i < 3000; ++i)
+        man.putEvent("b" + std::to_string((i * 7919) % 211));
+    // but not alongside a second model as big
+    return man.getUndoCount() == 0 && man.getModelSize() > 0;
+}
+
+bool generationKeepsSnapshotShared()
+{
+    MarkovChain chain{};
+    for (int i = 0; i < 5000; ++i)
+        chain.addObservationAllOrders({std::to_string(i % 13), std::to_string((i * 7) % 11)}, std::to_string((i * 31) % 40));
+    const MarkovChain snapshot = chain;
+    // the page list is this chain's own now, but every page is still shared with the snapshot
+    chain.makeModelPrivate();
+    state_sequence context{"1", "2"};
+    for (int i = 0; i < 2000; ++i)
+    {
+        if (i == 1000) chain.setBlending(MarkovChain::BlendOptions{MarkovChain::BlendOptions::escape, {}});
+        context = {context[1], chain.generateObservation(context, 2)};
+    }
+    // generating only reads, so nothing was copied
+    return chain.pagesNotSharedWith(snapshot) == 0 && snapshot.pagesNotSharedWith(chain) == 0;
+}
+
+bool pagedMapCopiesOnlyWhatIsWritten()
+{
+    PagedMap<int, int> paged;
+    const int keys = 100000;
+    for (int i = 0; i < keys; ++i)
+        paged.try_emplace((i * 7919) % keys);
+    // enough pages for several directories
+    if (paged.size() != keys || paged.pageCount() < PagedMap<int, int>::maxDirectorySize * 4) return false;
+    const PagedMap<int, int> snapshot = paged;
+    auto it = paged.find(4242);
+    paged.edit(it) = 1;
+    // one write copies one directory and one page, and the rest stays shared
+    if (paged.pagesNotIn(snapshot) != 1 || snapshot.pagesNotIn(paged) != 1) return false;
+    if (snapshot.find(4242)->second != 0 || paged.find(4242)->second != 1) return false;
+
+    // walking and lower_bound cross page and directory boundaries
+    int expected = 0;
+    for (const auto& kv : paged)
+        if (kv.first != expected++) return false;
+    for (int i = 0; i < keys; i += 2)
+        paged.erase(paged.find(i));
+    if (paged.size() != keys / 2 || paged.lower_bound(4242)->first != 4243 || paged.find(4242) != paged.end()) return false;
+    // emptying pages and directories
+    for (auto at = paged.begin(); at != paged.end();)
+        at = paged.erase(at);
+    return paged.empty() && paged.begin() == paged.end() && snapshot.size() == static_cast<size_t>(keys);
+}
+
+bool historyCostIsCountedNotCompared()
+{
+    MarkovChain chain{};
+    for (int i = 0; i < 20000; ++i)
+        chain.addObservationAllOrders({std::to_string(i % 97), std::to_string((i * 7) % 89)}, std::to_string((i * 13) % 101));
+    const MarkovChain snapshot = chain;
+    const MarkovChain::ModelVersion version = snapshot.saveVersion();
+    for (int i = 0; i < 300; ++i)
+        chain.addObservationAllOrders({std::to_string(i % 31), std::to_string(i % 29)}, "x");
+    // the copies counted while learning match the pages that are actually no longer shared
+    const size_t bytesPerPage = version.modelBytes / version.table->pageCount();
+    const size_t unshared = snapshot.pagesNotSharedWith(chain);
+    if (unshared == 0 || MarkovChain::unsharedBytes(version, chain.saveVersion()) != bytesPerPage * unshared) return false;
+    // a table from somewhere else shares nothing
+    MarkovChain other{};
+    other.addObservation({"a"}, "b");
+    if (MarkovChain::unsharedBytes(version, other.saveVersion()) != bytesPerPage * version.table->pageCount()) return false;
+
+    // playing doesn't cost the history anything, so it never loses an undo
+    MarkovManager man{4};
+    std::mt19937 rng(3);
+    for (int i = 0; i < 5000; ++i)
+        man.putEvent(std::to_string(1 + rng() % 50));
+    man.setUndoDepth(4);
+    man.checkpoint();
+    man.putEvent("1");
+    const size_t budget = man.getApproxMemoryUsage() * 11 / 10;
+    man.setMemoryBudget(budget);
+    if (man.getUndoCount() != 1) return false;
+    state_sequence events;
+    for (int i = 0; i < 2000; ++i)
+        man.getEvents(events, 4, false);
+    // setting the budget measures the history again
+    man.setMemoryBudget(budget);
+    return man.getUndoCount() == 1;
+}
+
+bool orderZeroSummaryFollowsTheModel()
+{
+    const MarkovChain::NoteMask cMajor = MarkovChain::NoteMask::forScale(0xAB5, 0);
+    const state_sequence unknown{"999-"};
+    MarkovChain chain{};
+    chain.seed(3);
+    // lots of contexts, none of them followed by anything in C major
+    const char* blackKeys[] = {"61-", "63-", "66-", "68-", "70-"};
+    for (int i = 0; i < 5000; ++i)
+        chain.addObservationAllOrders({blackKeys[i % 5], blackKeys[(i * 7) % 5], std::to_string(i % 97) + "-"}, blackKeys[(i * 3) % 5]);
+    if (chain.generateObservation(unknown, 1, false, cMajor) != "0") return false;
+    const MarkovChain::ModelVersion before = chain.saveVersion();
+
+    // order 0 picks allowed observations in proportion to the contexts they follow
+    chain.addObservation({"61-"}, "60-");
+    for (const char* key : {"63-", "66-", "68-"}) chain.addObservation({key}, "62-");
+    int d = 0;
+    for (int i = 0; i < 4000; ++i)
+    {
+        const state_single obs = chain.generateObservation(unknown, 1, false, cMajor);
+        if (obs == "62-") ++d;
+        else if (obs != "60-") return false;
+    }
+    if (std::abs(d / 4000.0 - 0.75) > 0.03) return false;
+
+    // removing an observation from the last context it follows takes it out of the summary
+    chain.removeMapping(chain.stateSequenceToString({"61-"}), "60-");
+    for (const char* key : {"63-", "66-", "68-"}) chain.removeMapping(chain.stateSequenceToString({key}), "62-");
+    if (chain.generateObservation(unknown, 1, false, cMajor) != "0") return false;
+
+    // a restored version brings its own observations back with it
+    chain.addObservation({"70-"}, "64-");
+    MarkovChain other{};
+    other.shareModelFrom(chain);
+    chain.restoreVersion(before);
+    if (chain.generateObservation(unknown, 1, false, cMajor) != "0") return false;
+    return other.generateObservation(unknown, 1, false, cMajor) == "64-";
+}
+
 void runMarkovTests()
 {
     int total_tests, passed_tests;
@@ -1210,6 +1900,146 @@ log("binaryRoundTripMatchesText", res);
     // log("putAndGetTheSame", res);
     total_tests ++;
     if (res) passed_tests ++;
+
+    res = aliasSamplingMatchesCounts();
+    log("aliasSamplingMatchesCounts", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = memoryBudgetBoundsModel();
+    log("memoryBudgetBoundsModel", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = decayForgetsOldMaterial();
+    log("decayForgetsOldMaterial", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = compactionDropsSingletonContexts();
+    log("compactionDropsSingletonContexts", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = binaryV2RoundTripAndReadsV1();
+    log("binaryV2RoundTripAndReadsV1", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = statusTracksPutAndGet();
+    log("statusTracksPutAndGet", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = resetAndReleaseHandsBackModel();
+    log("resetAndReleaseHandsBackModel", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = getEventsMatchesRepeatedGetEvent();
+    log("getEventsMatchesRepeatedGetEvent", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = seededManagersGenerateTheSame();
+    log("seededManagersGenerateTheSame", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = mergeFromAddsCounts();
+    log("mergeFromAddsCounts", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = mergeTreeMatchesSequentialMerge();
+    log("mergeTreeMatchesSequentialMerge", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = sharedModelCopiesOnWrite();
+    log("sharedModelCopiesOnWrite", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = sharedModelGenerates();
+    log("sharedModelGenerates", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = pagedMapMatchesStdMap();
+    log("pagedMapMatchesStdMap", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = copyOfModelIsASnapshot();
+    log("copyOfModelIsASnapshot", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = undoRestoresFeedbackAndReset();
+    log("undoRestoresFeedbackAndReset", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = undoHistoryIsBounded();
+    log("undoHistoryIsBounded", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = predictRanksSuccessors();
+    log("predictRanksSuccessors", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = constrainedSamplingStaysInScale();
+    log("constrainedSamplingStaysInScale", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = blendedGenerationMixesOrders();
+    log("blendedGenerationMixesOrders", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = chainsDrawIndependentNumbers();
+    log("chainsDrawIndependentNumbers", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = sharedModelManagersDiffer();
+    log("sharedModelManagersDiffer", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = decaySweepKeepsSnapshotShared();
+    log("decaySweepKeepsSnapshotShared", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = undoHistoryStaysSharedAndInBudget();
+    log("undoHistoryStaysSharedAndInBudget", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = generationKeepsSnapshotShared();
+    log("generationKeepsSnapshotShared", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = pagedMapCopiesOnlyWhatIsWritten();
+    log("pagedMapCopiesOnlyWhatIsWritten", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = historyCostIsCountedNotCompared();
+    log("historyCostIsCountedNotCompared", res);
+    total_tests ++;
+    if (res) passed_tests ++;
+
+    res = orderZeroSummaryFollowsTheModel();
+    log("orderZeroSummaryFollowsTheModel", res);
+    total_tests ++;
+    if (res) passed_tests ++;
 }
 
 int main(){
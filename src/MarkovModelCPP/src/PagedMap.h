@@ -0,0 +1,300 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+
+/**
+ * A sorted map split into pages of a few dozen entries, each held by a shared_ptr. The pages are
+ * indexed by directories of up to a few dozen pages, which are shared the same way. Copying a 
+ * PagedMap only copies the directory pointers, and a directory or page is copied the first time 
+ * one of the maps sharing it changes it. So taking a copy is cheap, and the first write after a 
+ * copy costs a copy of one directory and one page, however big the map is.
+ *
+ * Lookups and iteration are read only. To change a value, ask for it through edit, which gives
+ * the iterator's page to this map alone first. Two maps sharing pages can be read from on
+ * different threads, but one map must not be written to while another thread reads that same map.
+ */
+template <typename Key, typename Value>
+class PagedMap
+{
+public:
+    using Page = std::map<Key, Value>;
+    using value_type = typename Page::value_type;
+
+    /** pages are split in two when they grow past this */
+    static constexpr size_t maxPageSize = 64;
+    /** and directories when they hold more pages than this */
+    static constexpr size_t maxDirectorySize = 64;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename Page::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        const_iterator() = default;
+        reference operator*() const { return *it; }
+        pointer operator->() const { return &*it; }
+        const_iterator& operator++()
+        {
+            if (++it == owner->pageAt(dir, page).end())
+                *this = owner->firstEntryOf(dir, page + 1);
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator was = *this; ++(*this); return was; }
+        bool operator==(const const_iterator& other) const
+        {
+            // end() has dir == directories.size() and no valid map iterator
+            return dir == other.dir && page == other.page && (dir == owner->directories.size() || it == other.it);
+        }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        friend class PagedMap;
+        const_iterator(const PagedMap* o, size_t d, size_t p, typename Page::const_iterator i) : owner{o}, dir{d}, page{p}, it{i} {}
+        const PagedMap* owner { nullptr };
+        size_t dir { 0 };
+        size_t page { 0 };
+        typename Page::const_iterator it;
+    };
+
+    PagedMap() = default;
+    /** take over an ordinary map, e.g. one built by a parser */
+    explicit PagedMap(Page&& sorted)
+    {
+        while (!sorted.empty())
+        {
+            // half full, so the first inserts don't split straight away
+            if (directories.empty() || directories.back()->size() >= maxDirectorySize / 2)
+                directories.push_back(std::make_shared<Directory>());
+            auto page = std::make_shared<Page>();
+            for (size_t i = 0; i < maxPageSize / 2 && !sorted.empty(); ++i)
+                page->insert(page->end(), sorted.extract(sorted.begin()));
+            count += page->size();
+            directories.back()->push_back(std::move(page));
+            ++pages;
+        }
+    }
+
+    const_iterator begin() const { return firstEntryOf(0, 0); }
+    const_iterator end() const { return const_iterator{this, directories.size(), 0, {}}; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() { directories.clear(); count = 0; pages = 0; }
+    size_t pageCount() const { return pages; }
+    /**
+     * how many shared pages this map, and the maps it was copied from, have copied to write to. 
+     * each one is a page the map no longer shares, so for two maps where one was copied from 
+     * the other, the difference is about how many pages they don't share, without comparing them
+     */
+    size_t pageCopies() const { return copiedPages; }
+
+    const_iterator find(const Key& key) const
+    {
+        if (directories.empty()) return end();
+        const Slot at = slotFor(key);
+        const Page& page = pageAt(at.dir, at.page);
+        auto it = page.find(key);
+        return it == page.end() ? end() : const_iterator{this, at.dir, at.page, it};
+    }
+
+    const_iterator lower_bound(const Key& key) const
+    {
+        if (directories.empty()) return end();
+        const Slot at = slotFor(key);
+        const Page& page = pageAt(at.dir, at.page);
+        auto it = page.lower_bound(key);
+        if (it == page.end())
+            return firstEntryOf(at.dir, at.page + 1);
+        return const_iterator{this, at.dir, at.page, it};
+    }
+
+    /** how many of this map's pages other doesn't use, e.g. what a snapshot holds on to by itself */
+    size_t pagesNotIn(const PagedMap& other) const
+    {
+        size_t missing = 0;
+        size_t od = 0;
+        size_t op = 0;
+        // both are in key order and a shared page starts at the same key in both
+        auto skipBefore = [&](const Key& key) {
+            while (od < other.directories.size() && other.pageAt(od, op).begin()->first < key)
+                if (++op == other.directories[od]->size()) { op = 0; ++od; }
+        };
+        for (const auto& dir : directories)
+        {
+            skipBefore(dir->front()->begin()->first);
+            // a shared directory means all of its pages are shared
+            if (op == 0 && od < other.directories.size() && other.directories[od] == dir)
+            {
+                ++od;
+                continue;
+            }
+            for (const auto& page : *dir)
+            {
+                skipBefore(page->begin()->first);
+                if (od == other.directories.size() || (*other.directories[od])[op] != page) ++missing;
+            }
+        }
+        return missing;
+    }
+
+    /** true if another map still uses the page this entry is on, i.e. edit would copy it */
+    bool isShared(const const_iterator& pos) const
+    {
+        const auto& dir = directories[pos.dir];
+        return dir.use_count() > 1 || (*dir)[pos.page].use_count() > 1;
+    }
+
+    /**
+     * the value at pos, for writing. if the page it is on is shared it is copied first and
+     * pos is moved to the same entry in the copy
+     */
+    Value& edit(const_iterator& pos)
+    {
+        if (makePagePrivate(pos.dir, pos.page))
+            pos.it = pageAt(pos.dir, pos.page).find(pos.it->first);
+        // the empty range erase turns a const_iterator into an iterator without a search
+        return writablePage(pos.dir, pos.page).erase(pos.it, pos.it)->second;
+    }
+
+    /** find the entry for key, adding a default value if there isn't one. true if it was added */
+    std::pair<const_iterator, bool> try_emplace(const Key& key)
+    {
+        if (directories.empty())
+        {
+            directories.push_back(std::make_shared<Directory>(1, std::make_shared<Page>()));
+            pages = 1;
+        }
+        Slot at = slotFor(key);
+        auto found = pageAt(at.dir, at.page).find(key);
+        if (found != pageAt(at.dir, at.page).end())
+            return {const_iterator{this, at.dir, at.page, found}, false};
+
+        makePagePrivate(at.dir, at.page);
+        Page& page = writablePage(at.dir, at.page);
+        page.try_emplace(key);
+        ++count;
+        if (page.size() > maxPageSize)
+        {
+            splitPage(at.dir, at.page);
+            if (directories[at.dir]->size() > maxDirectorySize)
+                splitDirectory(at.dir);
+            at = slotFor(key);
+        }
+        return {const_iterator{this, at.dir, at.page, pageAt(at.dir, at.page).find(key)}, true};
+    }
+
+    /** remove the entry at pos, returning the one after it */
+    const_iterator erase(const_iterator pos)
+    {
+        const size_t d = pos.dir;
+        const size_t p = pos.page;
+        auto at = pos.it;
+        if (makePagePrivate(d, p))
+            at = pageAt(d, p).find(pos.it->first);
+        Page& page = writablePage(d, p);
+        auto next = page.erase(at);
+        --count;
+        if (page.empty())
+        {
+            Directory& dir = *directories[d];
+            dir.erase(dir.begin() + static_cast<std::ptrdiff_t>(p));
+            --pages;
+            if (!dir.empty())
+                return firstEntryOf(d, p);
+            directories.erase(directories.begin() + static_cast<std::ptrdiff_t>(d));
+            return firstEntryOf(d, 0);
+        }
+        if (next == page.end())
+            return firstEntryOf(d, p + 1);
+        return const_iterator{this, d, p, next};
+    }
+
+private:
+    using Directory = std::vector<std::shared_ptr<Page>>;
+    struct Slot
+    {
+        size_t dir;
+        size_t page;
+    };
+
+    const Page& pageAt(size_t d, size_t p) const { return *(*directories[d])[p]; }
+    /** only once makePagePrivate has been called for the page */
+    Page& writablePage(size_t d, size_t p) { return *(*directories[d])[p]; }
+
+    /** the first entry on page p of directory d, moving on to the next directory if p is past its end */
+    const_iterator firstEntryOf(size_t d, size_t p) const
+    {
+        if (d < directories.size() && p == directories[d]->size())
+        {
+            ++d;
+            p = 0;
+        }
+        if (d >= directories.size()) return end();
+        return const_iterator{this, d, p, pageAt(d, p).begin()};
+    }
+
+    /** the page key is on, or would go on. directories and pages are never empty */
+    Slot slotFor(const Key& key) const
+    {
+        auto startsAfter = [](const Key& k, const std::shared_ptr<Page>& page) { return k < page->begin()->first; };
+        auto dirAfter = std::upper_bound(directories.begin() + 1, directories.end(), key,
+            [&](const Key& k, const std::shared_ptr<Directory>& dir) { return startsAfter(k, dir->front()); });
+        const size_t d = static_cast<size_t>(dirAfter - directories.begin()) - 1;
+        const Directory& dir = *directories[d];
+        auto pageAfter = std::upper_bound(dir.begin() + 1, dir.end(), key, startsAfter);
+        return Slot{d, static_cast<size_t>(pageAfter - dir.begin()) - 1};
+    }
+
+    /** give the page, and the directory it is in, to this map alone. true if the page was copied */
+    bool makePagePrivate(size_t d, size_t p)
+    {
+        auto& dir = directories[d];
+        if (dir.use_count() > 1)
+            dir = std::make_shared<Directory>(*dir);
+        auto& page = (*dir)[p];
+        if (page.use_count() == 1)
+            return false;
+        page = std::make_shared<Page>(*page);
+        ++copiedPages;
+        return true;
+    }
+
+    /** move the top half of a full page onto a new page after it. the page must be private */
+    void splitPage(size_t d, size_t p)
+    {
+        Directory& dir = *directories[d];
+        Page& full = *dir[p];
+        auto upper = std::make_shared<Page>();
+        auto it = std::next(full.begin(), static_cast<std::ptrdiff_t>(full.size() / 2));
+        while (it != full.end())
+        {
+            auto moving = it++;
+            upper->insert(upper->end(), full.extract(moving));
+        }
+        dir.insert(dir.begin() + static_cast<std::ptrdiff_t>(p + 1), std::move(upper));
+        ++pages;
+    }
+
+    /** the same for a full directory, which must be private */
+    void splitDirectory(size_t d)
+    {
+        Directory& full = *directories[d];
+        const auto half = full.begin() + static_cast<std::ptrdiff_t>(full.size() / 2);
+        auto upper = std::make_shared<Directory>(std::make_move_iterator(half), std::make_move_iterator(full.end()));
+        full.erase(half, full.end());
+        directories.insert(directories.begin() + static_cast<std::ptrdiff_t>(d + 1), std::move(upper));
+    }
+
+    std::vector<std::shared_ptr<Directory>> directories;
+    size_t count { 0 };
+    size_t pages { 0 };
+    size_t copiedPages { 0 };
+};
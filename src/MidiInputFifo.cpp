@@ -0,0 +1,46 @@
+#include "MidiInputFifo.h"
+#include <cstring>
+
+bool MidiInputFifo::push(const juce::MidiMessage& msg, int sampleOffset)
+{
+    const int size = msg.getRawDataSize();
+    if (size < 1 || size > 3)
+        return false;
+
+    Record record {};
+    std::memcpy(record.bytes, msg.getRawData(), static_cast<size_t>(size));
+    record.numBytes = static_cast<juce::uint8>(size);
+    record.sampleOffset = juce::jmax(0, sampleOffset);
+
+    const juce::SpinLock::ScopedLockType lock(producerLock);
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(1, start1, size1, start2, size2);
+    if (size1 + size2 < 1)
+        return false;
+    records[static_cast<size_t>(size1 > 0 ? start1 : start2)] = record;
+    fifo.finishedWrite(1);
+    return true;
+}
+
+void MidiInputFifo::popAllInto(juce::MidiBuffer& dest, int numSamples)
+{
+    const int lastSample = juce::jmax(0, numSamples - 1);
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+    auto add = [&](int start, int count)
+    {
+        for (int i = start; i < start + count; ++i)
+        {
+            const Record& record = records[static_cast<size_t>(i)];
+            dest.addEvent(record.bytes, record.numBytes, juce::jmin(record.sampleOffset, lastSample));
+        }
+    };
+    add(start1, size1);
+    add(start2, size2);
+    fifo.finishedRead(size1 + size2);
+}
+
+void MidiInputFifo::discardAll()
+{
+    fifo.finishedRead(fifo.getNumReady());
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <array>
+
+/**
+ * Bounded FIFO of short midi messages going from the message thread (the piano UI, and later
+ * remote or OSC sources) to the audio thread. The audio thread side is wait free and 
+ * nothing allocates after construction. Messages that do not fit are dropped.
+ * Producers are serialised with a spin lock so there can be more than one; the audio thread
+ * never takes it.
+ */
+class MidiInputFifo{
+    public:
+        static constexpr int capacity = 1024;
+        /**
+         * @brief queue a message to be played at sampleOffset in the next block.
+         * Only messages of up to 3 bytes are carried (no sysex).
+         *
+         * @return false if the fifo is full or the message is too long
+         */
+        bool push(const juce::MidiMessage& msg, int sampleOffset);
+        /**
+         * @brief audio thread only. move everything queued into dest, with the sample offsets
+         * clamped into the block.
+         */
+        void popAllInto(juce::MidiBuffer& dest, int numSamples);
+        /** audio thread only. throw away everything queued */
+        void discardAll();
+    private:
+        struct Record {
+            juce::uint8 bytes[3];
+            juce::uint8 numBytes;
+            int sampleOffset;
+        };
+        juce::AbstractFifo fifo { capacity };
+        std::array<Record, capacity> records;
+        juce::SpinLock producerLock;
+};
@@ -0,0 +1,95 @@
+#include "NoteScheduler.h"
+
+NoteScheduler::NoteScheduler(size_t _capacity)
+: capacity{_capacity}, keys(16 * 128, KeyState{0, 0, 0})
+{
+    heap.reserve(capacity);
+}
+
+bool NoteScheduler::scheduleNoteOff(unsigned long time, int channel, int note)
+{
+    if (!validKey(channel, note)) return false;
+    KeyState& key = keys[keyIndex(channel, note)];
+    if (!push({time, key.generation, static_cast<uint8_t>(channel), static_cast<uint8_t>(note), 0, Kind::noteOff}))
+        return false;
+    ++key.pendingOffs;
+    key.latestOff = std::max(key.latestOff, time);
+    return true;
+}
+
+bool NoteScheduler::scheduleNoteOn(unsigned long time, int channel, int note, int velocity)
+{
+    if (!validKey(channel, note)) return false;
+    const auto vel = static_cast<uint8_t>(std::clamp(velocity, 1, 127));
+    return push({time, 0, static_cast<uint8_t>(channel), static_cast<uint8_t>(note), vel, Kind::noteOn});
+}
+
+unsigned long NoteScheduler::latestNoteOff(int channel, int note) const
+{
+    if (!validKey(channel, note)) return 0;
+    return keys[keyIndex(channel, note)].latestOff;
+}
+
+void NoteScheduler::cancelNoteOffs(int channel, int note)
+{
+    if (!validKey(channel, note)) return;
+    KeyState& key = keys[keyIndex(channel, note)];
+    // the events stay in the heap, but no longer match the key's generation
+    ++key.generation;
+    key.pendingOffs = 0;
+    key.latestOff = 0;
+}
+
+void NoteScheduler::clear()
+{
+    heap.clear();
+    for (KeyState& key : keys)
+    {
+        ++key.generation;
+        key.pendingOffs = 0;
+        key.latestOff = 0;
+    }
+}
+
+size_t NoteScheduler::size() const
+{
+    return heap.size();
+}
+
+bool NoteScheduler::later(const Event& a, const Event& b)
+{
+    // std heaps are max heaps, so invert to get the earliest event at the front
+    return a.time > b.time;
+}
+
+bool NoteScheduler::validKey(int channel, int note)
+{
+    return channel >= 1 && channel <= 16 && note >= 0 && note < 128;
+}
+
+size_t NoteScheduler::keyIndex(int channel, int note)
+{
+    return static_cast<size_t>(channel - 1) * 128 + static_cast<size_t>(note);
+}
+
+bool NoteScheduler::push(const Event& event)
+{
+    if (heap.size() >= capacity)
+    {
+        purgeCancelled();
+        if (heap.size() >= capacity) return false;
+    }
+    heap.push_back(event);
+    std::push_heap(heap.begin(), heap.end(), later);
+    return true;
+}
+
+void NoteScheduler::purgeCancelled()
+{
+    auto cancelled = [this](const Event& e)
+    {
+        return e.kind == Kind::noteOff && e.generation != keys[keyIndex(e.channel, e.note)].generation;
+    };
+    heap.erase(std::remove_if(heap.begin(), heap.end(), cancelled), heap.end());
+    std::make_heap(heap.begin(), heap.end(), later);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * Sample accurate scheduler for future note events, e.g. the note offs for generated notes.
+ * Events live in a min-heap ordered by absolute sample time, with its capacity allocated up front,
+ * so scheduling and draining never allocate on the audio thread and each block only touches
+ * the events that fall due in it.
+ * Any number of offs can be pending per channel/ note. Cancelled offs are left in the heap and
+ * skipped when they come due.
+ */
+class NoteScheduler{
+    public:
+        enum class Kind : uint8_t { noteOff, noteOn };
+        struct Event {
+            unsigned long time;
+            uint32_t generation;
+            uint8_t channel; // 1-16
+            uint8_t note;
+            uint8_t velocity;
+            Kind kind;
+        };
+        /**
+         * @brief Construct a new Note Scheduler
+         *
+         * @param capacity: most events that can be pending at once
+         */
+        NoteScheduler(size_t capacity = 4096);
+        /**
+         * @brief schedule a note off at the sent absolute sample time
+         *
+         * @return false if the scheduler is full or the channel/note is out of range
+         */
+        bool scheduleNoteOff(unsigned long time, int channel, int note);
+        /** schedule a note on at the sent absolute sample time. note ons cannot be cancelled */
+        bool scheduleNoteOn(unsigned long time, int channel, int note, int velocity);
+        /** the time of the latest note off pending for this channel/ note, or 0 if there is none */
+        unsigned long latestNoteOff(int channel, int note) const;
+        /** drop every note off pending for this channel/ note */
+        void cancelNoteOffs(int channel, int note);
+        /**
+         * @brief hand every event due before windowEnd to handler, earliest first, and remove it.
+         * Events that were due before the window started are included, so nothing is lost if
+         * a block was skipped.
+         *
+         * @param handler: called with a const Event&
+         */
+        template <typename Handler>
+        void processDue(unsigned long windowEnd, Handler&& handler)
+        {
+            while (!heap.empty() && heap.front().time < windowEnd)
+            {
+                std::pop_heap(heap.begin(), heap.end(), later);
+                const Event event = heap.back();
+                heap.pop_back();
+                if (event.kind == Kind::noteOff)
+                {
+                    KeyState& key = keys[keyIndex(event.channel, event.note)];
+                    if (event.generation != key.generation) continue; // cancelled
+                    if (--key.pendingOffs == 0) key.latestOff = 0;
+                }
+                handler(event);
+            }
+        }
+        /** forget everything that is pending */
+        void clear();
+        /** number of events in the heap, including cancelled ones not yet reached */
+        size_t size() const;
+    private:
+        struct KeyState {
+            uint32_t generation;
+            uint32_t pendingOffs;
+            unsigned long latestOff;
+        };
+        static bool later(const Event& a, const Event& b);
+        static bool validKey(int channel, int note);
+        static size_t keyIndex(int channel, int note);
+        bool push(const Event& event);
+        /** remove cancelled events to make room. only happens when the heap is full */
+        void purgeCancelled();
+
+        std::vector<Event> heap;
+        size_t capacity;
+        std::vector<KeyState> keys;
+};
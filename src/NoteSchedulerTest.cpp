@@ -0,0 +1,64 @@
+#include "NoteScheduler.h"
+#include <iostream>
+#include <assert.h>
+
+int main()
+{
+    NoteScheduler ns {8};
+    std::vector<NoteScheduler::Event> got;
+    auto collect = [&got](const NoteScheduler::Event& e){ got.push_back(e); };
+
+    // events come out in time order, only when due
+    ns.scheduleNoteOff(300, 1, 60);
+    ns.scheduleNoteOff(100, 2, 64);
+    ns.scheduleNoteOff(200, 1, 67);
+    ns.processDue(100, collect);
+    assert(got.size() == 0);
+    ns.processDue(250, collect);
+    assert(got.size() == 2);
+    assert(got[0].note == 64 && got[0].channel == 2);
+    assert(got[1].note == 67);
+    assert(ns.latestNoteOff(1, 60) == 300);
+    assert(ns.latestNoteOff(1, 67) == 0);
+
+    // retrigger: cancel the old off, the new one still fires
+    ns.cancelNoteOffs(1, 60);
+    assert(ns.latestNoteOff(1, 60) == 0);
+    ns.scheduleNoteOff(500, 1, 60);
+    got.clear();
+    ns.processDue(400, collect);
+    assert(got.size() == 0);
+    ns.processDue(501, collect);
+    assert(got.size() == 1 && got[0].time == 500);
+
+    // two offs pending for the same note both fire
+    ns.scheduleNoteOff(600, 1, 48);
+    ns.scheduleNoteOff(700, 1, 48);
+    assert(ns.latestNoteOff(1, 48) == 700);
+    ns.processDue(650, collect);
+    assert(ns.latestNoteOff(1, 48) == 700);
+    ns.processDue(800, collect);
+    assert(ns.latestNoteOff(1, 48) == 0);
+    assert(got.size() == 3);
+
+    // note ons ride along too
+    ns.scheduleNoteOn(900, 3, 72, 100);
+    got.clear();
+    ns.processDue(1000, collect);
+    assert(got.size() == 1 && got[0].kind == NoteScheduler::Kind::noteOn && got[0].velocity == 100);
+
+    // full: cancelled events are purged to make room, then it refuses
+    for (int i = 0; i < 8; ++i)
+        assert(ns.scheduleNoteOff(2000 + i, 1, 30));
+    ns.cancelNoteOffs(1, 30);
+    for (int i = 0; i < 8; ++i)
+        assert(ns.scheduleNoteOff(3000 + i, 1, 31 + i));
+    assert(!ns.scheduleNoteOff(4000, 1, 50));
+    assert(!ns.scheduleNoteOff(10, 17, 50));
+
+    got.clear();
+    ns.processDue(5000, collect);
+    assert(got.size() == 8);
+
+    std::cout << "NoteScheduler tests passed" << std::endl;
+}
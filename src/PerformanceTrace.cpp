@@ -0,0 +1,295 @@
+#include "PerformanceTrace.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+namespace
+{
+constexpr char traceMagic[4] = { 'M', 'M', 'T', 'R' };
+constexpr uint64_t traceVersion = 1;
+
+void appendVarint(std::string& dest, uint64_t value)
+{
+    while (value >= 0x80u)
+    {
+        dest.push_back(static_cast<char>((value & 0x7Fu) | 0x80u));
+        value >>= 7;
+    }
+    dest.push_back(static_cast<char>(value));
+}
+
+bool readVarint(const std::string& src, size_t& offset, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (offset >= src.size())
+            return false;
+        const auto byte = static_cast<unsigned char>(src[offset++]);
+        value |= static_cast<uint64_t>(byte & 0x7Fu) << shift;
+        if ((byte & 0x80u) == 0)
+            return true;
+    }
+    return false;
+}
+
+/** zig-zag, so small negative numbers stay small */
+void appendSigned(std::string& dest, int64_t value)
+{
+    appendVarint(dest, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+bool readSigned(const std::string& src, size_t& offset, int64_t& value)
+{
+    uint64_t raw;
+    if (!readVarint(src, offset, raw))
+        return false;
+    value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1u);
+    return true;
+}
+
+// floating point values are stored bit for bit, as replay has to be exact
+void appendFixed(std::string& dest, uint64_t bits, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        dest.push_back(static_cast<char>((bits >> (8 * i)) & 0xFFu));
+}
+
+bool readFixed(const std::string& src, size_t& offset, uint64_t& bits, int bytes)
+{
+    if (offset + static_cast<size_t>(bytes) > src.size())
+        return false;
+    bits = 0;
+    for (int i = 0; i < bytes; ++i)
+        bits |= static_cast<uint64_t>(static_cast<unsigned char>(src[offset + i])) << (8 * i);
+    offset += static_cast<size_t>(bytes);
+    return true;
+}
+
+void appendDouble(std::string& dest, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    appendFixed(dest, bits, 8);
+}
+
+bool readDouble(const std::string& src, size_t& offset, double& value)
+{
+    uint64_t bits;
+    if (!readFixed(src, offset, bits, 8))
+        return false;
+    std::memcpy(&value, &bits, sizeof(value));
+    return true;
+}
+
+void appendFloat(std::string& dest, float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    appendFixed(dest, bits, 4);
+}
+
+bool readFloat(const std::string& src, size_t& offset, float& value)
+{
+    uint64_t bits;
+    if (!readFixed(src, offset, bits, 4))
+        return false;
+    const auto bits32 = static_cast<uint32_t>(bits);
+    std::memcpy(&value, &bits32, sizeof(value));
+    return true;
+}
+
+void appendMidi(std::string& dest, const PerformanceTrace::MidiEvent& event)
+{
+    appendSigned(dest, event.samplePos);
+    dest.push_back(static_cast<char>(event.size));
+    for (uint8_t i = 0; i < event.size; ++i)
+        dest.push_back(static_cast<char>(event.bytes[i]));
+}
+
+bool readMidi(const std::string& src, size_t& offset, PerformanceTrace::MidiEvent& event)
+{
+    int64_t samplePos;
+    if (!readSigned(src, offset, samplePos) || offset >= src.size())
+        return false;
+    event = {};
+    event.samplePos = static_cast<int32_t>(samplePos);
+    event.size = static_cast<uint8_t>(src[offset++]);
+    if (event.size > 3 || offset + event.size > src.size())
+        return false;
+    for (uint8_t i = 0; i < event.size; ++i)
+        event.bytes[i] = static_cast<uint8_t>(src[offset++]);
+    return true;
+}
+}
+
+void PerformanceTrace::reserve(size_t blockCount)
+{
+    blocks.reserve(blockCount);
+    params.reserve(blockCount);
+    midiIn.reserve(blockCount * 4);
+    midiOut.reserve(blockCount * 4);
+}
+
+void PerformanceTrace::clear()
+{
+    blocks.clear();
+    params.clear();
+    midiIn.clear();
+    midiOut.clear();
+}
+
+PerformanceTrace::Block& PerformanceTrace::beginBlock(uint32_t numSamples, uint16_t flags)
+{
+    Block block {};
+    block.numSamples = numSamples;
+    block.flags = flags;
+    block.firstParam = static_cast<uint32_t>(params.size());
+    block.firstMidiIn = static_cast<uint32_t>(midiIn.size());
+    block.firstMidiOut = static_cast<uint32_t>(midiOut.size());
+    blocks.push_back(block);
+    return blocks.back();
+}
+
+void PerformanceTrace::addParamChange(uint16_t index, float value)
+{
+    if (blocks.empty()) return;
+    params.push_back({index, value});
+    ++blocks.back().numParams;
+}
+
+bool PerformanceTrace::makeEvent(int samplePos, const uint8_t* data, int size, MidiEvent& event)
+{
+    if (size < 1 || size > 3) return false;
+    event = {};
+    event.samplePos = samplePos;
+    event.size = static_cast<uint8_t>(size);
+    std::memcpy(event.bytes, data, static_cast<size_t>(size));
+    return true;
+}
+
+bool PerformanceTrace::addMidiIn(int samplePos, const uint8_t* data, int size)
+{
+    MidiEvent event;
+    if (blocks.empty() || !makeEvent(samplePos, data, size, event)) return false;
+    midiIn.push_back(event);
+    ++blocks.back().numMidiIn;
+    return true;
+}
+
+bool PerformanceTrace::addMidiOut(int samplePos, const uint8_t* data, int size)
+{
+    MidiEvent event;
+    if (blocks.empty() || !makeEvent(samplePos, data, size, event)) return false;
+    midiOut.push_back(event);
+    ++blocks.back().numMidiOut;
+    return true;
+}
+
+bool PerformanceTrace::save(const std::string& filename) const
+{
+    std::string buffer(traceMagic, sizeof(traceMagic));
+    appendVarint(buffer, traceVersion);
+    appendVarint(buffer, seed);
+    appendDouble(buffer, sampleRate);
+    appendVarint(buffer, static_cast<uint64_t>(maxBlockSize));
+    appendVarint(buffer, blocks.size());
+    for (const Block& block : blocks)
+    {
+        appendVarint(buffer, block.numSamples);
+        appendVarint(buffer, block.flags);
+        if (block.flags & hasPpq) appendDouble(buffer, block.ppqPosition);
+        if (block.flags & hasBpm) appendDouble(buffer, block.bpm);
+        if (block.flags & hasTimeInSamples) appendSigned(buffer, block.timeInSamples);
+        // the arrays are written in block order, so the counts are enough to find them again
+        appendVarint(buffer, block.numParams);
+        for (uint32_t i = 0; i < block.numParams; ++i)
+        {
+            appendVarint(buffer, params[block.firstParam + i].index);
+            appendFloat(buffer, params[block.firstParam + i].value);
+        }
+        appendVarint(buffer, block.numMidiIn);
+        for (uint32_t i = 0; i < block.numMidiIn; ++i)
+            appendMidi(buffer, midiIn[block.firstMidiIn + i]);
+        appendVarint(buffer, block.numMidiOut);
+        for (uint32_t i = 0; i < block.numMidiOut; ++i)
+            appendMidi(buffer, midiOut[block.firstMidiOut + i]);
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open())
+        return false;
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    return static_cast<bool>(out);
+}
+
+bool PerformanceTrace::load(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open())
+        return false;
+    std::stringstream contents;
+    contents << in.rdbuf();
+    const std::string src = contents.str();
+
+    if (src.size() < sizeof(traceMagic) || std::memcmp(src.data(), traceMagic, sizeof(traceMagic)) != 0)
+        return false;
+    size_t offset = sizeof(traceMagic);
+    uint64_t version, seedValue, blockSize, blockCount;
+    double rate;
+    if (!readVarint(src, offset, version) || version != traceVersion)
+        return false;
+    if (!readVarint(src, offset, seedValue) || !readDouble(src, offset, rate)
+        || !readVarint(src, offset, blockSize) || !readVarint(src, offset, blockCount))
+        return false;
+
+    PerformanceTrace loaded;
+    loaded.seed = static_cast<uint32_t>(seedValue);
+    loaded.sampleRate = rate;
+    loaded.maxBlockSize = static_cast<int>(blockSize);
+    for (uint64_t b = 0; b < blockCount; ++b)
+    {
+        uint64_t numSamples, flags, count;
+        if (!readVarint(src, offset, numSamples) || !readVarint(src, offset, flags))
+            return false;
+        Block& block = loaded.beginBlock(static_cast<uint32_t>(numSamples), static_cast<uint16_t>(flags));
+        if ((block.flags & hasPpq) && !readDouble(src, offset, block.ppqPosition))
+            return false;
+        if ((block.flags & hasBpm) && !readDouble(src, offset, block.bpm))
+            return false;
+        if ((block.flags & hasTimeInSamples) && !readSigned(src, offset, block.timeInSamples))
+            return false;
+
+        if (!readVarint(src, offset, count))
+            return false;
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint64_t index;
+            float value;
+            if (!readVarint(src, offset, index) || !readFloat(src, offset, value))
+                return false;
+            loaded.addParamChange(static_cast<uint16_t>(index), value);
+        }
+        for (auto* events : { &loaded.midiIn, &loaded.midiOut })
+        {
+            if (!readVarint(src, offset, count))
+                return false;
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                MidiEvent event;
+                if (!readMidi(src, offset, event))
+                    return false;
+                events->push_back(event);
+            }
+            if (events == &loaded.midiIn)
+                loaded.blocks.back().numMidiIn = static_cast<uint32_t>(count);
+            else
+                loaded.blocks.back().numMidiOut = static_cast<uint32_t>(count);
+        }
+    }
+    if (offset != src.size())
+        return false;
+
+    *this = std::move(loaded);
+    return true;
+}
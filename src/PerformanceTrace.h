@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Everything from outside that drives a run of the processor: the seed for its random number
+ * generators, then per block the block size, host transport, parameter changes, requests from
+ * the GUI and the incoming midi. The midi that came out is kept too, so a replay can check
+ * that it produced exactly the same thing.
+ * Blocks index into the shared params/ midi arrays, so recording a block is a few push_backs
+ * into vectors that were reserved up front.
+ */
+class PerformanceTrace{
+    public:
+        /** a short midi message at a sample offset in its block. longer messages are not traced */
+        struct MidiEvent
+        {
+            int32_t samplePos;
+            uint8_t size;
+            uint8_t bytes[3];
+        };
+        /** a parameter whose raw value changed since the previous block. index is into the processor's parameter list */
+        struct ParamChange
+        {
+            uint16_t index;
+            float value;
+        };
+        enum BlockFlags : uint16_t
+        {
+            nonRealtime      = 1 << 0,
+            resetRequested   = 1 << 1,
+            allNotesOff      = 1 << 2,
+            transportKnown   = 1 << 3,
+            transportPlaying = 1 << 4,
+            transportRecording = 1 << 5,
+            hasPpq           = 1 << 6,
+            hasBpm           = 1 << 7,
+            hasTimeInSamples = 1 << 8,
+            undoRequested    = 1 << 9,
+            redoRequested    = 1 << 10
+        };
+        struct Block
+        {
+            uint32_t numSamples;
+            uint16_t flags;
+            double ppqPosition;
+            double bpm;
+            int64_t timeInSamples;
+            uint32_t firstParam, numParams;
+            uint32_t firstMidiIn, numMidiIn;
+            uint32_t firstMidiOut, numMidiOut;
+        };
+
+        uint32_t seed { 0 };
+        double sampleRate { 44100.0 };
+        int maxBlockSize { 512 };
+        std::vector<Block> blocks;
+        std::vector<ParamChange> params;
+        std::vector<MidiEvent> midiIn;
+        std::vector<MidiEvent> midiOut;
+
+        /** room for this many blocks before recording has to allocate */
+        void reserve(size_t blockCount);
+        void clear();
+        /** start a new block. the add* calls that follow go into it */
+        Block& beginBlock(uint32_t numSamples, uint16_t flags);
+        void addParamChange(uint16_t index, float value);
+        /** returns false, and adds nothing, if the message is longer than 3 bytes */
+        bool addMidiIn(int samplePos, const uint8_t* data, int size);
+        bool addMidiOut(int samplePos, const uint8_t* data, int size);
+
+        /** write to the sent file in a compact little-endian binary format. returns false if it failed */
+        bool save(const std::string& filename) const;
+        /** replace this trace with the one in the sent file. returns false if it is not a valid trace */
+        bool load(const std::string& filename);
+    private:
+        static bool makeEvent(int samplePos, const uint8_t* data, int size, MidiEvent& event);
+};
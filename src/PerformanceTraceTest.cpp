@@ -0,0 +1,67 @@
+#include "PerformanceTrace.h"
+#include <iostream>
+#include <cstdio>
+#include <assert.h>
+
+int main()
+{
+    PerformanceTrace trace;
+    trace.seed = 0xDEADBEEF;
+    trace.sampleRate = 48000.0;
+    trace.maxBlockSize = 256;
+
+    const uint8_t noteOn[3] = {0x90, 60, 100};
+    const uint8_t noteOff[3] = {0x80, 60, 0};
+    const uint8_t sysex[4] = {0xF0, 1, 2, 0xF7};
+
+    PerformanceTrace::Block& first = trace.beginBlock(256, PerformanceTrace::transportKnown | PerformanceTrace::transportPlaying
+                                                           | PerformanceTrace::hasPpq | PerformanceTrace::hasBpm
+                                                           | PerformanceTrace::hasTimeInSamples);
+    first.ppqPosition = 1.0 / 3.0;
+    first.bpm = 123.456;
+    first.timeInSamples = -12;
+    trace.addParamChange(0, 1.0f);
+    trace.addParamChange(7, 0.1f);
+    assert(trace.addMidiIn(10, noteOn, 3));
+    assert(!trace.addMidiIn(11, sysex, 4));
+    assert(trace.addMidiOut(20, noteOn, 3));
+
+    trace.beginBlock(100, PerformanceTrace::resetRequested);
+    assert(trace.addMidiIn(0, noteOff, 3));
+    assert(trace.addMidiOut(99, noteOff, 3));
+    assert(trace.addMidiOut(99, noteOn, 2));
+
+    const std::string filename = "performance_trace_test.mmtrace";
+    assert(trace.save(filename));
+    PerformanceTrace loaded;
+    assert(loaded.load(filename));
+    std::remove(filename.c_str());
+
+    // everything comes back bit for bit
+    assert(loaded.seed == 0xDEADBEEF);
+    assert(loaded.sampleRate == 48000.0 && loaded.maxBlockSize == 256);
+    assert(loaded.blocks.size() == 2);
+    assert(loaded.blocks[0].ppqPosition == 1.0 / 3.0);
+    assert(loaded.blocks[0].bpm == 123.456);
+    assert(loaded.blocks[0].timeInSamples == -12);
+    assert(loaded.blocks[0].numParams == 2 && loaded.params[1].index == 7 && loaded.params[1].value == 0.1f);
+    assert(loaded.blocks[0].numMidiIn == 1 && loaded.midiIn[0].samplePos == 10 && loaded.midiIn[0].bytes[2] == 100);
+    assert(loaded.blocks[1].flags == PerformanceTrace::resetRequested);
+    assert(loaded.blocks[1].numSamples == 100);
+    assert(loaded.blocks[1].numParams == 0);
+    assert(loaded.blocks[1].firstMidiIn == 1 && loaded.midiIn[1].bytes[0] == 0x80);
+    assert(loaded.blocks[1].firstMidiOut == 1 && loaded.blocks[1].numMidiOut == 2);
+    assert(loaded.midiOut[2].size == 2 && loaded.midiOut[2].samplePos == 99);
+
+    // not a trace
+    {
+        std::FILE* f = std::fopen(filename.c_str(), "wb");
+        std::fputs("MKCB nonsense", f);
+        std::fclose(f);
+    }
+    assert(!loaded.load(filename));
+    assert(loaded.blocks.size() == 2);
+    std::remove(filename.c_str());
+
+    std::cout << "PerformanceTrace tests passed" << std::endl;
+}
@@ -130,6 +130,56 @@ void MidiMarkovEditor::handleNoteOff(juce::MidiKeyboardState *source, int midiCh
 
 
 
+bool MidiMarkovEditor::handleTelemetry(const TelemetryEvent& event)
+{
+    switch (event.type)
+    {
+        case TelemetryEvent::Type::midiIn:
+        case TelemetryEvent::Type::midiOut:
+        {
+            // Synthesize a small message to feed the GUI indicator.
+            const int channel = juce::jlimit(1, 16, static_cast<int>(event.channel));
+            juce::MidiMessage m = event.velocity > 0
+                ? juce::MidiMessage::noteOn(channel, event.note, event.velocity)
+                : juce::MidiMessage::noteOff(channel, event.note);
+            if (event.type == TelemetryEvent::Type::midiIn)
+                improControlUI.midiReceived(m); // runs on message thread → safe
+            else
+                improControlUI.midiSent(m);
+            break;
+        }
+        case TelemetryEvent::Type::clockTick:
+            improControlUI.clockTicked();
+            break;
+        case TelemetryEvent::Type::avoidTransposition:
+            improControlUI.setAvoidTransposition(event.value1);
+            break;
+        case TelemetryEvent::Type::slomoScalar:
+            improControlUI.setSlowMoScalar(event.scalar);
+            break;
+        case TelemetryEvent::Type::overpolyExtra:
+            improControlUI.setOverpolyExtra(event.value1);
+            break;
+        case TelemetryEvent::Type::callResponseEnergy:
+            improControlUI.setCallResponseEnergy(event.scalar);
+            // callResponseMeter.setEnergy(event.scalar);
+            break;
+        case TelemetryEvent::Type::callResponsePhase:
+            improControlUI.setCallResponsePhase(event.value1 != 0, event.value2 != 0);
+            // callResponseMeter.setState(event.value1 != 0, event.value2 != 0);
+            break;
+        case TelemetryEvent::Type::modelStatus:
+            if (event.note < 3)
+            {
+                modelStatus[event.note][0] = event.value1;
+                modelStatus[event.note][1] = event.value2;
+                return true;
+            }
+            break;
+    }
+    return false;
+}
+
 // polling the processor in a thread safe manner to
 void MidiMarkovEditor::timerCallback()
 {
@@ -140,74 +190,25 @@ void MidiMarkovEditor::timerCallback()
         refreshGuiUpdateToggle();
     }
 
-    if (!updateGUI) return; 
-
-    int noteIn; float velIn; int noteOut; float velOut;
-
-    if (audioProcessor.pullMIDIInForGUI(noteIn, velIn, lastMidiInStamp))
-    {
-        // Synthesize a small message to feed the GUI indicator.
-        const bool isOn = velIn > 0.0f;
-        const int channel = 1; // arbitrary; GUI only uses note/velocity
-        juce::MidiMessage m = isOn ? juce::MidiMessage::noteOn(channel, noteIn, velIn)
-                                   : juce::MidiMessage::noteOff(channel, noteIn);
-        improControlUI.midiReceived(m); // runs on message thread → safe
-    }
-    if (audioProcessor.pullMIDIOutForGUI(noteOut, velOut, lastMidiOutStamp))
-    {
-        // Synthesize a small message to feed the GUI indicator.
-        const bool isOn = velOut > 0.0f;
-        const int channel = 1; // arbitrary; GUI only uses note/velocity
-        juce::MidiMessage m = isOn ? juce::MidiMessage::noteOn(channel, noteOut, velOut)
-                                   : juce::MidiMessage::noteOff(channel, noteOut);
-        improControlUI.midiSent(m); // runs on message thread → safe
-    }
-
-    if (audioProcessor.pullClockTickForGUI(lastClockTickStamp))
-    {
-        improControlUI.clockTicked();
-    }
-
-    int avoidSemitone = 0;
-    if (audioProcessor.pullAvoidTranspositionForGUI(avoidSemitone, lastAvoidTransposeStamp))
-    {
-        improControlUI.setAvoidTransposition(avoidSemitone);
-    }
-
-    float slomoScalar = 1.0f;
-    if (audioProcessor.pullSlomoScalarForGUI(slomoScalar, lastSlomoScalarStamp))
-    {
-        improControlUI.setSlowMoScalar(slomoScalar);
-    }
-
-    int overpolyExtra = 0;
-    if (audioProcessor.pullOverpolyExtraForGUI(overpolyExtra, lastOverpolyExtraStamp))
-    {
-        improControlUI.setOverpolyExtra(overpolyExtra);
-    }
-
-    float callRespEnergy = 0.0f;
-    if (audioProcessor.pullCallResponseEnergyForGUI(callRespEnergy, lastCallResponseEnergyStamp))
+    // always drain the telemetry stream so it never backs up, even when the GUI is not updating
+    TelemetryEvent events[256];
+    bool modelStatusChanged = false;
+    size_t count = 0;
+    while ((count = audioProcessor.pullTelemetryForGUI(events, 256)) > 0)
     {
-        improControlUI.setCallResponseEnergy(callRespEnergy);
-        // callResponseMeter.setEnergy(callRespEnergy);
+        if (!updateGUI) continue;
+        for (size_t i = 0; i < count; ++i)
+            modelStatusChanged |= handleTelemetry(events[i]);
     }
 
-    bool callRespEnabled = false;
-    bool callRespInResponse = false;
-    if (audioProcessor.pullCallResponsePhaseForGUI(callRespEnabled, callRespInResponse, lastCallResponsePhaseStamp))
-    {
-        improControlUI.setCallResponsePhase(callRespEnabled, callRespInResponse);
-        // callResponseMeter.setState(callRespEnabled, callRespInResponse);
-    }
+    if (!updateGUI) return; 
 
-    int pitchSize = 0, pitchOrder = 0;
-    int ioiSize = 0, ioiOrder = 0;
-    int durSize = 0, durOrder = 0;
-    if (audioProcessor.pullModelStatusForGUI(pitchSize, pitchOrder, ioiSize, ioiOrder, durSize, durOrder, lastModelStatusStamp))
+    if (modelStatusChanged)
     {
-        improControlUI.setModelStatus(pitchSize, pitchOrder, ioiSize, ioiOrder, durSize, durOrder);
-        // pitchOrderCircle.setOrder(pitchOrder);
+        improControlUI.setModelStatus(modelStatus[0][0], modelStatus[0][1],
+                                      modelStatus[1][0], modelStatus[1][1],
+                                      modelStatus[2][0], modelStatus[2][1]);
+        // pitchOrderCircle.setOrder(modelStatus[0][1]);
     }
 
     ModelIoState ioState = ModelIoState::Idle;
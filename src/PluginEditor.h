@@ -47,7 +47,7 @@ public:
     void handleNoteOff(juce::MidiKeyboardState *source, int midiChannel, int midiNoteNumber, float velocity) override; 
   
     // from Timer
-    void timerCallback() override; // polls processor mailbox
+    void timerCallback() override; // drains the processor telemetry stream
 
     void layoutMainTab();
 
@@ -58,15 +58,11 @@ private:
     MidiMarkovProcessor& audioProcessor;
 
 
-    uint32_t lastMidiInStamp { 0 };
-    uint32_t lastMidiOutStamp { 0 };
-    uint32_t lastClockTickStamp { 0 };
-    uint32_t lastAvoidTransposeStamp { 0 };
-    uint32_t lastSlomoScalarStamp { 0 };
-    uint32_t lastOverpolyExtraStamp { 0 };
-    uint32_t lastCallResponseEnergyStamp { 0 };
-    uint32_t lastCallResponsePhaseStamp { 0 };
-    uint32_t lastModelStatusStamp { 0 };
+    /** pass one telemetry record on to the GUI. returns true if it updated modelStatus */
+    bool handleTelemetry(const TelemetryEvent& event);
+
+    // size and order of the pitch, ioi and duration models, as last reported
+    int modelStatus[3][2] {};
     uint32_t lastModelIoStamp { 0 };
 
     // needed for the mini piano keyboard
@@ -100,6 +100,22 @@ bool MidiMarkovProcessor::decompressModelData(const std::string& compressed, std
     return true;
 }
 
+/** 
+ * the choices for the scale parameter, as the pitch classes they allow counting up from 
+ * the root (bit 0 is the root). Off lets everything through 
+ */
+static const std::array<std::pair<const char*, uint16_t>, 9> scaleChoices {{
+    { "Off", 0 },
+    { "Major", 0xAB5 },
+    { "Natural minor", 0x5AD },
+    { "Harmonic minor", 0x9AD },
+    { "Dorian", 0x6AD },
+    { "Mixolydian", 0x6B5 },
+    { "Major pentatonic", 0x295 },
+    { "Minor pentatonic", 0x4A9 },
+    { "Blues", 0x4E9 },
+}};
+
 /** This is the currently preferred way (2025) of setting up params  */
 static juce::AudioProcessorValueTreeState::ParameterLayout makeParameterLayout()
 {
@@ -172,6 +188,47 @@ static juce::AudioProcessorValueTreeState::ParameterLayout makeParameterLayout()
         ParameterID{ "midiOutChannel", kParamVersion }, "MIDI Out Channel",
         1, 16, 1));
 
+    // with more than one voice, voice n learns from midiInChannel + n (1 if that is All)
+    // and plays on midiOutChannel + n
+    params.emplace_back(std::make_unique<AudioParameterInt>(
+        ParameterID{ "voiceCount", kParamVersion }, "Voices",
+        1, MidiMarkovProcessor::maxVoices, 1));
+
+    params.emplace_back(std::make_unique<AudioParameterInt>(
+        ParameterID{ "modelMemoryMB", kParamVersion }, "Model Memory (MB)",
+        0, 4096, 0)); // 0 = unlimited, applies to each model
+
+    params.emplace_back(std::make_unique<AudioParameterInt>(
+        ParameterID{ "forgetHalfLife", kParamVersion }, "Forget Half-life (notes)",
+        0, 5000, 0)); // 0 = never forget
+
+    // compaction applied when saving. contexts of order 2+ seen fewer than
+    // saveMinCount times are left out, as is anything above saveMaxOrder
+    params.emplace_back(std::make_unique<AudioParameterInt>(
+        ParameterID{ "saveMinCount", kParamVersion }, "Save Min Count",
+        0, 16, 0)); // 0 or 1 = keep everything
+    params.emplace_back(std::make_unique<AudioParameterInt>(
+        ParameterID{ "saveMaxOrder", kParamVersion }, "Save Max Order",
+        0, 100, 0)); // 0 = no limit
+
+    // off: panic only releases the notes we know are sounding
+    params.emplace_back(std::make_unique<AudioParameterBool>(
+        ParameterID{ "fullPanic", kParamVersion }, "Full MIDI Panic", false));
+
+    // keeps the pitch models to the notes of a scale. see scaleChoices
+    StringArray scaleNames;
+    for (const auto& choice : scaleChoices)
+        scaleNames.add(choice.first);
+    params.emplace_back(std::make_unique<AudioParameterChoice>(
+        ParameterID{ "scale", kParamVersion }, "Scale", scaleNames, 0));
+    params.emplace_back(std::make_unique<AudioParameterChoice>(
+        ParameterID{ "scaleRoot", kParamVersion }, "Scale Root",
+        StringArray{ "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" }, 0));
+
+    // on: every matching order has a say in each event (PPM style), off: the longest match wins
+    params.emplace_back(std::make_unique<AudioParameterBool>(
+        ParameterID{ "blendOrders", kParamVersion }, "Blend Orders", false));
+
     return { params.begin(), params.end() };
 }
 
@@ -191,22 +248,20 @@ MidiMarkovProcessor::MidiMarkovProcessor()
 #endif
     // --- APVTS now initialised with a ParameterLayout + state name ---
     , apvts(*this, nullptr, "MidiMarkovState", makeParameterLayout())
-    , pitchModel{}
-    , polyphonyModel{}
-    , iOIModel{}
-    , velocityModel{}
-    , lastIncomingNoteOnTime{0}
-    , noMidiYet{true}
     , elapsedSamples{0}
-    , nextTimeToPlayANote{0}
-    , chordDetect{0}
     , midiMonitor{44100}
 {
-    // set all note on/off times to zero
-    for (int i = 0; i < 127; ++i)
+    // room for a busy block, so the voice jobs don't allocate
+    for (Voice& voice : voices)
     {
-        noteOffTimes[i] = 0;
-        noteOnTimes[i]  = 0;
+        voice.generated.reserve(256);
+        voice.learnedIois.reserve(64);
+        for (MarkovManager* mm : voice.models())
+        {
+            mm->setUndoDepth(modelUndoDepth);
+            // versions falling out of the history can be whole models, e.g. the one before a reset
+            mm->setRetiredVersionHandler([this](MarkovChain::SharedModel&& table) { modelReclaimer.retire(std::move(table)); });
+        }
     }
 
     playingParam         = apvts.getRawParameterValue("playing");
@@ -228,17 +283,34 @@ MidiMarkovProcessor::MidiMarkovProcessor()
     quantDivisionParam   = apvts.getRawParameterValue("quantDivision");
     midiInChannelParam   = apvts.getRawParameterValue("midiInChannel");
     midiOutChannelParam  = apvts.getRawParameterValue("midiOutChannel");
+    voiceCountParam      = apvts.getRawParameterValue("voiceCount");
+    modelMemoryMBParam   = apvts.getRawParameterValue("modelMemoryMB");
+    forgetHalfLifeParam  = apvts.getRawParameterValue("forgetHalfLife");
+    saveMinCountParam    = apvts.getRawParameterValue("saveMinCount");
+    saveMaxOrderParam    = apvts.getRawParameterValue("saveMaxOrder");
+    fullPanicParam       = apvts.getRawParameterValue("fullPanic");
+    scaleParam           = apvts.getRawParameterValue("scale");
+    scaleRootParam       = apvts.getRawParameterValue("scaleRoot");
+    blendOrdersParam     = apvts.getRawParameterValue("blendOrders");
     quantBpmParamObject  = dynamic_cast<juce::AudioParameterFloat*>(apvts.getParameter("quantBPM"));
+    for (auto* param : getParameters())
+        if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(param))
+            traceParameters.push_back({ranged, apvts.getRawParameterValue(ranged->paramID)});
     lastResetParamState.store(resetParam != nullptr ? (resetParam->load() > 0.5f) : false,
                               std::memory_order_release);
 
     // initialise avoid transposition display
     pushAvoidTranspositionForGUI(avoidStrategy.getTransposition());
+
+    const auto traceFile = juce::SystemStats::getEnvironmentVariable("MIDI_MARKOV_TRACE", {});
+    if (traceFile.isNotEmpty())
+        startTraceRecording(traceFile.toStdString());
 }
 
 
 MidiMarkovProcessor::~MidiMarkovProcessor()
 {
+    stopTraceRecording();
     if (modelIoThread.joinable())
         modelIoThread.join();
 }
@@ -306,14 +378,47 @@ void MidiMarkovProcessor::changeProgramName(int index, const juce::String &newNa
 }
 
 //==============================================================================
+MidiMarkovProcessor::BlockParams MidiMarkovProcessor::snapshotParameters() const
+{
+  auto isOn = [](const std::atomic<float>* p, bool fallback) { return p != nullptr ? (p->load(std::memory_order_relaxed) > 0.5f) : fallback; };
+  auto value = [](const std::atomic<float>* p, float fallback) { return p != nullptr ? p->load(std::memory_order_relaxed) : fallback; };
+
+  BlockParams params;
+  params.playing         = isOn(playingParam, false);
+  params.learning        = isOn(learningParam, true);
+  params.leadFollow      = isOn(leadFollowParam, true);
+  params.avoid           = isOn(avoidParam, false);
+  params.slowMo          = isOn(slowMoParam, false);
+  params.overpoly        = isOn(overpolyParam, false);
+  params.callResponse    = isOn(callResponseParam, false);
+  params.callRespGain    = value(callResponseGainParam, params.callRespGain);
+  params.callRespSilence = value(callResponseSilenceParam, params.callRespSilence);
+  params.callRespDrain   = value(callResponseDrainParam, params.callRespDrain);
+  params.playProbability = value(playProbabilityParam, 1.0f);
+  params.quantise        = isOn(quantiseParam, false);
+  params.useHostClock    = isOn(quantUseHostClockParam, false);
+  params.quantBpm        = static_cast<double>(value(quantBPMParam, 120.0f));
+  params.quantDivision   = static_cast<int>(value(quantDivisionParam, 1.0f));
+  params.modelMemoryMB   = static_cast<int>(value(modelMemoryMBParam, 0.0f));
+  params.forgetHalfLife  = static_cast<int>(value(forgetHalfLifeParam, 0.0f));
+  params.fullPanic       = isOn(fullPanicParam, false);
+  params.midiInChannel   = static_cast<int>(value(midiInChannelParam, 0.0f));
+  params.midiOutChannel  = static_cast<int>(value(midiOutChannelParam, 1.0f));
+  params.voiceCount      = static_cast<int>(value(voiceCountParam, 1.0f));
+  params.scale           = static_cast<int>(value(scaleParam, 0.0f));
+  params.scaleRoot       = static_cast<int>(value(scaleRootParam, 0.0f));
+  params.blendOrders     = isOn(blendOrdersParam, false);
+  return params;
+}
+
 void MidiMarkovProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
   double maxIntervalInSamples = sampleRate * 0.05; // 50ms - the threshold for deciding if its a chord or not
-  chordDetect = ChordDetector((unsigned long) maxIntervalInSamples); 
+  for (Voice& voice : voices)
+    voice.chordDetect = ChordDetector((unsigned long) maxIntervalInSamples); 
   midiMonitor.setSampleRate(getSampleRate());
   clockSamplesAccumulated = 0.0;
-  clockSamplesPerTick = calculateClockSamplesPerTick(sampleRate);
-  lastClockTickStamp.store(0, std::memory_order_relaxed);
+  clockSamplesPerTick = calculateClockSamplesPerTick(sampleRate, snapshotParameters());
   hostClockPositionInitialised = false;
   hostClockLastPpq = 0.0;
   hostAwaitingFirstTick = true;
@@ -323,6 +428,8 @@ void MidiMarkovProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
   hostLastKnownWasPlaying = false;
   lastProcessBlockSampleCount = 0;
   havePreviousBlockInfo = false;
+  generatedMidi.ensureSize(midiScratchBytes);
+  filteredMidi.ensureSize(midiScratchBytes);
 }
 
 void MidiMarkovProcessor::releaseResources()
@@ -358,16 +465,34 @@ bool MidiMarkovProcessor::isBusesLayoutSupported(const BusesLayout &layouts) con
 
 // called from external sources to store midi 
 // this is only currently called by the piano ui
-void MidiMarkovProcessor::uiAddsMidi(const juce::MidiMessage& msg, int sampleOffset)
+bool MidiMarkovProcessor::uiAddsMidi(const juce::MidiMessage& msg, int sampleOffset)
 {
-  // might not be thread safe whoops - should probaably lock
-  // midiToProcess before adding things to it 
-  midiReceivedFromUI.addEvent(msg, sampleOffset);  // keep your existing logic
-  // Notify UI via mailbox only — do NOT touch the editor from here.
-  pushMIDIInForGUI(msg);
+  // the GUI hears about it from the audio thread once it is merged into the input
+  return midiReceivedFromUI.push(msg, sampleOffset);
 }
 
-void MidiMarkovProcessor::sendMidiPanic(juce::MidiBuffer& out, int samplePos)
+void MidiMarkovProcessor::sendMidiPanic(juce::MidiBuffer& out, int samplePos, bool fullPanic)
+{
+    if (fullPanic)
+    {
+        sendFullMidiPanic(out, samplePos);
+        soundingNotes.clear();
+        return;
+    }
+
+    soundingNotes.forEachSounding([&](int ch, int note)
+    {
+        out.addEvent(juce::MidiMessage::noteOff(ch, note), samplePos);
+    });
+    for (int ch = 1; ch <= 16; ++ch)
+    {
+        out.addEvent(juce::MidiMessage::controllerEvent(ch, 120, 0), samplePos);  // All Sound Off
+        out.addEvent(juce::MidiMessage::controllerEvent(ch, 123, 0), samplePos);  // All Notes Off
+    }
+    soundingNotes.clear();
+}
+
+void MidiMarkovProcessor::sendFullMidiPanic(juce::MidiBuffer& out, int samplePos)
 {
     constexpr int pitchBendCenter = 0x2000; // 8192
 
@@ -436,6 +561,16 @@ void MidiMarkovProcessor::processBlockHide(juce::AudioBuffer<float> &buffer, juc
 
 void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::MidiBuffer &midiMessages)
 {
+  const bool offline = isNonRealtime();
+  // a bounce has time to wait for a model load rather than blanking blocks. this has to happen 
+  // before we count as an active block, as the io task waits for those to finish before starting
+  bool waitedForModelIo = false;
+  if (offline)
+      while (modelIoInProgress.load(std::memory_order_acquire))
+      {
+          waitedForModelIo = true;
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
 
   struct ScopedProcessCounter
   {
@@ -444,22 +579,40 @@ void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::M
       ~ScopedProcessCounter() { counter.fetch_sub(1, std::memory_order_acq_rel); }
   } processCounter(processBlockActiveCount);
 
+  if (offline != renderingOffline || waitedForModelIo)
+  {
+      // phrases generated ahead belong to the mode and the models that made them
+      for (Voice& voice : voices)
+          voice.clearPhrases();
+      renderingOffline = offline;
+  }
+  if (telemetryResendRequested.exchange(false, std::memory_order_acq_rel))
+      forgetTelemetrySent();
+
+  const bool tracing = traceRecording.load(std::memory_order_acquire);
+  if (tracing)
+      pb_traceBlockStart(buffer.getNumSamples());
+  const BlockParams params = snapshotParameters();
+
   if (modelIoInProgress.load(std::memory_order_acquire))
   {
       buffer.clear();
       midiMessages.clear();
-      pb_sendPendingAllNotesOff(midiMessages, sendAllNotesOffNext.load(std::memory_order_acquire));
+      pb_sendPendingAllNotesOff(midiMessages, sendAllNotesOffNext.load(std::memory_order_acquire), params);
+      pb_trackSoundingNotes(midiMessages);
+      if (tracing)
+          pb_traceOutgoing(midiMessages);
       havePreviousBlockInfo = false;
       return;
   }
 
   bool allOff = sendAllNotesOffNext.load(std::memory_order_acquire);
   const double sampleRate = getSampleRate();
-  const bool hostClockEnabled = (quantUseHostClockParam != nullptr) && (quantUseHostClockParam->load() > 0.5f);
+  const bool hostClockEnabled = params.useHostClock;
   HostClockInfo hostInfo = pb_collectHostClockInfo(hostClockEnabled);
   if (hostClockEnabled)
   {
-      if (double hostTick = calculateHostClockSamplesPerTick(hostInfo); hostTick > 0.0)
+      if (double hostTick = calculateHostClockSamplesPerTick(hostInfo, params); hostTick > 0.0)
           clockSamplesPerTick = hostTick;
   }
   const bool hostRestarted = hostClockEnabled
@@ -469,40 +622,52 @@ void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::M
   const bool hostTransportJumped = hostClockEnabled && hostInfo.transportPositionChanged;
   const bool hostAllowsPlayback = hostClockEnabled ? (hostInfo.transportKnown ? hostInfo.transportPlaying : false)
                                                    : true;
-  const bool playingParamEnabled = playingParam != nullptr ? (playingParam->load() > 0.5f) : false;
+  const bool playingParamEnabled = params.playing;
   const bool wasPlaying = lastPlayingParamState.load(std::memory_order_acquire);
   const bool shouldPlayNow = playingParamEnabled && hostAllowsPlayback;
   const bool playingReactivated = shouldPlayNow && !wasPlaying;
   bool resetParamActive = resetParam != nullptr ? (resetParam->load(std::memory_order_relaxed) > 0.5f) : false;
-  if (resetParamActive && !lastResetParamState.load(std::memory_order_acquire))
+  const bool resetParamTriggered = resetParamActive && !lastResetParamState.load(std::memory_order_acquire);
+  const bool resetFromGui = resetRequested.exchange(false, std::memory_order_acq_rel);
+  if (resetFromGui || resetParamTriggered)
   {
-      resetModel();
-      if (resetParam != nullptr)
-          resetParam->store(0.0f, std::memory_order_relaxed); // re-arm trigger
-      resetParamActive = false;
+      pb_resetModels();
+      if (resetParamTriggered)
+      {
+          if (resetParam != nullptr)
+              resetParam->store(0.0f, std::memory_order_relaxed); // re-arm trigger
+          resetParamActive = false;
+      }
   }
   lastResetParamState.store(resetParamActive, std::memory_order_release);
+  const bool undoFromGui = undoRequested.exchange(false, std::memory_order_acq_rel);
+  const bool redoFromGui = redoRequested.exchange(false, std::memory_order_acq_rel);
+  if (undoFromGui)
+      pb_stepModelHistory(true);
+  if (redoFromGui)
+      pb_stepModelHistory(false);
+  pb_assignVoices(params);
 
   if (hostClockEnabled)
   {
       bool alignedForHostRestart = false;
       if (hostRestarted && playingParamEnabled)
       {
-          alignModelPlayTimeToNextTick(true, hostInfo);
+          alignModelPlayTimeToNextTick(true, hostInfo, params);
           hostAwaitingFirstTick = true;
           alignedForHostRestart = true;
       }
 
       if (hostTransportJumped && hostInfo.transportPlaying && playingParamEnabled && !alignedForHostRestart)
       {
-          alignModelPlayTimeToNextTick(true, hostInfo);
+          alignModelPlayTimeToNextTick(true, hostInfo, params);
           hostAwaitingFirstTick = true;
           alignedForHostRestart = true;
       }
 
       if (playingReactivated && !alignedForHostRestart)
       {
-          alignModelPlayTimeToNextTick(true, hostInfo);
+          alignModelPlayTimeToNextTick(true, hostInfo, params);
           hostAwaitingFirstTick = true;
       }
   }
@@ -510,10 +675,10 @@ void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::M
   {
       hostAwaitingFirstTick = false;
       if (playingReactivated)
-          alignModelPlayTimeToNextTick(false, hostInfo);
+          alignModelPlayTimeToNextTick(false, hostInfo, params);
   }
 
-  const double manualBpm = quantBPMParam != nullptr ? static_cast<double>(quantBPMParam->load()) : 120.0;
+  const double manualBpm = params.quantBpm;
   double effectiveBpm = manualBpm;
   bool usingHostBpm = false;
   if (hostClockEnabled && hostInfo.hasBpm && hostInfo.bpm > 0.0)
@@ -525,16 +690,20 @@ void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::M
   effectiveBpmForDisplay.store(static_cast<float>(effectiveBpm), std::memory_order_relaxed);
   effectiveBpmIsHost.store(usingHostBpm, std::memory_order_relaxed);
 
-  pb_handleMidiFromUI(midiMessages);
+  pb_handleMidiFromUI(midiMessages, buffer.getNumSamples());
+  if (tracing)
+      pb_traceIncoming(midiMessages, resetFromGui, undoFromGui, redoFromGui, allOff);
 
   if (hostClockEnabled)
-      pb_tickHostClock(hostInfo.transportPlaying, hostInfo.hasPpq, hostInfo.ppqPosition);
+      pb_tickHostClock(hostInfo.transportPlaying, hostInfo.hasPpq, hostInfo.ppqPosition, params);
   else
-      pb_tickInternalClock(buffer);
+      pb_tickInternalClock(buffer, params);
 
-  pb_informGuiOfIncoming(midiMessages);
+  if (!renderingOffline)
+      pb_informGuiOfIncoming(midiMessages);
   pb_recordIncomingNotesForAvoid(midiMessages);
-  pb_learnFromIncomingMidi(midiMessages, effectiveBpm);
+  pb_applyModelLimits(params);
+  pb_learnFromIncomingMidi(midiMessages, effectiveBpm, params);
 
   const unsigned long elapsedSamplesAtStart = elapsedSamples;
   const unsigned long elapsedSamplesAtEnd = elapsedSamplesAtStart + static_cast<unsigned long>(buffer.getNumSamples());
@@ -542,10 +711,10 @@ void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::M
       ? static_cast<double>(elapsedSamplesAtEnd - elapsedSamplesAtStart) / sampleRate
       : 0.0;
   // DBG("from s to e " << elapsedSamplesAtStart << " : " << elapsedSamplesAtEnd << " diff " << (elapsedSamplesAtEnd - elapsedSamplesAtStart));
-  const bool callResponseEnabled = (callResponseParam != nullptr) && (callResponseParam->load() > 0.5f);
-  if (callResponseGainParam)    callResponseEngine.setGainFactor(callResponseGainParam->load());
-  if (callResponseSilenceParam) callResponseEngine.setSilenceSeconds(callResponseSilenceParam->load());
-  if (callResponseDrainParam)   callResponseEngine.setPassiveDrainPerSecond(callResponseDrainParam->load());
+  const bool callResponseEnabled = params.callResponse;
+  callResponseEngine.setGainFactor(params.callRespGain);
+  callResponseEngine.setSilenceSeconds(params.callRespSilence);
+  callResponseEngine.setPassiveDrainPerSecond(params.callRespDrain);
   callResponseEngine.setEnabled(callResponseEnabled);
   callResponseEngine.startBlock(elapsedSamplesAtStart, elapsedSamplesAtEnd, sampleRate);
   pb_trackCallResponseInput(midiMessages, elapsedSamplesAtStart);
@@ -554,17 +723,15 @@ void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::M
       pb_randomiseBehaviourTogglesForResponse();
   pushCallResponsePhaseForGUI(callResponseEnabled, callResponseEngine.isInResponse());
 
-  juce::MidiBuffer generatedMessages;
-  if (!hostAwaitingFirstTick)
-  {
-      if (callResponseEnabled && !callResponseEngine.isInResponse())
-          generatedMessages.clear();
-      else
-          generatedMessages = generateNotesFromModel(midiMessages, elapsedSamplesAtStart, elapsedSamplesAtEnd, hostInfo);
-  }
+  // reused every block so steady state playback does not allocate
+  juce::MidiBuffer& generatedMessages = generatedMidi;
+  generatedMessages.clear();
+  if (!hostAwaitingFirstTick && !(callResponseEnabled && !callResponseEngine.isInResponse()))
+      generateNotesFromModel(generatedMessages, midiMessages, elapsedSamplesAtStart, elapsedSamplesAtEnd, hostInfo, params);
 
   pb_schedulePendingNoteOffs(generatedMessages, elapsedSamplesAtStart, elapsedSamplesAtEnd);
-  pb_informGuiOfOutgoing(generatedMessages);
+  if (!renderingOffline)
+      pb_informGuiOfOutgoing(generatedMessages);
   int generatedNoteOns = 0;
   double generatedVelSum = 0.0;
   for (const auto meta : generatedMessages)
@@ -578,20 +745,27 @@ void MidiMarkovProcessor::processBlock(juce::AudioBuffer<float> &buffer, juce::M
   }
   callResponseEngine.applyDrainForGenerated(blockDurationSeconds, generatedNoteOns, generatedVelSum);
   pushCallResponseEnergyForGUI(callResponseEngine.getEnergy01());
-  pushModelStatusForGUI(static_cast<int>(pitchModel.getModelSize()), pitchModel.getLastOrderOfMatch(),
-                        static_cast<int>(iOIModel.getModelSize()), iOIModel.getLastOrderOfMatch(),
-                        static_cast<int>(noteDurationModel.getModelSize()), noteDurationModel.getLastOrderOfMatch());
-
-  midiMessages.clear();
-  midiMessages.addEvents(generatedMessages, generatedMessages.getFirstEventTime(), -1, 0);
-
-  pb_applyPlayProbability(midiMessages);
+  // lock free reads, so the GUI status costs nothing on the audio thread
+  const auto pitchStatus = voices[0].pitchModel.getStatus();
+  const auto ioiStatus = voices[0].iOIModel.getStatus();
+  const auto durStatus = voices[0].noteDurationModel.getStatus();
+  pushModelStatusForGUI(static_cast<int>(pitchStatus.modelSize), pitchStatus.lastOrder,
+                        static_cast<int>(ioiStatus.modelSize), ioiStatus.lastOrder,
+                        static_cast<int>(durStatus.modelSize), durStatus.lastOrder);
+
+  // the incoming messages are finished with, so hand the host our buffer instead of copying
+  midiMessages.swapWith(generatedMessages);
+
+  pb_applyPlayProbability(midiMessages, params);
   pb_logMidiEvents(midiMessages);
 
-  allOff = pb_handlePlayingState(midiMessages, hostAllowsPlayback, allOff);
+  allOff = pb_handlePlayingState(midiMessages, hostAllowsPlayback, allOff, params);
 
   pb_handleStuckNotes(midiMessages, elapsedSamplesAtEnd);
-  pb_sendPendingAllNotesOff(midiMessages, allOff);
+  pb_sendPendingAllNotesOff(midiMessages, allOff, params);
+  pb_trackSoundingNotes(midiMessages);
+  if (tracing)
+      pb_traceOutgoing(midiMessages);
 
   elapsedSamples = elapsedSamplesAtEnd;
   lastHostTransportPlaying = hostClockEnabled && hostInfo.transportKnown ? hostInfo.transportPlaying : false;
@@ -607,6 +781,8 @@ bool MidiMarkovProcessor::hasEditor() const
 
 juce::AudioProcessorEditor *MidiMarkovProcessor::createEditor()
 {
+  // a new editor starts with nothing, so send it the current status again
+  telemetryResendRequested.store(true, std::memory_order_release);
   return new MidiMarkovEditor(*this);
     // return new GenericAudioProcessorEditor(*this);
 }
@@ -650,154 +826,116 @@ juce::AudioProcessor *JUCE_CALLTYPE createPluginFilter()
   return new MidiMarkovProcessor();
 }
 
-// Publish note/velocity to the UI mailbox (RT-safe, no locks/allocs).
+// Publish to the telemetry stream (RT-safe, no locks/allocs).
 void MidiMarkovProcessor::pushMIDIInForGUI(const juce::MidiMessage& msg)
 {
     if (!msg.isNoteOnOrOff())
         return;
 
-    const int   note = msg.getNoteNumber();
-    const float vel  = msg.isNoteOn() ? juce::jlimit(0.0f, 1.0f, msg.getFloatVelocity())
-                                      : 0.0f;
-
-    lastNoteIn.store(note, std::memory_order_relaxed);
-    lastVelocityIn.store(vel,   std::memory_order_relaxed);
-    lastNoteInStamp.fetch_add(1, std::memory_order_release);
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::midiIn;
+    event.channel = static_cast<uint8_t>(msg.getChannel());
+    event.note = static_cast<uint8_t>(msg.getNoteNumber());
+    event.velocity = msg.isNoteOn() ? msg.getVelocity() : 0;
+    pushTelemetry(event);
 }
 
 void MidiMarkovProcessor::pushAvoidTranspositionForGUI(int semitones)
 {
-  DBG("Storing an avoid " << semitones);
-    lastAvoidTranspose.store(semitones, std::memory_order_relaxed);
-    lastAvoidTransposeStamp.fetch_add(1, std::memory_order_release);
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::avoidTransposition;
+    event.value1 = semitones;
+    pushTelemetry(event);
 }
 
 void MidiMarkovProcessor::pushSlomoScalarForGUI(float scalar)
 {
-    lastSlomoScalar.store(scalar, std::memory_order_relaxed);
-    lastSlomoScalarStamp.fetch_add(1, std::memory_order_release);
+    if (scalar == telemetrySlomoScalar)
+        return;
+
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::slomoScalar;
+    event.scalar = scalar;
+    if (pushTelemetry(event))
+        telemetrySlomoScalar = scalar;
 }
 
 void MidiMarkovProcessor::pushCallResponseEnergyForGUI(float energy01)
 {
     const float clamped = juce::jlimit(0.0f, 1.0f, energy01);
-    callResponseEnergyForGui.store(clamped, std::memory_order_relaxed);
-    callResponseEnergyStamp.fetch_add(1, std::memory_order_release);
-}
-
-void MidiMarkovProcessor::pushCallResponsePhaseForGUI(bool enabled, bool inResponse)
-{
-    callResponsePhaseEnabled.store(enabled, std::memory_order_relaxed);
-    callResponsePhaseInResponse.store(inResponse, std::memory_order_relaxed);
-    callResponsePhaseStamp.fetch_add(1, std::memory_order_release);
-}
-
-// Pull latest event if stamp changed since lastSeenStamp (message thread).
-bool MidiMarkovProcessor::pullMIDIInForGUI(int& note, float& vel, uint32_t& lastSeenStamp)
-{
-    const auto s = lastNoteInStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp) return false; // don't send same note twice
-
-    lastSeenStamp = s;
-    note = lastNoteIn.load(std::memory_order_relaxed);
-    if (note == -1) return false; // starting condition is that the note is -1
-
-    vel  = lastVelocityIn.load(std::memory_order_relaxed);
-    return true;
-}
-
-bool MidiMarkovProcessor::pullAvoidTranspositionForGUI(int& semitones, uint32_t& lastSeenStamp)
-{
-    const auto s = lastAvoidTransposeStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp)
-        return false;
+    if (clamped == telemetryCallResponseEnergy)
+        return;
 
-    lastSeenStamp = s;
-    semitones = lastAvoidTranspose.load(std::memory_order_relaxed);
-    return true;
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::callResponseEnergy;
+    event.scalar = clamped;
+    if (pushTelemetry(event))
+        telemetryCallResponseEnergy = clamped;
 }
 
-bool MidiMarkovProcessor::pullSlomoScalarForGUI(float& scalar, uint32_t& lastSeenStamp)
+void MidiMarkovProcessor::pushCallResponsePhaseForGUI(bool enabled, bool inResponse)
 {
-    const auto s = lastSlomoScalarStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp)
-        return false;
+    const int phase = (enabled ? 1 : 0) | (inResponse ? 2 : 0);
+    if (phase == telemetryCallResponsePhase)
+        return;
 
-    lastSeenStamp = s;
-    scalar = lastSlomoScalar.load(std::memory_order_relaxed);
-    return true;
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::callResponsePhase;
+    event.value1 = enabled ? 1 : 0;
+    event.value2 = inResponse ? 1 : 0;
+    if (pushTelemetry(event))
+        telemetryCallResponsePhase = phase;
 }
 
 void MidiMarkovProcessor::pushOverpolyExtraForGUI(int extraCount)
 {
-    overpolyExtraCount.store(extraCount, std::memory_order_relaxed);
-    overpolyExtraStamp.fetch_add(1, std::memory_order_release);
-}
-
-bool MidiMarkovProcessor::pullOverpolyExtraForGUI(int& extraCount, uint32_t& lastSeenStamp)
-{
-    const auto s = overpolyExtraStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp)
-        return false;
-
-    lastSeenStamp = s;
-    extraCount = overpolyExtraCount.load(std::memory_order_relaxed);
-    return true;
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::overpolyExtra;
+    event.value1 = extraCount;
+    pushTelemetry(event);
 }
 
-bool MidiMarkovProcessor::pullCallResponseEnergyForGUI(float& energy01, uint32_t& lastSeenStamp)
+void MidiMarkovProcessor::pushModelStatusForGUI(int pitchSize, int pitchOrder,
+                                                int ioiSize, int ioiOrder,
+                                                int durSize, int durOrder)
 {
-    const auto s = callResponseEnergyStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp)
-        return false;
-
-    lastSeenStamp = s;
-    energy01 = callResponseEnergyForGui.load(std::memory_order_relaxed);
-    return true;
+    const int status[6] = { pitchSize, pitchOrder, ioiSize, ioiOrder, durSize, durOrder };
+    for (int model = 0; model < 3; ++model)
+    {
+        int* last = &telemetryModelStatus[model * 2];
+        if (last[0] == status[model * 2] && last[1] == status[model * 2 + 1])
+            continue;
+
+        TelemetryEvent event {};
+        event.type = TelemetryEvent::Type::modelStatus;
+        event.note = static_cast<uint8_t>(model);
+        event.value1 = status[model * 2];
+        event.value2 = status[model * 2 + 1];
+        if (!pushTelemetry(event))
+            continue;
+        last[0] = event.value1;
+        last[1] = event.value2;
+    }
 }
 
-bool MidiMarkovProcessor::pullCallResponsePhaseForGUI(bool& enabled, bool& inResponse, uint32_t& lastSeenStamp)
+bool MidiMarkovProcessor::pushTelemetry(const TelemetryEvent& event)
 {
-    const auto s = callResponsePhaseStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp)
+    if (renderingOffline)
         return false;
-
-    lastSeenStamp = s;
-    enabled = callResponsePhaseEnabled.load(std::memory_order_relaxed);
-    inResponse = callResponsePhaseInResponse.load(std::memory_order_relaxed);
-    return true;
+    return telemetry.push(event);
 }
 
-void MidiMarkovProcessor::pushModelStatusForGUI(int pitchSize, int pitchOrder,
-                                                int ioiSize, int ioiOrder,
-                                                int durSize, int durOrder)
+void MidiMarkovProcessor::forgetTelemetrySent()
 {
-    modelSizePitch.store(pitchSize, std::memory_order_relaxed);
-    modelOrderPitch.store(pitchOrder, std::memory_order_relaxed);
-    modelSizeIoI.store(ioiSize, std::memory_order_relaxed);
-    modelOrderIoI.store(ioiOrder, std::memory_order_relaxed);
-    modelSizeDur.store(durSize, std::memory_order_relaxed);
-    modelOrderDur.store(durOrder, std::memory_order_relaxed);
-    modelStatusStamp.fetch_add(1, std::memory_order_release);
+    telemetrySlomoScalar = -1.0f;
+    telemetryCallResponseEnergy = -1.0f;
+    telemetryCallResponsePhase = -1;
+    std::fill(std::begin(telemetryModelStatus), std::end(telemetryModelStatus), -1);
 }
 
-bool MidiMarkovProcessor::pullModelStatusForGUI(int& pitchSize, int& pitchOrder,
-                                                int& ioiSize, int& ioiOrder,
-                                                int& durSize, int& durOrder,
-                                                uint32_t& lastSeenStamp)
+size_t MidiMarkovProcessor::pullTelemetryForGUI(TelemetryEvent* dest, size_t maxEvents)
 {
-    const auto s = modelStatusStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp)
-        return false;
-
-    lastSeenStamp = s;
-    pitchSize = modelSizePitch.load(std::memory_order_relaxed);
-    pitchOrder = modelOrderPitch.load(std::memory_order_relaxed);
-    ioiSize = modelSizeIoI.load(std::memory_order_relaxed);
-    ioiOrder = modelOrderIoI.load(std::memory_order_relaxed);
-    durSize = modelSizeDur.load(std::memory_order_relaxed);
-    durOrder = modelOrderDur.load(std::memory_order_relaxed);
-    return true;
+    return telemetry.pop(dest, maxEvents);
 }
 
 void MidiMarkovProcessor::pushModelIoStatusForGUI(ModelIoState state, const std::string& stage)
@@ -835,43 +973,19 @@ void MidiMarkovProcessor::pushMIDIOutForGUI(const juce::MidiMessage& msg)
     if (!msg.isNoteOnOrOff())
         return;
 
-    const int   note = msg.getNoteNumber();
-    const float vel  = msg.isNoteOn() ? juce::jlimit(0.0f, 1.0f, msg.getFloatVelocity())
-                                      : 0.0f;
-
-    lastNoteOut.store(note, std::memory_order_relaxed);
-    lastVelocityOut.store(vel,   std::memory_order_relaxed);
-    lastNoteOutStamp.fetch_add(1, std::memory_order_release);
-
-}
-
-// Pull latest event if stamp changed since lastSeenStamp (message thread).
-bool MidiMarkovProcessor::pullMIDIOutForGUI(int& note, float& vel, uint32_t& lastSeenStamp)
-{
-    const auto s = lastNoteOutStamp.load(std::memory_order_acquire);
-
-    if (s == lastSeenStamp) return false; // don't send back same note twice
-
-    lastSeenStamp = s;
-    note = lastNoteOut.load(std::memory_order_relaxed);
-    if (note == -1) return false; // starting condition is that the note is -1
-    vel  = lastVelocityOut.load(std::memory_order_relaxed);
-    return true;
-}
-
-bool MidiMarkovProcessor::pullClockTickForGUI(uint32_t& lastSeenStamp)
-{
-    const auto s = lastClockTickStamp.load(std::memory_order_acquire);
-    if (s == lastSeenStamp)
-        return false;
-
-    lastSeenStamp = s;
-    return true;
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::midiOut;
+    event.channel = static_cast<uint8_t>(msg.getChannel());
+    event.note = static_cast<uint8_t>(msg.getNoteNumber());
+    event.velocity = msg.isNoteOn() ? msg.getVelocity() : 0;
+    pushTelemetry(event);
 }
 
 void MidiMarkovProcessor::pushClockTickForGUI()
 {
-    lastClockTickStamp.fetch_add(1, std::memory_order_release);
+    TelemetryEvent event {};
+    event.type = TelemetryEvent::Type::clockTick;
+    pushTelemetry(event);
 }
 
 void MidiMarkovProcessor::requestBpmAdjust(int step)
@@ -895,18 +1009,14 @@ void MidiMarkovProcessor::requestBpmAdjust(int step)
     param->endChangeGesture();
 }
 
-double MidiMarkovProcessor::calculateClockSamplesPerTick(double sampleRate) const
+double MidiMarkovProcessor::calculateClockSamplesPerTick(double sampleRate, const BlockParams& params) const
 {
     if (sampleRate <= 0.0)
         return 0.0;
 
-    const double bpmParam = quantBPMParam != nullptr ? static_cast<double>(quantBPMParam->load())
-                                                     : 120.0;
-    const double bpm = juce::jlimit(20.0, 300.0, bpmParam);
+    const double bpm = juce::jlimit(20.0, 300.0, params.quantBpm);
 
-    const double divisionParam = quantDivisionParam != nullptr ? static_cast<double>(quantDivisionParam->load())
-                                                               : 1.0;
-    const double divisionValue = static_cast<double>(ImproviserControlGUI::divisionIdToValue(static_cast<int>(divisionParam)));
+    const double divisionValue = static_cast<double>(ImproviserControlGUI::divisionIdToValue(params.quantDivision));
     const double safeDivision = juce::jmax(0.001, divisionValue);
 
     const double secondsPerBeat = 60.0 / bpm;
@@ -915,7 +1025,7 @@ double MidiMarkovProcessor::calculateClockSamplesPerTick(double sampleRate) cons
     return juce::jmax(1.0, samplesPerDivision);
 }
 
-double MidiMarkovProcessor::calculateHostClockSamplesPerTick(const HostClockInfo& info) const
+double MidiMarkovProcessor::calculateHostClockSamplesPerTick(const HostClockInfo& info, const BlockParams& params) const
 {
     if (!info.hostClockEnabled || !info.hasBpm)
         return 0.0;
@@ -924,9 +1034,7 @@ double MidiMarkovProcessor::calculateHostClockSamplesPerTick(const HostClockInfo
     if (sampleRate <= 0.0)
         return 0.0;
 
-    const double divisionParam = quantDivisionParam != nullptr ? static_cast<double>(quantDivisionParam->load())
-                                                               : 1.0;
-    const double divisionValue = static_cast<double>(ImproviserControlGUI::divisionIdToValue(static_cast<int>(divisionParam)));
+    const double divisionValue = static_cast<double>(ImproviserControlGUI::divisionIdToValue(params.quantDivision));
     const double safeDivision = juce::jmax(0.001, divisionValue);
 
     const double safeBpm = juce::jmax(1.0, info.bpm);
@@ -936,7 +1044,7 @@ double MidiMarkovProcessor::calculateHostClockSamplesPerTick(const HostClockInfo
     return juce::jmax(1.0, samplesPerDivision);
 }
 
-std::optional<unsigned long> MidiMarkovProcessor::computeNextInternalTickSample() const
+std::optional<unsigned long> MidiMarkovProcessor::computeNextInternalTickSample(const BlockParams& params) const
 {
     const double sampleRate = getSampleRate();
     if (sampleRate <= 0.0)
@@ -944,7 +1052,7 @@ std::optional<unsigned long> MidiMarkovProcessor::computeNextInternalTickSample(
 
     double interval = clockSamplesPerTick;
     if (interval <= 0.0)
-        interval = calculateClockSamplesPerTick(sampleRate);
+        interval = calculateClockSamplesPerTick(sampleRate, params);
 
     if (interval <= 0.0 || !std::isfinite(interval))
         return std::nullopt;
@@ -963,7 +1071,7 @@ std::optional<unsigned long> MidiMarkovProcessor::computeNextInternalTickSample(
     return elapsedSamples + deltaSamples;
 }
 
-std::optional<unsigned long> MidiMarkovProcessor::computeNextHostTickSample(const HostClockInfo& info) const
+std::optional<unsigned long> MidiMarkovProcessor::computeNextHostTickSample(const HostClockInfo& info, const BlockParams& params) const
 {
     if (!info.hostClockEnabled || !info.hasPpq || !info.hasBpm)
         return std::nullopt;
@@ -972,10 +1080,8 @@ std::optional<unsigned long> MidiMarkovProcessor::computeNextHostTickSample(cons
     if (sampleRate <= 0.0)
         return std::nullopt;
 
-    const double divisionParam = quantDivisionParam != nullptr ? static_cast<double>(quantDivisionParam->load())
-                                                               : 1.0;
     const double ppqPerTick = juce::jmax(1.0e-5,
-        static_cast<double>(ImproviserControlGUI::divisionIdToValue(static_cast<int>(divisionParam))));
+        static_cast<double>(ImproviserControlGUI::divisionIdToValue(params.quantDivision)));
 
     if (ppqPerTick <= 0.0 || !std::isfinite(ppqPerTick))
         return std::nullopt;
@@ -1000,16 +1106,14 @@ std::optional<unsigned long> MidiMarkovProcessor::computeNextHostTickSample(cons
     return elapsedSamples + deltaSamples;
 }
 
-void MidiMarkovProcessor::alignModelPlayTimeToNextTick(bool hostClockEnabled, const HostClockInfo& info)
+void MidiMarkovProcessor::alignModelPlayTimeToNextTick(bool hostClockEnabled, const HostClockInfo& info, const BlockParams& params)
 {
     std::optional<unsigned long> nextTick = hostClockEnabled
-        ? computeNextHostTickSample(info)
-        : computeNextInternalTickSample();
+        ? computeNextHostTickSample(info, params)
+        : computeNextInternalTickSample(params);
 
-    if (nextTick.has_value())
-        nextTimeToPlayANote = *nextTick;
-    else
-        nextTimeToPlayANote = elapsedSamples;
+    for (Voice& voice : voices)
+        voice.nextTimeToPlayANote = nextTick.has_value() ? *nextTick : elapsedSamples;
 }
 
 
@@ -1030,19 +1134,29 @@ void MidiMarkovProcessor::sendAllNotesOff()
 
 
     
-void MidiMarkovProcessor::analysePitches(const juce::MidiBuffer& midiMessages, bool learningEnabled)
+void MidiMarkovProcessor::learnFromMidi(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, 
+                                        double sampleRate, int quantBlockSizeSamples, bool learningEnabled)
+{
+  analysePitches(voice, midiMessages, bufferStartTime, learningEnabled);
+  analyseDuration(voice, midiMessages, bufferStartTime, quantBlockSizeSamples, learningEnabled);
+  analyseIoI(voice, midiMessages, bufferStartTime, sampleRate, quantBlockSizeSamples, learningEnabled);
+  analyseVelocity(voice, midiMessages, learningEnabled);
+}
+void MidiMarkovProcessor::analysePitches(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, bool learningEnabled)
 {
   for (const auto metadata : midiMessages)
   {
     auto message = metadata.getMessage();
+    if (!voice.listensTo(message.getChannel()))
+      continue;
     if (message.isNoteOn()){
-      chordDetect.addNote(
+      voice.chordDetect.addNote(
             message.getNoteNumber(), 
             // add the offset within this buffer
-            elapsedSamples + message.getTimeStamp()
+            bufferStartTime + message.getTimeStamp()
         );
-      if (chordDetect.hasChord()){
-          std::vector<int> notesVec = chordDetect.getChord();
+      if (voice.chordDetect.hasChord()){
+          std::vector<int> notesVec = voice.chordDetect.getChord();
 
           std::string notes = 
               MidiMarkovProcessor::notesToMarkovState(notesVec);
@@ -1051,16 +1165,16 @@ void MidiMarkovProcessor::analysePitches(const juce::MidiBuffer& midiMessages, b
 
           if (learningEnabled)
           {
-              pitchModel.putEvent(notes);
-              polyphonyModel.putEvent(std::to_string(notesVec.size()));
+              voice.pitchModel.putEvent(notes);
+              voice.polyphonyModel.putEvent(std::to_string(notesVec.size()));
           }
           else
           {
-              pitchModel.observeContextOnly(notes);
-              polyphonyModel.observeContextOnly(std::to_string(notesVec.size()));
+              voice.pitchModel.observeContextOnly(notes);
+              voice.polyphonyModel.observeContextOnly(std::to_string(notesVec.size()));
           }
       }     
-      noMidiYet = false;// bootstrap code
+      voice.noMidiYet = false;// bootstrap code
     }
   }
 }
@@ -1081,18 +1195,20 @@ int MidiMarkovProcessor::quantiseInterval(int interval, int quantBlock)
     // exactly halfway → round to even
     return ((q % 2 == 0) ? q : ((interval >= 0) ? q + 1 : q - 1)) * quantBlock;
 }
-void MidiMarkovProcessor::analyseIoI(const juce::MidiBuffer& midiMessages, int quantBlockSizeSamples, bool learningEnabled)
+void MidiMarkovProcessor::analyseIoI(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, double sampleRate, int quantBlockSizeSamples, bool learningEnabled)
 {
   // compute the IOI 
   // are we quantising? 
 //   const bool quantiseEnabled = (quantiseParam != nullptr) && (quantiseParam->load() > 0.0f);
   for (const auto metadata : midiMessages){
       auto message = metadata.getMessage();
+      if (!voice.listensTo(message.getChannel()))
+          continue;
       if (message.isNoteOn()){   
-          unsigned long exactNoteOnTime = elapsedSamples + message.getTimeStamp();
-          int iOI = static_cast<int>(exactNoteOnTime - lastIncomingNoteOnTime);
-          if (iOI < getSampleRate() * 2 && 
-              iOI > getSampleRate() * 0.05){
+          unsigned long exactNoteOnTime = bufferStartTime + message.getTimeStamp();
+          int iOI = static_cast<int>(exactNoteOnTime - voice.lastIncomingNoteOnTime);
+          if (iOI < sampleRate * 2 && 
+              iOI > sampleRate * 0.05){
             // if (quantiseEnabled && quantBlockSizeSamples != 0){// quantise it
             if (quantBlockSizeSamples != 0){// quantise it
                 // DBG("analyseIOI quantising an IOI block : " << quantBlockSizeSamples);
@@ -1101,36 +1217,37 @@ void MidiMarkovProcessor::analyseIoI(const juce::MidiBuffer& midiMessages, int q
             }
 
             if (iOI > 0){// ignore zero iois
-              if (const double sr = getSampleRate(); sr > 0.0)
-                  slomoStrategy.addIoiSamples(iOI, sr);
+              voice.learnedIois.push_back(iOI);
             //   DBG("analyseIOI  storing IOI " << iOI);
 
               if (learningEnabled)
-                  iOIModel.putEvent(std::to_string(iOI));
+                  voice.iOIModel.putEvent(std::to_string(iOI));
               else
-                  iOIModel.observeContextOnly(std::to_string(iOI));
+                  voice.iOIModel.observeContextOnly(std::to_string(iOI));
             }   
 
           }
-          lastIncomingNoteOnTime = exactNoteOnTime; 
+          voice.lastIncomingNoteOnTime = exactNoteOnTime; 
       }
   }
 }
 
-void MidiMarkovProcessor::analyseDuration(const juce::MidiBuffer& midiMessages, int quantBlockSizeSamples, bool learningEnabled)
+void MidiMarkovProcessor::analyseDuration(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, int quantBlockSizeSamples, bool learningEnabled)
 {
 
   for (const auto metadata : midiMessages)
   {
     auto message = metadata.getMessage();
+    if (!voice.listensTo(message.getChannel()))
+      continue;
     if (message.isNoteOn())
     {
-      noteOnTimes[message.getNoteNumber()] = elapsedSamples + message.getTimeStamp();
+      voice.noteOnTimes[message.getNoteNumber()] = bufferStartTime + message.getTimeStamp();
     }
     if (message.isNoteOff()){
-      unsigned long noteOffTime = elapsedSamples + message.getTimeStamp();
+      unsigned long noteOffTime = bufferStartTime + message.getTimeStamp();
       int noteLength = static_cast<int> (noteOffTime - 
-                                  noteOnTimes[message.getNoteNumber()]);
+                                  voice.noteOnTimes[message.getNoteNumber()]);
       if (quantBlockSizeSamples != 0){// quantise it
         // DBG("analyseDuration quant block " << quantBlockSizeSamples << " from " << noteLength << " to " << MidiMarkovProcessor::quantiseInterval(noteLength, quantBlockSizeSamples));
         noteLength = MidiMarkovProcessor::quantiseInterval(noteLength, quantBlockSizeSamples);
@@ -1139,45 +1256,47 @@ void MidiMarkovProcessor::analyseDuration(const juce::MidiBuffer& midiMessages,
     //   DBG("analyseDuration storing duration " << noteLength);
 
       if (learningEnabled)
-          noteDurationModel.putEvent(std::to_string(noteLength));
+          voice.noteDurationModel.putEvent(std::to_string(noteLength));
       else
-          noteDurationModel.observeContextOnly(std::to_string(noteLength));
+          voice.noteDurationModel.observeContextOnly(std::to_string(noteLength));
     }
   }
 }
 
 
-void MidiMarkovProcessor::analyseVelocity(const juce::MidiBuffer& midiMessages, bool learningEnabled)
+void MidiMarkovProcessor::analyseVelocity(Voice& voice, const juce::MidiBuffer& midiMessages, bool learningEnabled)
 {
   // compute the IOI 
   for (const auto metadata : midiMessages){
       auto message = metadata.getMessage();
+      if (!voice.listensTo(message.getChannel()))
+          continue;
       if (message.isNoteOn()){   
           auto velocity = message.getVelocity();
           // DBG("Vel " << velocity);
           if (learningEnabled)
-              velocityModel.putEvent(std::to_string(velocity));
+              voice.velocityModel.putEvent(std::to_string(velocity));
           else
-              velocityModel.observeContextOnly(std::to_string(velocity));
+              voice.velocityModel.observeContextOnly(std::to_string(velocity));
       }
   }
 }
 
-void MidiMarkovProcessor::syncNextTimeToClock(const HostClockInfo& info)
+void MidiMarkovProcessor::syncNextTimeToClock(unsigned long& nextTime, const HostClockInfo& info, const BlockParams& params) const
 {
     const double tickLength = clockSamplesPerTick;
     if (tickLength <= 0.0 || !std::isfinite(tickLength))
         return;
 
     const auto nextTickSample = info.hostClockEnabled
-        ? computeNextHostTickSample(info)
-        : computeNextInternalTickSample();
+        ? computeNextHostTickSample(info, params)
+        : computeNextInternalTickSample(params);
 
     if (!nextTickSample.has_value())
         return;
 
     const double target = static_cast<double>(*nextTickSample);
-    const double diff = static_cast<double>(nextTimeToPlayANote) - target;
+    const double diff = static_cast<double>(nextTime) - target;
     double remainder = std::fmod(diff, tickLength);
     if (!std::isfinite(remainder))
         return;
@@ -1192,29 +1311,55 @@ void MidiMarkovProcessor::syncNextTimeToClock(const HostClockInfo& info)
     const double adjustment = tickLength - remainder;
     const auto adjustmentSamples = static_cast<long long>(std::llround(adjustment));
     if (adjustmentSamples > 0)
-        nextTimeToPlayANote += static_cast<unsigned long>(adjustmentSamples);
+        nextTime += static_cast<unsigned long>(adjustmentSamples);
 }
 
-juce::MidiBuffer MidiMarkovProcessor::generateNotesFromModel(const juce::MidiBuffer& incomingNotes, unsigned long bufferStartTime, unsigned long bufferEndTime, const HostClockInfo& hostInfo)
+void MidiMarkovProcessor::generateNotesFromModel(juce::MidiBuffer& generatedMessages, const juce::MidiBuffer& incomingNotes, unsigned long bufferStartTime, unsigned long bufferEndTime, const HostClockInfo& hostInfo, const BlockParams& params)
 {
-  juce::MidiBuffer generatedMessages{};
-  if (pitchModel.getModelSize() < 2){// only play once we've got something!
-    return generatedMessages;
+  generatedMessages.clear();
+
+  const double slomoMultiplier = params.slowMo ? slomoStrategy.getComplementaryMultiplier() : 1.0;
+  pushSlomoScalarForGUI(static_cast<float>(slomoMultiplier));
+
+  const size_t voiceCount = static_cast<size_t>(activeVoiceCount);
+  voicePool.run(voiceCount, [&](size_t v)
+  {
+      generateVoiceNotes(voices[v], bufferStartTime, bufferEndTime, hostInfo, params, slomoMultiplier);
+  });
+
+  // the note scheduler is shared, so the voices' notes are scheduled back here on the audio thread
+  for (size_t v = 0; v < voiceCount; ++v)
+  {
+      Voice& voice = voices[v];
+      for (const GeneratedNote& note : voice.generated)
+      {
+          juce::MidiMessage nOn = juce::MidiMessage::noteOn(voice.outputChannel, note.note, note.velocity);
+          // ptocess Block deals with note offs - we just schedule em here 
+          addScheduledNote(generatedMessages, nOn, note.samplePos, note.noteOffTime);
+      }
+      voice.generated.clear();
+      if (voice.overpolyExtra >= 0)
+          pushOverpolyExtraForGUI(voice.overpolyExtra);
   }
+}
 
-  unsigned long nextIoI = 0;
+void MidiMarkovProcessor::generateVoiceNotes(Voice& voice, unsigned long bufferStartTime, unsigned long bufferEndTime, const HostClockInfo& hostInfo, const BlockParams& params, double slomoMultiplier)
+{
+  voice.generated.clear();
+  voice.overpolyExtra = -1;
+  if (voice.pitchModel.getStatus().modelSize < 2){// only play once we've got something!
+    return;
+  }
 
   // if this is true, we will 
   // generate using the recent input from the user 
   // as the state instead of the model's own auto-regressed state
-  bool userMIDIIsGenContextMode = (leadFollowParam->load() == 0.0f);
+  bool userMIDIIsGenContextMode = !params.leadFollow;
 
-  const bool slowMoEnabled = (slowMoParam != nullptr) && (slowMoParam->load() > 0.5f);
-  const bool overpolyEnabled = (overpolyParam != nullptr) && (overpolyParam->load() > 0.5f);
+  const bool slowMoEnabled = params.slowMo;
+  const bool overpolyEnabled = params.overpoly;
   if (!overpolyEnabled)
-      overpolySkipRemaining = 0;
-  const double slomoMultiplier = slowMoEnabled ? slomoStrategy.getComplementaryMultiplier() : 1.0;
-  pushSlomoScalarForGUI(static_cast<float>(slomoMultiplier));
+      voice.overpolySkipRemaining = 0;
   auto applySlomo = [&](unsigned long value) -> unsigned long
   {
       if (!slowMoEnabled)
@@ -1228,12 +1373,11 @@ juce::MidiBuffer MidiMarkovProcessor::generateNotesFromModel(const juce::MidiBuf
   {
       std::vector<int> gotNotes = markovStateToNotes(pitchState);
       std::vector<int> playNotes{};
-      int wantPolyphony = std::stoi(polyphonyModel.getEvent(true, userMIDIIsGenContextMode));
+      int wantPolyphony = std::stoi(nextVoiceEvent(voice, Voice::polyphony, userMIDIIsGenContextMode));
       int gotPolyphony = static_cast<int>(gotNotes.size());
       if (gotPolyphony > wantPolyphony)
       {
-          thread_local std::mt19937 rng{std::random_device{}()};
-          std::shuffle(gotNotes.begin(), gotNotes.end(), rng);
+          std::shuffle(gotNotes.begin(), gotNotes.end(), voice.rng);
           for (int i = 0; i < wantPolyphony; ++i)
               playNotes.push_back(gotNotes[i]);
       }
@@ -1244,29 +1388,32 @@ juce::MidiBuffer MidiMarkovProcessor::generateNotesFromModel(const juce::MidiBuf
       return playNotes;
   };
 
- unsigned long noteOnTime{0};
-  if (isTimeToPlayNote(bufferStartTime, bufferEndTime)){
-    if (overpolyEnabled && overpolySkipRemaining > 0)
+  // every onset that falls in this block goes out at its own sample offset, so 
+  // big buffers and short iois don't delay or drop notes
+  int onsetsThisBlock = 0;
+  while (onsetsThisBlock < maxOnsetsPerBlock && isTimeToPlayNote(voice, bufferStartTime, bufferEndTime)){
+    ++onsetsThisBlock;
+    const unsigned long noteOnTime = voice.nextTimeToPlayANote - bufferStartTime;
+    const size_t notesBeforeOnset = voice.generated.size();
+    unsigned long nextIoI = 0;
+
+    if (overpolyEnabled && voice.overpolySkipRemaining > 0)
     {
         // Skip output but advance time as if we played the note.
-        overpolySkipRemaining--;
-        noteOnTime = nextTimeToPlayANote - bufferStartTime;
-        nextIoI = applySlomo(std::stoul(iOIModel.getEvent(true, userMIDIIsGenContextMode)));
-        if (nextIoI > 0)
-        {
-            nextTimeToPlayANote = bufferStartTime + nextIoI + noteOnTime;
-            const bool quantiseEnabled = (quantiseParam != nullptr) && (quantiseParam->load() > 0.0f);
-            if (quantiseEnabled)
-                syncNextTimeToClock(hostInfo);
-        }
-        return generatedMessages;
+        voice.overpolySkipRemaining--;
+        nextIoI = applySlomo(std::stoul(nextVoiceEvent(voice, Voice::ioi, userMIDIIsGenContextMode)));
+        if (nextIoI == 0)
+            break;
+        voice.nextTimeToPlayANote = bufferStartTime + nextIoI + noteOnTime;
+        if (params.quantise)
+            syncNextTimeToClock(voice.nextTimeToPlayANote, hostInfo, params);
+        continue;
     }
 
-    if (!noMidiYet){ // not in bootstrapping phase 
-      std::string notes = pitchModel.getEvent(true, userMIDIIsGenContextMode);
-      unsigned long duration = applySlomo(std::stoul(noteDurationModel.getEvent(true, userMIDIIsGenContextMode)));
-      int velocity = std::stoi(velocityModel.getEvent(true, userMIDIIsGenContextMode));
-      noteOnTime = nextTimeToPlayANote - bufferStartTime; 
+    if (!voice.noMidiYet){ // not in bootstrapping phase 
+      std::string notes = nextVoiceEvent(voice, Voice::pitch, userMIDIIsGenContextMode);
+      unsigned long duration = applySlomo(std::stoul(nextVoiceEvent(voice, Voice::duration, userMIDIIsGenContextMode)));
+      int velocity = std::stoi(nextVoiceEvent(voice, Voice::velocity, userMIDIIsGenContextMode));
       // DBG("model wants note at "<< modelPlayNoteTime << " buffer starts at " << bufferStartTime << " boffset " << noteOnTime);
 
       // DBG("Note on time " << noteOnTime);
@@ -1280,7 +1427,7 @@ juce::MidiBuffer MidiMarkovProcessor::generateNotesFromModel(const juce::MidiBuf
         if (overpolyEnabled && playNotes.size() == 1)
         {
             std::uniform_int_distribution<int> extraDist(0, 4);
-            extraNotesGenerated = extraDist(callResponseRng);
+            extraNotesGenerated = extraDist(voice.rng);
             if (extraNotesGenerated > 0)
                 duration = duration * 4;
         }
@@ -1292,7 +1439,7 @@ juce::MidiBuffer MidiMarkovProcessor::generateNotesFromModel(const juce::MidiBuf
         };
 
         const juce::uint8 appliedVelocity = reduceVelocity(velocity, extraNotesGenerated);
-        const bool avoidEnabled = (avoidParam != nullptr) && (avoidParam->load() > 0.5f);
+        const bool avoidEnabled = params.avoid;
         const int avoidTransposition = avoidEnabled ? avoidStrategy.getTransposition() : 0;
 
         auto transposeNote = [&](int noteNumber)
@@ -1303,25 +1450,9 @@ juce::MidiBuffer MidiMarkovProcessor::generateNotesFromModel(const juce::MidiBuf
 
         for (const int& note : playNotes){
             const int transposedNote = transposeNote(note);
-            juce::MidiMessage nOn = juce::MidiMessage::noteOn(1, transposedNote, appliedVelocity);
             // DBG("generateNotesFromModel adding a note " << note << " v: " << velocity );
-
-            // ptocess Block deals with note offs - we just peg em here 
-            // but if this note is already playing
-            // then to avoid a double trigger/ note hold problem
-            // we need to add a note off to generatedmessage
-            if (noteOffTimes[transposedNote] > 0){// already playing this note
-              // force a note off at frame zero in the next frame
-              juce::MidiMessage nOff = juce::MidiMessage::noteOff(1, transposedNote);
-              generatedMessages.addEvent(nOff, 0);// send note off at the start of the block
-        
-              if (noteOnTime < 5){// ensure we have at least 5 samples before the next note on
-                noteOnTime = 5; 
-              }
-            } 
-            generatedMessages.addEvent(nOn, noteOnTime);// note to be played in this block
-
-            noteOffTimes[transposedNote] = elapsedSamples + duration; 
+            voice.generated.push_back({static_cast<int>(noteOnTime), transposedNote, appliedVelocity,
+                                       bufferStartTime + noteOnTime + duration});
         }
 
         if (overpolyEnabled && playNotes.size() == 1)
@@ -1329,93 +1460,91 @@ juce::MidiBuffer MidiMarkovProcessor::generateNotesFromModel(const juce::MidiBuf
             const int extraNotes = extraNotesGenerated;
             for (int i = 0; i < extraNotes; ++i)
             {
-                const std::string extraPitchState = pitchModel.getEvent(true, userMIDIIsGenContextMode);
-                unsigned long extraDuration = applySlomo(std::stoul(noteDurationModel.getEvent(true, userMIDIIsGenContextMode)));
+                const std::string extraPitchState = nextVoiceEvent(voice, Voice::pitch, userMIDIIsGenContextMode);
+                unsigned long extraDuration = applySlomo(std::stoul(nextVoiceEvent(voice, Voice::duration, userMIDIIsGenContextMode)));
                 if (extraNotes > 0)
                     extraDuration = extraDuration * 4;
-                int extraVelocityRaw = std::stoi(velocityModel.getEvent(true, userMIDIIsGenContextMode));
+                int extraVelocityRaw = std::stoi(nextVoiceEvent(voice, Voice::velocity, userMIDIIsGenContextMode));
                 const juce::uint8 extraVelocity = reduceVelocity(extraVelocityRaw, extraNotesGenerated);
                 unsigned long jitterSamples = 0;
                 if (const double sr = getSampleRate(); sr > 0.0)
                 {
                     std::uniform_int_distribution<unsigned long> jitterDist(
                         0, static_cast<unsigned long>(sr / 4.0));
-                    jitterSamples = jitterDist(callResponseRng);
+                    jitterSamples = jitterDist(voice.rng);
                 }
                 std::vector<int> extraPlayNotes = buildPlayableNotes(extraPitchState);
                 for (const int& noteVal : extraPlayNotes)
                 {
                     const int transposedNote = transposeNote(noteVal);
-                    juce::MidiMessage nOn = juce::MidiMessage::noteOn(1, transposedNote, extraVelocity);
-                    if (noteOffTimes[transposedNote] > 0)
-                    {
-                        juce::MidiMessage nOff = juce::MidiMessage::noteOff(1, transposedNote);
-                        generatedMessages.addEvent(nOff, 0);
-                        if (noteOnTime < 5)
-                            noteOnTime = 5;
-                    }
-                    generatedMessages.addEvent(nOn, noteOnTime);
-                    noteOffTimes[transposedNote] = elapsedSamples + extraDuration + jitterSamples;
+                    voice.generated.push_back({static_cast<int>(noteOnTime), transposedNote, extraVelocity,
+                                               bufferStartTime + noteOnTime + extraDuration + jitterSamples});
                 }
             }
-            overpolySkipRemaining = extraNotes;
-            pushOverpolyExtraForGUI(extraNotes);
+            voice.overpolySkipRemaining = extraNotes;
+            voice.overpolyExtra = extraNotes;
         }
         else
         {
-            pushOverpolyExtraForGUI(0);
+            voice.overpolyExtra = 0;
         }
       }
     }
 
 
     // how long to wait before we play next note/ chord
-    nextIoI = applySlomo(std::stoul(iOIModel.getEvent(true, userMIDIIsGenContextMode)));
+    nextIoI = applySlomo(std::stoul(nextVoiceEvent(voice, Voice::ioi, userMIDIIsGenContextMode)));
 
     // unsigned long quant = quantBPMParam.load()
     // apply quantisation if necessary
 
     //DBG("generateNotesFromModel playing. modelPlayNoteTime passed " << modelPlayNoteTime << " elapsed " << elapsedSamples);
-    if (nextIoI > 0){
-      lastOutgoingNoteOnTime = nextTimeToPlayANote; // satore the last one 
-      // elapsedSamples is the 'start of the buffer' 
-      nextTimeToPlayANote = bufferStartTime + nextIoI + noteOnTime;
-
-      const bool quantiseEnabled = (quantiseParam != nullptr) && (quantiseParam->load() > 0.0f);
-      if (quantiseEnabled)
-          syncNextTimeToClock(hostInfo);
-      // DBG("Next IOI " << nextIoI << " since last one " << (nextTimeToPlayANote -lastOutgoingNoteOnTime) << " buff " << getBlockSize());
-
-      // DBG("generateNotesFromModel new modelPlayNoteTime passed " << modelPlayNoteTime << "from IOI " << nextIoI);
-    } 
-  }
-  // if (generatedMessages.getNumEvents() > 0){
-  //   DBG("generateNotesFromModel:: retuirning notes " << generatedMessages.getNumEvents() << " ioi " << nextIoI);
-  // }
-  if (nextIoI == 0 && generatedMessages.getNumEvents() > 0){// stuck note badness. clear the notes
-    // DBG("Clearing notes....");
-    generatedMessages.clear();
-  }
+    if (nextIoI == 0){// stuck note badness. drop this onset's notes and wait for the next block
+      // DBG("Clearing notes....");
+      voice.generated.erase(voice.generated.begin() + static_cast<std::ptrdiff_t>(notesBeforeOnset), voice.generated.end());
+      break;
+    }
 
+    voice.lastOutgoingNoteOnTime = voice.nextTimeToPlayANote; // satore the last one 
+    // elapsedSamples is the 'start of the buffer' 
+    voice.nextTimeToPlayANote = bufferStartTime + nextIoI + noteOnTime;
 
-  return generatedMessages;
+    if (params.quantise)
+        syncNextTimeToClock(voice.nextTimeToPlayANote, hostInfo, params);
+    // DBG("Next IOI " << nextIoI << " since last one " << (voice.nextTimeToPlayANote - voice.lastOutgoingNoteOnTime) << " buff " << getBlockSize());
+  }
 }
 
 
-bool MidiMarkovProcessor::isTimeToPlayNote(unsigned long windowStartTime, unsigned long windowEndTime)
+state_single MidiMarkovProcessor::nextVoiceEvent(Voice& voice, Voice::Model model, bool useInputAsContext)
+{
+  MarkovManager& manager = *voice.models()[model];
+  if (!renderingOffline)
+    return manager.getEvent(true, useInputAsContext);
+
+  state_sequence& phrase = voice.phrases[model];
+  size_t& position = voice.phrasePositions[model];
+  if (position >= phrase.size())
+  {
+    manager.getEvents(phrase, offlinePhraseLength, true, useInputAsContext);
+    position = 0;
+  }
+  return phrase[position++];
+}
+
+bool MidiMarkovProcessor::isTimeToPlayNote(Voice& voice, unsigned long windowStartTime, unsigned long windowEndTime)
 {
   // if (modelPlayNoteTime == 0){
   //   return false; 
   // }
   // DBG("play at " << modelPlayNoteTime << " win: " << windowStartTime << ":" << windowEndTime);
-  if (nextTimeToPlayANote < windowStartTime) {
-    // shift the start time along to bootstrap
-    // playback. Weird but necessary
-    nextTimeToPlayANote = windowEndTime;// force the note play time on. eventually we'll want to play, right? 
-    return false;  
+  if (voice.nextTimeToPlayANote < windowStartTime) {
+    // we fell behind (or are just starting), so play at the start of this block 
+    // rather than losing a whole block, which would make timing depend on the buffer size
+    voice.nextTimeToPlayANote = windowStartTime;
   }
-  if (nextTimeToPlayANote >= windowStartTime && nextTimeToPlayANote < windowEndTime){
-    // DBG("time to play: [ win s "<< windowStartTime << " m: " << nextTimeToPlayANote << " win e " << windowEndTime << " ]");
+  if (voice.nextTimeToPlayANote >= windowStartTime && voice.nextTimeToPlayANote < windowEndTime){
+    // DBG("time to play: [ win s "<< windowStartTime << " m: " << voice.nextTimeToPlayANote << " win e " << windowEndTime << " ]");
     
     return true; 
   }
@@ -1496,25 +1625,167 @@ void MidiMarkovProcessor::setUpdateGuiEnabled(bool enabled)
 
 void MidiMarkovProcessor::resetModel()
 {
-  suspendProcessing(true);
-
   DBG("Proc: reset model");
+  // the audio thread does the work, so it never races with processBlock
+  resetRequested.store(true, std::memory_order_release);
+}
+
+void MidiMarkovProcessor::undoModelChange()
+{
+  DBG("Proc: undo model change");
+  undoRequested.store(true, std::memory_order_release);
+}
+
+void MidiMarkovProcessor::redoModelChange()
+{
+  DBG("Proc: redo model change");
+  redoRequested.store(true, std::memory_order_release);
+}
 
-    std::vector<MarkovManager*> mms = {&pitchModel, &polyphonyModel,  &iOIModel, &noteDurationModel, &velocityModel};
-  for (MarkovManager* mm : mms)
+void MidiMarkovProcessor::pb_stepModelHistory(bool undo)
+{
+  for (Voice& voice : voices)
   {
-    mm->reset();
+    // restoring a version swaps a pointer, so this is cheap even for big models
+    for (MarkovManager* mm : voice.models())
+    {
+      if (undo) mm->undo();
+      else mm->redo();
+    }
+    // phrases generated ahead came from the version we just left
+    voice.clearPhrases();
   }
-  for (int i = 0; i < 127; ++i)
+}
+
+void MidiMarkovProcessor::pb_resetModels()
+{
+  for (Voice& voice : voices)
   {
-    noteOffTimes[i] = 0;
-    noteOnTimes[i]  = 0;
+    for (MarkovManager* mm : voice.models())
+    {
+      MarkovChain::SharedModel oldModel = mm->resetAndRelease();
+      // only if all the slots are full does the old model get freed here
+      modelReclaimer.retire(std::move(oldModel));
+    }
+    for (int i = 0; i < 127; ++i)
+    {
+      voice.noteOnTimes[i]  = 0;
+    }
+    voice.clearPhrases();
   }
+  noteScheduler.clear();
 
   // next time processBlock is called, it'll send all notes off and return 
   sendAllNotesOffNext.store(true);
-  suspendProcessing(false);
+}
 
+void MidiMarkovProcessor::seedRandom(uint32_t seed)
+{
+    // one independent stream for each generator, so voices and models don't share sequences
+    std::seed_seq sequence { seed };
+    std::vector<uint32_t> seeds(static_cast<size_t>(maxVoices) * 6 + 3);
+    sequence.generate(seeds.begin(), seeds.end());
+    size_t next = 0;
+    for (Voice& voice : voices)
+    {
+        voice.rng.seed(seeds[next++]);
+        for (MarkovManager* mm : voice.models())
+            mm->seed(seeds[next++]);
+    }
+    callResponseRng.seed(seeds[next++]);
+    playProbabilityRng.seed(seeds[next++]);
+    loadSeedRng.seed(seeds[next++]);
+}
+
+bool MidiMarkovProcessor::startTraceRecording(const std::string& filename)
+{
+    if (traceRecording.load(std::memory_order_acquire))
+        return false;
+    trace.clear();
+    trace.reserve(traceReserveBlocks);
+    trace.seed = std::random_device{}();
+    traceFilename = filename;
+    // NaN never matches, so the first block records every parameter
+    tracedParameterValues.assign(traceParameters.size(), std::numeric_limits<float>::quiet_NaN());
+    seedRandom(trace.seed);
+    traceRecording.store(true, std::memory_order_release);
+    return true;
+}
+
+bool MidiMarkovProcessor::stopTraceRecording()
+{
+    if (!traceRecording.exchange(false, std::memory_order_acq_rel))
+        return false;
+    // a block that saw the flag may still be adding to the trace
+    waitForActiveProcessBlocks();
+    trace.sampleRate = getSampleRate();
+    trace.maxBlockSize = getBlockSize();
+    const bool saved = trace.save(traceFilename);
+    if (!saved)
+        std::cout << "MidiMarkovProcessor::stopTraceRecording could not write " << traceFilename << std::endl;
+    trace.clear();
+    return saved;
+}
+
+void MidiMarkovProcessor::applyTracedParameter(uint16_t index, float value)
+{
+    if (index >= traceParameters.size())
+        return;
+    TracedParameter& traced = traceParameters[index];
+    traced.parameter->setValueNotifyingHost(traced.parameter->convertTo0to1(value));
+    // the normalised round trip can be off by a bit, and the audio thread reads the raw value
+    traced.value->store(value, std::memory_order_relaxed);
+}
+
+void MidiMarkovProcessor::pb_traceBlockStart(int numSamples)
+{
+    uint16_t flags = renderingOffline ? PerformanceTrace::nonRealtime : 0;
+    double ppq = 0.0, bpm = 0.0;
+    int64_t timeInSamples = 0;
+    if (auto* playHead = getPlayHead())
+    {
+        if (auto position = playHead->getPosition())
+        {
+            flags |= PerformanceTrace::transportKnown;
+            if (position->getIsPlaying()) flags |= PerformanceTrace::transportPlaying;
+            if (position->getIsRecording()) flags |= PerformanceTrace::transportRecording;
+            if (auto value = position->getPpqPosition()) { flags |= PerformanceTrace::hasPpq; ppq = *value; }
+            if (auto value = position->getBpm()) { flags |= PerformanceTrace::hasBpm; bpm = *value; }
+            if (auto value = position->getTimeInSamples()) { flags |= PerformanceTrace::hasTimeInSamples; timeInSamples = *value; }
+        }
+    }
+    PerformanceTrace::Block& block = trace.beginBlock(static_cast<uint32_t>(numSamples), flags);
+    block.ppqPosition = ppq;
+    block.bpm = bpm;
+    block.timeInSamples = timeInSamples;
+
+    for (size_t i = 0; i < traceParameters.size(); ++i)
+    {
+        const float value = traceParameters[i].value->load(std::memory_order_relaxed);
+        if (value != tracedParameterValues[i])
+        {
+            trace.addParamChange(static_cast<uint16_t>(i), value);
+            tracedParameterValues[i] = value;
+        }
+    }
+}
+
+void MidiMarkovProcessor::pb_traceIncoming(const juce::MidiBuffer& midiMessages, bool resetFromGui, bool undoFromGui, bool redoFromGui, bool allOffRequested)
+{
+    if (trace.blocks.empty())
+        return;
+    if (resetFromGui) trace.blocks.back().flags |= PerformanceTrace::resetRequested;
+    if (undoFromGui) trace.blocks.back().flags |= PerformanceTrace::undoRequested;
+    if (redoFromGui) trace.blocks.back().flags |= PerformanceTrace::redoRequested;
+    if (allOffRequested) trace.blocks.back().flags |= PerformanceTrace::allNotesOff;
+    for (const auto metadata : midiMessages)
+        trace.addMidiIn(metadata.samplePosition, metadata.data, metadata.numBytes);
+}
+
+void MidiMarkovProcessor::pb_traceOutgoing(const juce::MidiBuffer& midiMessages)
+{
+    for (const auto metadata : midiMessages)
+        trace.addMidiOut(metadata.samplePosition, metadata.data, metadata.numBytes);
 }
 
 void MidiMarkovProcessor::waitForActiveProcessBlocks() const
@@ -1535,6 +1806,13 @@ bool MidiMarkovProcessor::startModelIOTask(ModelIoState state, std::string stage
     if (modelIoThread.joinable())
         modelIoThread.join();
 
+    // a replay has no model files to load or save, so the trace ends here
+    if (traceRecording.load(std::memory_order_acquire))
+    {
+        std::cout << "MidiMarkovProcessor::startModelIOTask " << stage << " ends the trace recording" << std::endl;
+        stopTraceRecording();
+    }
+
     sendAllNotesOffNext.store(true, std::memory_order_relaxed);
     pushModelIoStatusForGUI(state, stage);
     suspendProcessing(true);
@@ -1595,25 +1873,29 @@ bool MidiMarkovProcessor::loadModelString(const std::string& filename)
     in.close();
 
     std::vector<std::string> modelStrings = MarkovChain::tokenise(data, FILE_SEP_FOR_SAVE);
-    std::vector<MarkovManager*> managers = {
-        &pitchModel, &polyphonyModel, &iOIModel, &noteDurationModel, &velocityModel};
+    const size_t modelsPerVoice = voices[0].models().size();
 
-    if (modelStrings.size() != managers.size())
+    if (modelStrings.size() != modelsPerVoice)
     {
-      DBG("DinvernoPolyMarkov::loadModel did not find " << managers.size()
+      DBG("DinvernoPolyMarkov::loadModel did not find " << modelsPerVoice
           << " model strings in file " << filename);
       return false;
     }
 
-    for (size_t i = 0; i < managers.size(); ++i)
+    // every active voice starts from the loaded material
+    for (int v = 0; v < loadVoiceCount(); ++v)
     {
-      if (!managers[i]->setupModelFromString(modelStrings[i]))
+      auto managers = voices[static_cast<size_t>(v)].models();
+      for (size_t i = 0; i < managers.size(); ++i)
       {
-        DBG("DinvernoPolyMarkov::loadModel error loading model " << i << " from " << filename);
-        return false;
-      }
+        if (!managers[i]->setupModelFromString(modelStrings[i]))
+        {
+          DBG("DinvernoPolyMarkov::loadModel error loading model " << i << " from " << filename);
+          return false;
+        }
 
-      DBG("DinvernoPolyMarkov::loadModel loaded model " << i << " from " << filename);
+        DBG("DinvernoPolyMarkov::loadModel loaded model " << i << " from " << filename);
+      }
     }
 
     return true;
@@ -1626,8 +1908,8 @@ bool MidiMarkovProcessor::loadModelString(const std::string& filename)
 bool MidiMarkovProcessor::saveModelString(const std::string& filename)
 {
   std::string data;
-  std::vector<MarkovManager*> managers = {
-      &pitchModel, &polyphonyModel, &iOIModel, &noteDurationModel, &velocityModel};
+  // the file format holds one voice, so this is the first one
+  auto managers = voices[0].models();
 
   for (MarkovManager* mm : managers)
   {
@@ -1648,15 +1930,31 @@ bool MidiMarkovProcessor::saveModelString(const std::string& filename)
 
 bool MidiMarkovProcessor::saveModelBinary(const std::string& filename)
 {
-  std::vector<MarkovManager*> managers = {
-      &pitchModel, &polyphonyModel, &iOIModel, &noteDurationModel, &velocityModel};
+  MarkovChain::CompactionOptions compaction;
+  if (saveMinCountParam != nullptr)
+    compaction.minCount = static_cast<double>(saveMinCountParam->load());
+  if (saveMaxOrderParam != nullptr)
+    compaction.maxOrder = static_cast<unsigned long>(saveMaxOrderParam->load());
+
+  // the file format holds one voice, so this is the first one
+  return saveVoiceModels(voices[0], filename, compaction);
+}
+bool MidiMarkovProcessor::saveVoiceModels(Voice& voice, const std::string& filename, const MarkovChain::CompactionOptions& compaction)
+{
+  auto managers = voice.models();
 
   std::string blob;
   appendUint32(blob, static_cast<uint32_t>(managers.size()));
+  size_t totalBytesBefore = 0;
 
   for (size_t i = 0; i < managers.size(); ++i)
   {
-    std::string modelData = managers[i]->getModelAsBinaryString();
+    MarkovChain::CompactionStats stats;
+    std::string modelData = managers[i]->getModelAsBinaryString(compaction, &stats);
+    totalBytesBefore += stats.bytesBefore;
+    DBG("DinvernoPolyMarkov::saveModelBinary model " << i << " compacted "
+        << static_cast<juce::int64>(stats.contextsBefore) << " -> " << static_cast<juce::int64>(stats.contextsAfter) << " contexts, "
+        << static_cast<juce::int64>(stats.bytesBefore) << " -> " << static_cast<juce::int64>(stats.bytesAfter) << " bytes");
 
     if (modelData.size() > std::numeric_limits<uint32_t>::max())
     {
@@ -1668,6 +1966,9 @@ bool MidiMarkovProcessor::saveModelBinary(const std::string& filename)
     appendUint32(blob, static_cast<uint32_t>(modelData.size()));
     blob.append(modelData);
   }
+  std::cout << "DinvernoPolyMarkov::saveModelBinary compaction and v2 encoding saved "
+            << (totalBytesBefore + 4 + 4 * managers.size() - blob.size()) << " of "
+            << (totalBytesBefore + 4 + 4 * managers.size()) << " v1 bytes before compression" << std::endl;
 
   if (std::ofstream ofs{filename, std::ios::binary})
   {
@@ -1709,6 +2010,50 @@ bool MidiMarkovProcessor::loadModelBinary(const std::string& filename)
   std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
   in.close();
 
+  // another instance may already have loaded this file, in which case we share its models
+  SharedModelRegistry& registry = SharedModelRegistry::instance();
+  const std::string registryKey = SharedModelRegistry::makeKey(filename, data);
+  std::shared_ptr<const SharedModelSet> loaded = registry.find(registryKey);
+  if (loaded == nullptr)
+  {
+    auto parsed = std::make_shared<SharedModelSet>();
+    if (!parseModelSet(filename, data, *parsed))
+      return false;
+    loaded = registry.add(registryKey, std::move(parsed));
+  }
+  else
+    DBG("DinvernoPolyMarkov::loadModelBinary sharing the models already loaded from " << filename);
+
+  if (loaded->chains.size() != voices[0].models().size())
+    return false;
+
+  // every active voice starts from the loaded material
+  const bool willLearn = snapshotParameters().learning;
+  // with its own random stream per model, or voices sharing a table would play the same notes
+  for (int v = 0; v < loadVoiceCount(); ++v)
+  {
+    auto models = voices[static_cast<size_t>(v)].models();
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+      models[i]->shareModelFrom(loaded->chains[i]);
+      models[i]->seed(loadSeedRng());
+      // otherwise the first note learned would copy the page directories on the audio thread
+      if (willLearn)
+        models[i]->makeModelPrivate();
+    }
+  }
+  // the voices that weren't loaded take a step too, so an undo moves every voice back together
+  for (int v = loadVoiceCount(); v < maxVoices; ++v)
+  {
+    for (MarkovManager* mm : voices[static_cast<size_t>(v)].models())
+      mm->checkpoint();
+  }
+  sharedModels = std::move(loaded);
+  return true;
+}
+
+bool MidiMarkovProcessor::parseModelSet(const std::string& filename, std::string data, SharedModelSet& set)
+{
   const bool isCompressed = hasExtensionIgnoreCase(filename, ".modelz");
   if (isCompressed)
   {
@@ -1730,17 +2075,16 @@ bool MidiMarkovProcessor::loadModelBinary(const std::string& filename)
     return false;
   }
 
-  std::vector<MarkovManager*> managers = {
-      &pitchModel, &polyphonyModel, &iOIModel, &noteDurationModel, &velocityModel};
+  const size_t modelsPerVoice = voices[0].models().size();
 
-  if (entryCount != managers.size())
+  if (entryCount != modelsPerVoice)
   {
-    // DBG("DinvernoPolyMarkov::loadModelBinary expected " << managers.size()
+    // DBG("DinvernoPolyMarkov::loadModelBinary expected " << modelsPerVoice
         // << " entries but file contains " << entryCount);
     return false;
   }
 
-  for (size_t i = 0; i < managers.size(); ++i)
+  for (size_t i = 0; i < modelsPerVoice; ++i)
   {
     uint32_t length = 0;
     if (!readUint32(data, offset, length))
@@ -1758,11 +2102,14 @@ bool MidiMarkovProcessor::loadModelBinary(const std::string& filename)
     std::string modelData(data.data() + offset, length);
     offset += length;
 
-    if (!managers[i]->setupModelFromBinaryString(modelData))
+    MarkovChain chain;
+    if (!chain.fromStringBinary(modelData))
     {
       DBG("DinvernoPolyMarkov::loadModelBinary error loading model " << i << " from " << filename);
       return false;
     }
+    chain.prepareForSharing();
+    set.chains.push_back(std::move(chain));
 
     DBG("DinvernoPolyMarkov::loadModelBinary loaded model " << i << " from " << filename);
   }
@@ -1857,16 +2204,9 @@ MidiMarkovProcessor::HostClockInfo MidiMarkovProcessor::pb_collectHostClockInfo(
     return info;
 }
 
-void MidiMarkovProcessor::pb_handleMidiFromUI(juce::MidiBuffer& midiMessages)
+void MidiMarkovProcessor::pb_handleMidiFromUI(juce::MidiBuffer& midiMessages, int numSamples)
 {
-    if (midiReceivedFromUI.getNumEvents() > 0)
-    {
-        midiMessages.addEvents(midiReceivedFromUI,
-                               midiReceivedFromUI.getFirstEventTime(),
-                               midiReceivedFromUI.getLastEventTime() + 1,
-                               0);
-        midiReceivedFromUI.clear();
-    }
+    midiReceivedFromUI.popAllInto(midiMessages, numSamples);
 }
 
 void MidiMarkovProcessor::pb_informGuiOfIncoming(const juce::MidiBuffer& midiMessages)
@@ -1875,10 +2215,7 @@ void MidiMarkovProcessor::pb_informGuiOfIncoming(const juce::MidiBuffer& midiMes
     {
         auto msg = metadata.getMessage();
         if (msg.isNoteOnOrOff())
-        {
             pushMIDIInForGUI(msg);
-            break;
-        }
     }
 }
 
@@ -1939,11 +2276,11 @@ void MidiMarkovProcessor::pb_randomiseBehaviourTogglesForResponse()
     });
 }
 
-void MidiMarkovProcessor::pb_tickInternalClock(const juce::AudioBuffer<float>& buffer)
+void MidiMarkovProcessor::pb_tickInternalClock(const juce::AudioBuffer<float>& buffer, const BlockParams& params)
 {
     if (const double sr = getSampleRate(); sr > 0.0)
     {
-        const double newInterval = calculateClockSamplesPerTick(sr);
+        const double newInterval = calculateClockSamplesPerTick(sr, params);
         if (newInterval > 0.0)
         {
             if (std::abs(newInterval - clockSamplesPerTick) > 0.5)
@@ -1966,13 +2303,13 @@ void MidiMarkovProcessor::pb_tickInternalClock(const juce::AudioBuffer<float>& b
     hostAwaitingFirstTick = false;
 }
 
-void MidiMarkovProcessor::pb_tickHostClock(bool transportPlaying, bool hostHasPpq, double hostPpqPosition)
+void MidiMarkovProcessor::pb_tickHostClock(bool transportPlaying, bool hostHasPpq, double hostPpqPosition, const BlockParams& params)
 {
     clockSamplesAccumulated = 0.0;
 
     if (transportPlaying && hostHasPpq)
     {
-        const double divisionBeats = static_cast<double>(ImproviserControlGUI::divisionIdToValue(static_cast<int>(quantDivisionParam->load())));
+        const double divisionBeats = static_cast<double>(ImproviserControlGUI::divisionIdToValue(params.quantDivision));
         const double ppqPerTick = juce::jmax(1.0e-4, divisionBeats);
 
         if (!hostClockPositionInitialised)
@@ -2005,63 +2342,169 @@ void MidiMarkovProcessor::pb_tickHostClock(bool transportPlaying, bool hostHasPp
     }
 }
 
-void MidiMarkovProcessor::pb_learnFromIncomingMidi(const juce::MidiBuffer& midiMessages, double effectiveBpm)
+void MidiMarkovProcessor::pb_learnFromIncomingMidi(const juce::MidiBuffer& midiMessages, double effectiveBpm, const BlockParams& params)
 {
-    const bool learningEnabled = learningParam->load() > 0.0f;
+    const bool learningEnabled = params.learning;
 
     unsigned long quantBlockSizeSamples = 0;
-    if (quantiseParam->load() > 0.0f && effectiveBpm > 0.0)
+    if (params.quantise && effectiveBpm > 0.0)
     {
-        const double division = ImproviserControlGUI::divisionIdToValue(static_cast<int>(quantDivisionParam->load()));
+        const double division = ImproviserControlGUI::divisionIdToValue(params.quantDivision);
         const double bpm = juce::jmax(20.0, effectiveBpm);
         const double secondsPerBeat = 60.0 / bpm;
         quantBlockSizeSamples = static_cast<unsigned long>(getSampleRate() * (division * secondsPerBeat));
     }
 
-    analysePitches(midiMessages, learningEnabled);
-    analyseDuration(midiMessages, quantBlockSizeSamples, learningEnabled);
-    analyseIoI(midiMessages, quantBlockSizeSamples, learningEnabled);
-    analyseVelocity(midiMessages, learningEnabled);
+    if (midiMessages.getNumEvents() == 0)
+        return;
+
+    const size_t voiceCount = static_cast<size_t>(activeVoiceCount);
+    const double sr = getSampleRate();
+    voicePool.run(voiceCount, [&](size_t v)
+    {
+        learnFromMidi(voices[v], midiMessages, elapsedSamples, sr, static_cast<int>(quantBlockSizeSamples), learningEnabled);
+    });
+
+    // the slow-mo strategy is shared between the voices, so it hears about their iois afterwards
+    for (size_t v = 0; v < voiceCount; ++v)
+    {
+        if (sr > 0.0)
+            for (int ioi : voices[v].learnedIois)
+                slomoStrategy.addIoiSamples(ioi, sr);
+        voices[v].learnedIois.clear();
+    }
+}
+
+void MidiMarkovProcessor::pb_assignVoices(const BlockParams& params)
+{
+    activeVoiceCount = juce::jlimit(1, maxVoices, params.voiceCount);
+    const int outBase = juce::jlimit(1, 16, params.midiOutChannel);
+    for (int v = 0; v < activeVoiceCount; ++v)
+    {
+        Voice& voice = voices[static_cast<size_t>(v)];
+        // a single voice can listen to everything, a group of voices has a channel each
+        if (activeVoiceCount == 1)
+            voice.inputChannel = juce::jlimit(0, 16, params.midiInChannel);
+        else
+            voice.inputChannel = (juce::jmax(1, params.midiInChannel) - 1 + v) % 16 + 1;
+        voice.outputChannel = (outBase - 1 + v) % 16 + 1;
+    }
 }
 
-void MidiMarkovProcessor::pb_schedulePendingNoteOffs(juce::MidiBuffer& buffer, unsigned long blockStart, unsigned long blockEnd)
+int MidiMarkovProcessor::loadVoiceCount() const
+{
+    const int count = voiceCountParam != nullptr ? static_cast<int>(voiceCountParam->load(std::memory_order_relaxed)) : 1;
+    return juce::jlimit(1, maxVoices, count);
+}
+
+void MidiMarkovProcessor::pb_applyModelLimits(const BlockParams& params)
 {
-    for (auto i = 0; i < 127; ++i)
+    if (params.modelMemoryMB != appliedModelMemoryMB)
+    {
+        appliedModelMemoryMB = params.modelMemoryMB;
+        const size_t budgetBytes = static_cast<size_t>(juce::jmax(0, params.modelMemoryMB)) * 1024 * 1024;
+        for (Voice& voice : voices)
+            for (MarkovManager* mm : voice.models())
+                mm->setMemoryBudget(budgetBytes);
+    }
+
+    if (params.forgetHalfLife != appliedForgetHalfLife)
+    {
+        const int halfLife = params.forgetHalfLife;
+        appliedForgetHalfLife = halfLife;
+        // each learned event scales existing weights by this, so they halve after halfLife events
+        const double decayPerEvent = halfLife > 0 ? std::pow(0.5, 1.0 / static_cast<double>(halfLife)) : 1.0;
+        for (Voice& voice : voices)
+            for (MarkovManager* mm : voice.models())
+                mm->setDecay(decayPerEvent);
+    }
+
+    if (params.scale != appliedScale || params.scaleRoot != appliedScaleRoot)
+    {
+        appliedScale = params.scale;
+        appliedScaleRoot = params.scaleRoot;
+        const uint16_t pitchClasses = scaleChoices[static_cast<size_t>(juce::jlimit(0, static_cast<int>(scaleChoices.size()) - 1, params.scale))].second;
+        // nothing is generating yet this block, so the mask can change under the models.
+        // avoid only transposes by octaves, so what is played stays in the scale
+        scaleMask = MarkovChain::NoteMask::forScale(pitchClasses, params.scaleRoot);
+        for (Voice& voice : voices)
+        {
+            voice.pitchModel.setObservationFilter(pitchClasses != 0 ? &scaleMask : nullptr);
+            // a phrase generated ahead for offline rendering would still be in the old scale
+            voice.phrases[Voice::pitch].clear();
+            voice.phrasePositions[Voice::pitch] = 0;
+        }
+    }
+
+    if (params.blendOrders != appliedBlendOrders)
     {
-        if (noteOffTimes[i] > blockStart && noteOffTimes[i] < blockEnd)
+        appliedBlendOrders = params.blendOrders;
+        MarkovChain::BlendOptions blend;
+        blend.mode = params.blendOrders ? MarkovChain::BlendOptions::escape : MarkovChain::BlendOptions::off;
+        for (Voice& voice : voices)
         {
-            const auto noteSampleOffset = static_cast<int>(noteOffTimes[i] - blockStart);
-            buffer.addEvent(juce::MidiMessage::noteOff(1, i, 0.0f), noteSampleOffset);
-            noteOffTimes[i] = 0;
+            for (MarkovManager* mm : voice.models())
+                mm->setBlending(blend);
+            voice.clearPhrases();
         }
     }
 }
 
+void MidiMarkovProcessor::pb_schedulePendingNoteOffs(juce::MidiBuffer& buffer, unsigned long blockStart, unsigned long blockEnd)
+{
+    noteScheduler.processDue(blockEnd, [&](const NoteScheduler::Event& event)
+    {
+        // anything overdue goes out at the start of the block
+        const int samplePos = event.time > blockStart ? static_cast<int>(event.time - blockStart) : 0;
+        if (event.kind == NoteScheduler::Kind::noteOff)
+            buffer.addEvent(juce::MidiMessage::noteOff(event.channel, event.note, 0.0f), samplePos);
+        else
+            buffer.addEvent(juce::MidiMessage::noteOn(event.channel, event.note, static_cast<juce::uint8>(event.velocity)), samplePos);
+    });
+}
+
+void MidiMarkovProcessor::addScheduledNote(juce::MidiBuffer& buffer, const juce::MidiMessage& noteOn, int samplePos, unsigned long noteOffTime)
+{
+    const int channel = noteOn.getChannel();
+    const int note = noteOn.getNoteNumber();
+    const unsigned long noteOnTime = elapsedSamples + static_cast<unsigned long>(samplePos);
+    // if this pitch is still sounding past our onset, its pending off would cut
+    // the new note short, so end the old note right where this one starts instead
+    const unsigned long pendingOff = noteScheduler.latestNoteOff(channel, note);
+    if (pendingOff > 0 && pendingOff >= noteOnTime)
+    {
+        noteScheduler.cancelNoteOffs(channel, note);
+        buffer.addEvent(juce::MidiMessage::noteOff(channel, note), samplePos);
+    }
+    // no room to schedule the off means no note, rather than a stuck one
+    if (!noteScheduler.scheduleNoteOff(noteOffTime, channel, note))
+        return;
+    buffer.addEvent(noteOn, samplePos);
+}
+
 void MidiMarkovProcessor::pb_informGuiOfOutgoing(const juce::MidiBuffer& midiMessages)
 {
     for (const auto metadata : midiMessages)
     {
         auto msg = metadata.getMessage();
         if (msg.isNoteOnOrOff())
-        {
             pushMIDIOutForGUI(msg);
-            break;
-        }
     }
 }
 
-void MidiMarkovProcessor::pb_applyPlayProbability(juce::MidiBuffer& midiMessages)
+void MidiMarkovProcessor::pb_applyPlayProbability(juce::MidiBuffer& midiMessages, const BlockParams& params)
 {
-    if (playProbabilityParam->load() >= 1.0f || midiMessages.getNumEvents() == 0)
+    if (params.playProbability >= 1.0f || midiMessages.getNumEvents() == 0)
         return;
 
-    juce::MidiBuffer filtered;
+    juce::MidiBuffer& filtered = filteredMidi;
+    filtered.clear();
     for (const auto metadata : midiMessages)
     {
         auto msg = metadata.getMessage();
         if (msg.isNoteOn())
         {
-            if (juce::Random::getSystemRandom().nextDouble() < playProbabilityParam->load())
+            if (std::uniform_real_distribution<double>(0.0, 1.0)(playProbabilityRng) < params.playProbability)
                 filtered.addEvent(msg, metadata.samplePosition);
         }
         else
@@ -2082,9 +2525,9 @@ void MidiMarkovProcessor::pb_logMidiEvents(const juce::MidiBuffer& midiMessages)
     }
 }
 
-bool MidiMarkovProcessor::pb_handlePlayingState(juce::MidiBuffer& midiMessages, bool hostAllowsPlayback, bool allOffRequested)
+bool MidiMarkovProcessor::pb_handlePlayingState(juce::MidiBuffer& midiMessages, bool hostAllowsPlayback, bool allOffRequested, const BlockParams& params)
 {
-    const bool playingParamEnabled = playingParam->load() == 1.0f;
+    const bool playingParamEnabled = params.playing;
     const bool shouldPlay = playingParamEnabled && hostAllowsPlayback;
 
     if (shouldPlay)
@@ -2109,20 +2552,36 @@ void MidiMarkovProcessor::pb_handleStuckNotes(juce::MidiBuffer& midiMessages, un
     std::vector<int> stuckNotes = midiMonitor.getStuckNotes(elapsedSamplesAtEnd);
     for (auto note : stuckNotes)
     {
-        midiMessages.addEvent(juce::MidiMessage::noteOff(1, note), 0);
+        // the monitor doesn't know channels, so release it on every channel we play on
+        for (int v = 0; v < activeVoiceCount; ++v)
+            midiMessages.addEvent(juce::MidiMessage::noteOff(voices[static_cast<size_t>(v)].outputChannel, note), 0);
         midiMonitor.unstickNote(note);
     }
 }
 
-void MidiMarkovProcessor::pb_sendPendingAllNotesOff(juce::MidiBuffer& midiMessages, bool allOffRequested)
+void MidiMarkovProcessor::pb_trackSoundingNotes(const juce::MidiBuffer& midiMessages)
+{
+    for (const auto metadata : midiMessages)
+    {
+        const auto msg = metadata.getMessage();
+        if (msg.isNoteOn())
+            soundingNotes.noteOn(msg.getChannel(), msg.getNoteNumber());
+        else if (msg.isNoteOff())
+            soundingNotes.noteOff(msg.getChannel(), msg.getNoteNumber());
+        else if (msg.isAllNotesOff() || msg.isAllSoundOff())
+            soundingNotes.allNotesOff(msg.getChannel());
+    }
+}
+
+void MidiMarkovProcessor::pb_sendPendingAllNotesOff(juce::MidiBuffer& midiMessages, bool allOffRequested, const BlockParams& params)
 {
     if (!allOffRequested)
         return;
 
     midiMessages.clear();
-    midiReceivedFromUI.clear();
+    midiReceivedFromUI.discardAll();
 
     DBG("Processor sending all notes off.");
-    sendMidiPanic(midiMessages, 0);
+    sendMidiPanic(midiMessages, 0, params.fullPanic);
     sendAllNotesOffNext.store(false, std::memory_order_relaxed);
 }
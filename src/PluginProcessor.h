@@ -16,10 +16,20 @@
 #include <functional>
 #include <atomic>
 #include <mutex>
+#include <array>
+#include <vector>
 #include "ImproviserControlGUI.h"
 #include "MarkovModelCPP/src/MarkovManager.h"
 #include "ChordDetector.h"
 #include "MIDIMonitor.h"
+#include "NoteScheduler.h"
+#include "SoundingNotes.h"
+#include "TelemetryRing.h"
+#include "MidiInputFifo.h"
+#include "DeferredReclaimer.h"
+#include "VoiceWorkerPool.h"
+#include "SharedModelRegistry.h"
+#include "PerformanceTrace.h"
 #include "Behaviours.h"
 
 //==============================================================================
@@ -33,6 +43,8 @@ class MidiMarkovProcessor  : public juce::AudioProcessor,
 
                             {
 public:
+    /** most parts one instance can improvise at once, see the voiceCount parameter */
+    static constexpr int maxVoices = 4;
     //==============================================================================
     MidiMarkovProcessor();
     ~MidiMarkovProcessor() override;
@@ -70,56 +82,47 @@ void processBlockHide (juce::AudioBuffer<float>&, juce::MidiBuffer&) ;
     //==============================================================================
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
-    /** add some midi to be played at the sent sample offset - the piano UI bit calls this*/
-    void uiAddsMidi(const juce::MidiMessage& msg, int sampleOffset);
+    /** 
+     * add some midi to be played at the sent sample offset in the next block - the piano UI bit calls this.
+     * safe to call from any non-audio thread. returns false if the message was dropped 
+     */
+    bool uiAddsMidi(const juce::MidiMessage& msg, int sampleOffset);
     /** reset the model data - does not send all notes off etc. do that manually if you want */
     void resetMarkovModel();
 
     /** on next processBlock, send all notes off and any other midi needed in a panic */
     void sendAllNotesOff();
-    /** call this from anywhere to tell the processor about some midi that was received so it can save it for the GUI to access later */
+    /**
+     * The push*ForGUI functions add a record to the telemetry stream. Only the audio thread
+     * may call them (it is single producer), apart from before playback starts.
+     */
+    /** tell the GUI about a midi note that was received */
     void pushMIDIInForGUI(const juce::MidiMessage& msg);
-    /** call this from the UI message thread if you want to know what the last received midi message was */
-    bool pullMIDIInForGUI(int& note, float& vel, uint32_t& lastSeenStamp);
-    /** push current avoid transposition to GUI mailbox */
+    /** push current avoid transposition to the GUI */
     void pushAvoidTranspositionForGUI(int semitones);
-    /** pull avoid transposition from GUI mailbox */
-    bool pullAvoidTranspositionForGUI(int& semitones, uint32_t& lastSeenStamp);
-    /** push the current slow-mo scalar to GUI mailbox */
+    /** push the current slow-mo scalar to the GUI, if it changed */
     void pushSlomoScalarForGUI(float scalar);
-    /** pull the latest slow-mo scalar from GUI mailbox */
-    bool pullSlomoScalarForGUI(float& scalar, uint32_t& lastSeenStamp);
     /** push overpoly extra note count */
     void pushOverpolyExtraForGUI(int extraCount);
-    /** pull overpoly extra note count */
-    bool pullOverpolyExtraForGUI(int& extraCount, uint32_t& lastSeenStamp);
-    /** push call/response energy to GUI mailbox */
+    /** push call/response energy to the GUI, if it changed */
     void pushCallResponseEnergyForGUI(float energy01);
-    /** pull latest call/response energy from GUI mailbox */
-    bool pullCallResponseEnergyForGUI(float& energy01, uint32_t& lastSeenStamp);
-    /** push call/response phase status to GUI mailbox */
+    /** push call/response phase status to the GUI, if it changed */
     void pushCallResponsePhaseForGUI(bool enabled, bool inResponse);
-    /** pull call/response phase status for GUI */
-    bool pullCallResponsePhaseForGUI(bool& enabled, bool& inResponse, uint32_t& lastSeenStamp);
-    /** push model status (size/order) to GUI mailbox */
+    /** push model status (size/order) to the GUI, for the models that changed */
     void pushModelStatusForGUI(int pitchSize, int pitchOrder,
                                int ioiSize, int ioiOrder,
                                int durSize, int durOrder);
-    /** pull model status for GUI */
-    bool pullModelStatusForGUI(int& pitchSize, int& pitchOrder,
-                               int& ioiSize, int& ioiOrder,
-                               int& durSize, int& durOrder,
-                               uint32_t& lastSeenStamp);
+    /** 
+     * call this from the UI message thread to drain the telemetry stream. 
+     * copies up to maxEvents into dest, oldest first, and returns how many 
+     */
+    size_t pullTelemetryForGUI(TelemetryEvent* dest, size_t maxEvents);
     /** push model IO status (loading/saving) */
     void pushModelIoStatusForGUI(ModelIoState state, const std::string& stage);
     /** pull model IO status */
     bool pullModelIoStatusForGUI(ModelIoState& state, std::string& stage, uint32_t& lastSeenStamp);
-    /** call this from anywhere to tell the processor about some midi that was sent so it can save it for the GUI to access later */
+    /** tell the GUI about a midi note that was sent */
     void pushMIDIOutForGUI(const juce::MidiMessage& msg);
-    /** call this from the UI message thread if you want to know what the last received midi message was */
-    bool pullMIDIOutForGUI(int& note, float& vel, uint32_t& lastSeenStamp);
-    /** return true if a new internal clock tick is available and update lastSeenStamp */
-    bool pullClockTickForGUI(uint32_t& lastSeenStamp);
     /** return a reference to the APVTS variable */
     juce::AudioProcessorValueTreeState& getAPVTState();
     /** request a BPM increment or decrement from the GUI */
@@ -134,7 +137,101 @@ void processBlockHide (juce::AudioBuffer<float>&, juce::MidiBuffer&) ;
     // implementation of the ImproControlListener interface
     bool loadModel(std::string filename) override;
     bool saveModel(std::string filename) override;
+    /** ask the audio thread to reset the models at the start of the next block */
     void resetModel() override; 
+    /** ask the audio thread to step every model back to its previous version. see MarkovManager::undo */
+    void undoModelChange() override;
+    /** ask the audio thread to step every model forward again. see MarkovManager::redo */
+    void redoModelChange() override;
+
+    /** 
+     * restart every random number generator the processor uses from the sent seed, so a run
+     * can be repeated exactly. call before playback starts 
+     */
+    void seedRandom(uint32_t seed);
+    /**
+     * capture everything that drives the processor to a PerformanceTrace, written to filename
+     * by stopTraceRecording (or the destructor). picks and applies a new seed, so call it before
+     * playback starts: a replay begins from a freshly constructed processor. Setting the 
+     * MIDI_MARKOV_TRACE environment variable to a file path does this from the constructor.
+     * loading or saving a model stops the recording, as a replay can't repeat it.
+     */
+    bool startTraceRecording(const std::string& filename);
+    /** stop capturing and write the trace. returns false if not recording or the write failed */
+    bool stopTraceRecording();
+    /** set a parameter to a raw value captured in a trace. index is into the trace's parameter list */
+    void applyTracedParameter(uint16_t index, float value);
+
+    /** a note a voice wants to play, waiting to be scheduled on the audio thread */
+    struct GeneratedNote
+    {
+        int samplePos;
+        int note;
+        juce::uint8 velocity;
+        unsigned long noteOffTime;
+    };
+    /** 
+     * one improviser: its own models, learning from one input channel and playing on one output channel.
+     * during the learn and generate steps each voice may be worked on by a different thread, 
+     * so anything in here must only be touched by the job for that voice 
+     */
+    struct Voice
+    {
+        MarkovManager pitchModel;
+        MarkovManager polyphonyModel; 
+        MarkovManager iOIModel;
+        MarkovManager noteDurationModel;    
+        MarkovManager velocityModel;    
+        ChordDetector chordDetect { 0 };
+        unsigned long noteOnTimes[127] {};
+        unsigned long lastIncomingNoteOnTime { 0 };
+        unsigned long lastOutgoingNoteOnTime { 0 };
+        unsigned long nextTimeToPlayANote { 0 };
+        bool noMidiYet { true };
+        int overpolySkipRemaining { 0 };
+        /** 1-16, or 0 to learn from every channel */
+        int inputChannel { 0 };
+        int outputChannel { 1 };
+        std::mt19937 rng { std::random_device{}() };
+        /** filled by the generate step, scheduled and cleared by the audio thread */
+        std::vector<GeneratedNote> generated;
+        /** how many extra overpoly notes the last generate step added, or -1 if it didn't decide */
+        int overpolyExtra { -1 };
+        /** iois learned this block, passed on to the (shared) slow-mo strategy by the audio thread */
+        std::vector<int> learnedIois;
+        /** index into models() and phrases */
+        enum Model : size_t { pitch, polyphony, ioi, duration, velocity };
+        /** when rendering offline, events are generated a phrase at a time. see nextVoiceEvent */
+        std::array<state_sequence, 5> phrases;
+        std::array<size_t, 5> phrasePositions {};
+
+        std::array<MarkovManager*, 5> models()
+        {
+            return {&pitchModel, &polyphonyModel, &iOIModel, &noteDurationModel, &velocityModel};
+        }
+        bool listensTo(int channel) const { return inputChannel == 0 || inputChannel == channel; }
+        void clearPhrases()
+        {
+            for (size_t i = 0; i < phrases.size(); ++i)
+            {
+                phrases[i].clear();
+                phrasePositions[i] = 0;
+            }
+        }
+    };
+    /**
+     * the feature extraction a voice runs on incoming midi: chords (via its ChordDetector), 
+     * polyphony, iois, durations and velocities. message timestamps are sample offsets from 
+     * bufferStartTime. quantBlockSizeSamples is 0 for no quantising. Doesn't touch the processor, 
+     * so the corpus trainer learns exactly the way the plugin does
+     */
+    static void learnFromMidi(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, 
+                              double sampleRate, int quantBlockSizeSamples, bool learningEnabled);
+    /** 
+     * write the voice's models to filename in the format loadModel reads, leaving out contexts 
+     * that fail the compaction options. .modelz files are compressed 
+     */
+    static bool saveVoiceModels(Voice& voice, const std::string& filename, const MarkovChain::CompactionOptions& compaction);
 
 private:
     static bool hasExtensionIgnoreCase(const std::string& filename, const std::string& ext);
@@ -154,8 +251,52 @@ private:
         double timeInSamples { 0.0 };
         bool transportPositionChanged { false };
     };
+    /**
+     * Every parameter the audio thread uses, read once at the start of each block
+     * and passed down, so all the stages of a block see the same values
+     */
+    struct BlockParams
+    {
+        bool playing { false };
+        bool learning { true };
+        bool leadFollow { true };
+        bool avoid { false };
+        bool slowMo { false };
+        bool overpoly { false };
+        bool callResponse { false };
+        float callRespGain { 0.5f };
+        float callRespSilence { 0.3f };
+        float callRespDrain { 1.0f };
+        float playProbability { 1.0f };
+        bool quantise { false };
+        bool useHostClock { false };
+        double quantBpm { 120.0 };
+        int quantDivision { 1 };
+        int modelMemoryMB { 0 };
+        int forgetHalfLife { 0 };
+        bool fullPanic { false };
+        int midiInChannel { 0 };
+        int midiOutChannel { 1 };
+        int voiceCount { 1 };
+        int scale { 0 };
+        int scaleRoot { 0 };
+        bool blendOrders { false };
+    };
+    /** most onsets (notes/ chords) one voice may start in a block, in case an ioi of 1 sample sneaks into a model */
+    static constexpr int maxOnsetsPerBlock = 64;
+    /** events generated per model in one go when rendering offline */
+    static constexpr size_t offlinePhraseLength = 256;
+    /** 
+     * the next event from one of the voice's models. when rendering offline, it comes from 
+     * a phrase generated ahead with the model locked once, otherwise straight from the model 
+     */
+    state_single nextVoiceEvent(Voice& voice, Voice::Model model, bool useInputAsContext);
+    /** load all the parameter atomics into a BlockParams */
+    BlockParams snapshotParameters() const;
     bool loadModelString(const std::string& filename);
     bool loadModelBinary(const std::string& filename);
+    /** decompress if need be and read each model in the file into set, ready to be shared */
+    bool parseModelSet(const std::string& filename, std::string data, SharedModelSet& set);
     bool saveModelString(const std::string& filename);
     bool saveModelBinary(const std::string& filename);
     bool startModelIOTask(ModelIoState state, std::string stage, std::function<bool()> ioTask);
@@ -166,29 +307,39 @@ private:
     /** quantise the sent time interval to the nearest multiple of quantBlock */
     static int quantiseInterval(int interval, int quantBlock);
     /** Convert the current BPM/division parameters into samples per internal tick */
-    double calculateClockSamplesPerTick(double sampleRate) const;
-    double calculateHostClockSamplesPerTick(const HostClockInfo& info) const;
+    double calculateClockSamplesPerTick(double sampleRate, const BlockParams& params) const;
+    double calculateHostClockSamplesPerTick(const HostClockInfo& info, const BlockParams& params) const;
     void pushClockTickForGUI();
 
-  // thread-safe atomics used for simple storage of last received midi note
-    std::atomic<int>   lastNoteIn {-1};
-    std::atomic<float> lastVelocityIn  {0.0f};            // 0..1
-    std::atomic<uint32_t> lastNoteInStamp {0};           // increments on every new note event
-    std::atomic<int>   lastAvoidTranspose {0};
-    std::atomic<uint32_t> lastAvoidTransposeStamp {0};
-    std::atomic<float> lastSlomoScalar {1.0f};
-    std::atomic<uint32_t> lastSlomoScalarStamp {0};
-    std::atomic<int> overpolyExtraCount {0};
-    std::atomic<uint32_t> overpolyExtraStamp {0};
-
-    std::atomic<int>   lastNoteOut {-1};
-    std::atomic<float> lastVelocityOut  {0.0f};            // 0..1
-    std::atomic<uint32_t> lastNoteOutStamp {0};           // increments on every new note event
+    /** everything the audio thread wants the GUI to know, drained by the editor's timer */
+    TelemetryRing telemetry;
+    /** 
+     * adds to the telemetry stream, unless we are rendering offline and nobody is watching. 
+     * false if the event wasn't added, because of that or because the ring is full
+     */
+    bool pushTelemetry(const TelemetryEvent& event);
+    /** true while the host is bouncing with isNonRealtime. audio thread only */
+    bool renderingOffline { false };
+    // last values pushed, so status records only go out when something changed. only updated
+    // once the push succeeds, so a full ring doesn't lose a change. audio thread only
+    float telemetrySlomoScalar { -1.0f };
+    float telemetryCallResponseEnergy { -1.0f };
+    int telemetryCallResponsePhase { -1 };
+    int telemetryModelStatus[6] { -1, -1, -1, -1, -1, -1 };
+    /** forget the last values pushed, so they all go out again */
+    void forgetTelemetrySent();
+    /** set when an editor is created, so the audio thread calls forgetTelemetrySent */
+    std::atomic<bool> telemetryResendRequested { false };
 
     /** used to remember if we need to send all notes off on next processBlock */
     std::atomic<bool>   sendAllNotesOffNext {true};
-    /** panic function to stop a synth that gets into a bad state.  */
-    void sendMidiPanic (juce::MidiBuffer& out, int samplePos);
+    /** 
+     * panic function to stop a synth that gets into a bad state. sends offs for every sounding 
+     * note plus all notes/ sound off on each channel, or the full sweep if fullPanic is set
+     */
+    void sendMidiPanic (juce::MidiBuffer& out, int samplePos, bool fullPanic);
+    /** brute force: every controller reset and an off for every note on every channel */
+    void sendFullMidiPanic (juce::MidiBuffer& out, int samplePos);
 
     juce::AudioProcessorValueTreeState apvts;
     std::mt19937 callResponseRng { std::random_device{}() };
@@ -200,6 +351,9 @@ private:
     std::atomic<float>* updateGuiParam     = nullptr;
     std::atomic<float>* resetParam         = nullptr;
     std::atomic<bool>   lastResetParamState {false};
+    std::atomic<bool>   resetRequested {false};
+    std::atomic<bool>   undoRequested {false};
+    std::atomic<bool>   redoRequested {false};
     
     std::atomic<float>* learningParam       = nullptr;
     std::atomic<float>* leadFollowParam       = nullptr;
@@ -219,10 +373,25 @@ private:
     std::atomic<float>* quantDivisionParam  = nullptr;
     std::atomic<float>* midiInChannelParam  = nullptr;
     std::atomic<float>* midiOutChannelParam = nullptr;
+    std::atomic<float>* voiceCountParam     = nullptr;
+    std::atomic<float>* modelMemoryMBParam  = nullptr;
+    std::atomic<float>* forgetHalfLifeParam = nullptr;
+    std::atomic<float>* saveMinCountParam   = nullptr;
+    std::atomic<float>* saveMaxOrderParam   = nullptr;
+    std::atomic<float>* fullPanicParam      = nullptr;
+    std::atomic<float>* scaleParam          = nullptr;
+    std::atomic<float>* scaleRootParam      = nullptr;
+    std::atomic<float>* blendOrdersParam    = nullptr;
+    int appliedModelMemoryMB { 0 };
+    int appliedForgetHalfLife { 0 };
+    int appliedScale { 0 };
+    int appliedScaleRoot { 0 };
+    bool appliedBlendOrders { false };
+    /** the notes the pitch models may play while a scale is picked. only changed by pb_applyModelLimits */
+    MarkovChain::NoteMask scaleMask;
     juce::AudioParameterFloat* quantBpmParamObject = nullptr;
     juce::SpinLock bpmAdjustLock;
 
-    std::atomic<uint32_t> lastClockTickStamp {0};
     double clockSamplesPerTick { 0.0 };
     double clockSamplesAccumulated { 0.0 };
     bool   hostClockPositionInitialised { false };
@@ -236,18 +405,6 @@ private:
     bool   havePreviousBlockInfo { false };
     std::atomic<float> effectiveBpmForDisplay { 120.0f };
     std::atomic<bool>  effectiveBpmIsHost { false };
-    std::atomic<float> callResponseEnergyForGui { 0.0f };
-    std::atomic<uint32_t> callResponseEnergyStamp { 0 };
-    std::atomic<uint32_t> callResponsePhaseStamp { 0 };
-    std::atomic<bool> callResponsePhaseEnabled { false };
-    std::atomic<bool> callResponsePhaseInResponse { false };
-    std::atomic<int> modelSizePitch { 0 };
-    std::atomic<int> modelSizeIoI { 0 };
-    std::atomic<int> modelSizeDur { 0 };
-    std::atomic<int> modelOrderPitch { 0 };
-    std::atomic<int> modelOrderIoI { 0 };
-    std::atomic<int> modelOrderDur { 0 };
-    std::atomic<uint32_t> modelStatusStamp { 0 };
     std::atomic<int> modelIoState { static_cast<int>(ModelIoState::Idle) };
     std::atomic<uint32_t> modelIoStamp { 0 };
     std::string modelIoStage;
@@ -256,36 +413,44 @@ private:
     std::atomic<bool> modelIoInProgress { false };
     std::atomic<int> processBlockActiveCount { 0 };
     std::thread modelIoThread;
-    int overpolySkipRemaining { 0 };
 
-    void analysePitches(const juce::MidiBuffer& midiMessages, bool learningEnabled);
-    void analyseIoI(const juce::MidiBuffer& midiMessages, int quantBlockSizeSamples, bool learningEnabled);
-    void analyseDuration(const juce::MidiBuffer& midiMessages, int quantBlockSizeSamples, bool learningEnabled);
-    void analyseVelocity(const juce::MidiBuffer& midiMessages, bool learningEnabled);
+    // each of these only looks at the messages on the voice's input channel
+    static void analysePitches(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, bool learningEnabled);
+    static void analyseIoI(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, double sampleRate, int quantBlockSizeSamples, bool learningEnabled);
+    static void analyseDuration(Voice& voice, const juce::MidiBuffer& midiMessages, unsigned long bufferStartTime, int quantBlockSizeSamples, bool learningEnabled);
+    static void analyseVelocity(Voice& voice, const juce::MidiBuffer& midiMessages, bool learningEnabled);
 
     // processBlock helper steps
     /** in case the UI directly sent us midi */
-    void pb_handleMidiFromUI(juce::MidiBuffer& midiMessages);
+    void pb_handleMidiFromUI(juce::MidiBuffer& midiMessages, int numSamples);
     /** store the last incoming note for display*/
     void pb_informGuiOfIncoming(const juce::MidiBuffer& midiMessages);
     /** figure out the time */
     HostClockInfo pb_collectHostClockInfo(bool hostClockEnabled);
     /** tick in internal clocl mode */
-    void pb_tickInternalClock(const juce::AudioBuffer<float>& buffer);
+    void pb_tickInternalClock(const juce::AudioBuffer<float>& buffer, const BlockParams& params);
     /** tick in host clock mode */
-    void pb_tickHostClock(bool transportPlaying, bool hostHasPpq, double hostPpqPosition);
-    /** update the model with new midi */
-    void pb_learnFromIncomingMidi(const juce::MidiBuffer& midiMessages, double effectiveBpm);
-    /** peg note offs for future refenec */
+    void pb_tickHostClock(bool transportPlaying, bool hostHasPpq, double hostPpqPosition, const BlockParams& params);
+    /** work out how many voices are active and which channels they listen and play on */
+    void pb_assignVoices(const BlockParams& params);
+    /** how many voices a model load should fill, from the voiceCount parameter */
+    int loadVoiceCount() const;
+    /** push the memory budget, forgetting, scale and blending parameters down to the models if they changed */
+    void pb_applyModelLimits(const BlockParams& params);
+    /** update the models with new midi, one job per active voice */
+    void pb_learnFromIncomingMidi(const juce::MidiBuffer& midiMessages, double effectiveBpm, const BlockParams& params);
+    /** add the scheduled events that fall due in this block */
     void pb_schedulePendingNoteOffs(juce::MidiBuffer& buffer, unsigned long blockStart, unsigned long blockEnd);
+    /** add a generated note on to buffer and schedule its note off, dealing with retriggers of a sounding pitch */
+    void addScheduledNote(juce::MidiBuffer& buffer, const juce::MidiMessage& noteOn, int samplePos, unsigned long noteOffTime);
     /** store last sent midi for the UI to pick up  */
     void pb_informGuiOfOutgoing(const juce::MidiBuffer& midiMessages);
     /** remove generated notes if probablity set */
-    void pb_applyPlayProbability(juce::MidiBuffer& midiMessages);
+    void pb_applyPlayProbability(juce::MidiBuffer& midiMessages, const BlockParams& params);
     /** tell the midi logger about our notes */
     void pb_logMidiEvents(const juce::MidiBuffer& midiMessages);
     /**  */
-    bool pb_handlePlayingState(juce::MidiBuffer& midiMessages, bool hostAllowsPlayback, bool allOffRequested);
+    bool pb_handlePlayingState(juce::MidiBuffer& midiMessages, bool hostAllowsPlayback, bool allOffRequested, const BlockParams& params);
     /** feed incoming note-ons into avoid strategy buffer */
     void pb_recordIncomingNotesForAvoid(const juce::MidiBuffer& midiMessages);
     /** track call/response inputs */
@@ -294,47 +459,93 @@ private:
     void pb_randomiseBehaviourTogglesForResponse();
     /** deal with stuck notes */
     void pb_handleStuckNotes(juce::MidiBuffer& midiMessages, unsigned long elapsedSamplesAtEnd);
+    /** remember which notes the outgoing messages leave sounding */
+    void pb_trackSoundingNotes(const juce::MidiBuffer& midiMessages);
     /** send all notes off if needed */
-    void pb_sendPendingAllNotesOff(juce::MidiBuffer& midiMessages, bool allOffRequested);
+    void pb_sendPendingAllNotesOff(juce::MidiBuffer& midiMessages, bool allOffRequested, const BlockParams& params);
+    /** swap empty models in and hand the old ones to modelReclaimer, so nothing big is freed on the audio thread */
+    void pb_resetModels();
+    /** undo or redo the last change to every model. old versions go to modelReclaimer as for a reset */
+    void pb_stepModelHistory(bool undo);
 
-    std::optional<unsigned long> computeNextInternalTickSample() const;
-    std::optional<unsigned long> computeNextHostTickSample(const HostClockInfo& info) const;
-    void alignModelPlayTimeToNextTick(bool hostClockEnabled, const HostClockInfo& info);
+    std::optional<unsigned long> computeNextInternalTickSample(const BlockParams& params) const;
+    std::optional<unsigned long> computeNextHostTickSample(const HostClockInfo& info, const BlockParams& params) const;
+    void alignModelPlayTimeToNextTick(bool hostClockEnabled, const HostClockInfo& info, const BlockParams& params);
 
-    std::string notesToMarkovState (const std::vector<int>& notesVec);
+    static std::string notesToMarkovState (const std::vector<int>& notesVec);
     std::vector<int> markovStateToNotes (const std::string& notesStr);
-    juce::MidiBuffer generateNotesFromModel(const juce::MidiBuffer& incomingNotes, unsigned long bufferStartTime, unsigned long bufferEndTime, const HostClockInfo& hostInfo);
+    /** fills generatedMessages (clearing it first) with what the active voices want to play in this block */
+    void generateNotesFromModel(juce::MidiBuffer& generatedMessages, const juce::MidiBuffer& incomingNotes, unsigned long bufferStartTime, unsigned long bufferEndTime, const HostClockInfo& hostInfo, const BlockParams& params);
+    /** 
+     * fills voice.generated with every note this voice wants to start in this block, each at its 
+     * own sample offset (up to maxOnsetsPerBlock onsets). may run on a worker thread 
+     */
+    void generateVoiceNotes(Voice& voice, unsigned long bufferStartTime, unsigned long bufferEndTime, const HostClockInfo& hostInfo, const BlockParams& params, double slomoMultiplier);
 
     // juce::MidiBuffer generateNotesFromModel(const juce::MidiBuffer& incomingMessages);
     // return true if time to play a note
     // bool isTimeToPlayNote(unsigned long currentTime);
-    bool isTimeToPlayNote(unsigned long windowStartTime, unsigned long windowEndTime);
+    /** true if the voice's next onset falls in the window. pulls a late onset up to the window start */
+    bool isTimeToPlayNote(Voice& voice, unsigned long windowStartTime, unsigned long windowEndTime);
 
     // call after playing a note 
     void updateTimeForNextPlay();
-    void syncNextTimeToClock(const HostClockInfo& info);
+    /** push nextTime on to the next clock tick */
+    void syncNextTimeToClock(unsigned long& nextTime, const HostClockInfo& info, const BlockParams& params) const;
     int sanitiseNote(int note) const;
 
-    /** stores messages added from the addMidi function*/
-    juce::MidiBuffer midiReceivedFromUI;
-
-    MarkovManager pitchModel;
-    MarkovManager polyphonyModel; 
-    MarkovManager iOIModel;
-    MarkovManager noteDurationModel;    
-    MarkovManager velocityModel;    
-
-    unsigned long lastIncomingNoteOnTime; 
-    bool noMidiYet; 
-    unsigned long noteOffTimes[127];
-    unsigned long noteOnTimes[127];
+    /** scratch buffers for processBlock, sized in prepareToPlay and swapped rather than copied */
+    static constexpr int midiScratchBytes = 32768;
+    juce::MidiBuffer generatedMidi;
+    juce::MidiBuffer filteredMidi;
+
+    /** messages added by uiAddsMidi, waiting for the next block */
+    MidiInputFifo midiReceivedFromUI;
+
+    /** voice 0 is always active. the rest only learn and play when voiceCount asks for them */
+    std::array<Voice, maxVoices> voices;
+    int activeVoiceCount { 1 };
+    /** runs the per voice jobs when more than one voice is active */
+    VoiceWorkerPool voicePool { maxVoices - 1 };
+    /** destroys the models thrown away by a reset on a background thread */
+    DeferredReclaimer<MarkovChain::SharedModel> modelReclaimer;
+    /** how many resets, loads and feedbacks each model can undo */
+    static constexpr size_t modelUndoDepth = 16;
+    /** the models last loaded, shared with any other instance that loaded the same file */
+    std::shared_ptr<const SharedModelSet> sharedModels;
+
+    /** decides which generated notes pb_applyPlayProbability keeps */
+    std::mt19937 playProbabilityRng { std::random_device{}() };
+    /** seeds the models each load hands to the voices. reseeded by seedRandom, so loads repeat too */
+    std::mt19937 loadSeedRng { std::random_device{}() };
+    /** every parameter with its raw value, in the order traces index them */
+    struct TracedParameter
+    {
+        juce::RangedAudioParameter* parameter;
+        std::atomic<float>* value;
+    };
+    std::vector<TracedParameter> traceParameters;
+    /** last raw values written to the trace, so only changes are recorded. audio thread only while recording */
+    std::vector<float> tracedParameterValues;
+    /** blocks the trace has room for before recording allocates */
+    static constexpr size_t traceReserveBlocks = 1 << 16;
+    PerformanceTrace trace;
+    std::string traceFilename;
+    std::atomic<bool> traceRecording { false };
+    /** start a trace block with the parameters and host transport, before anything reads them */
+    void pb_traceBlockStart(int numSamples);
+    /** add the incoming midi (including anything from the UI) and the GUI requests used by this block */
+    void pb_traceIncoming(const juce::MidiBuffer& midiMessages, bool resetFromGui, bool undoFromGui, bool redoFromGui, bool allOffRequested);
+    /** add what the block sent out, so a replay can check it */
+    void pb_traceOutgoing(const juce::MidiBuffer& midiMessages);
+
+    /** note offs (and anything else) waiting for their sample to come round */
+    NoteScheduler noteScheduler;
+    /** what we have left sounding on the output, for panics */
+    SoundingNotes soundingNotes;
     
     unsigned long elapsedSamples; 
-    unsigned long lastOutgoingNoteOnTime; 
-    
-    unsigned long nextTimeToPlayANote;
 
-    ChordDetector chordDetect;
     MIDIMonitor midiMonitor;
     AvoidStrategy avoidStrategy {};
     SlomoStrategy slomoStrategy {};
@@ -0,0 +1,46 @@
+#include "SharedModelRegistry.h"
+#include <cstdint>
+
+SharedModelRegistry& SharedModelRegistry::instance()
+{
+    static SharedModelRegistry registry;
+    return registry;
+}
+
+std::string SharedModelRegistry::makeKey(const std::string& filename, const std::string& fileData)
+{
+    // FNV-1a, which is plenty to tell a re-saved file from the one loaded before
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : fileData)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return filename + "#" + std::to_string(fileData.size()) + ":" + std::to_string(hash);
+}
+
+std::shared_ptr<const SharedModelSet> SharedModelRegistry::find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = sets.find(key);
+    if (it == sets.end())
+        return nullptr;
+    auto set = it->second.lock();
+    if (set == nullptr)
+        sets.erase(it);
+    return set;
+}
+
+std::shared_ptr<const SharedModelSet> SharedModelRegistry::add(const std::string& key, std::shared_ptr<const SharedModelSet> set)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    // forget the sets nobody uses any more while we're here
+    for (auto it = sets.begin(); it != sets.end();)
+        it = it->second.expired() ? sets.erase(it) : std::next(it);
+
+    auto& entry = sets[key];
+    if (auto existing = entry.lock())
+        return existing;
+    entry = set;
+    return set;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "MarkovModelCPP/src/MarkovChain.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The models loaded from one file, ready to be shared by every plugin instance that loads it.
+ * The chains are never changed after they are built: instances share their tables through
+ * MarkovManager::shareModelFrom and copy them only if they go on to learn.
+ */
+struct SharedModelSet
+{
+    std::vector<MarkovChain> chains;
+};
+
+/**
+ * Process-wide lookup of the model files loaded so far, so that several instances of the
+ * plugin loading the same file hold one copy of it between them.
+ * Only weak references are kept: a set goes away when the last instance using it loads
+ * something else or is deleted.
+ */
+class SharedModelRegistry
+{
+public:
+    static SharedModelRegistry& instance();
+
+    /** the key for a file with these contents. a changed file gets a new key */
+    static std::string makeKey(const std::string& filename, const std::string& fileData);
+    /** the set already loaded under this key, or nullptr */
+    std::shared_ptr<const SharedModelSet> find(const std::string& key);
+    /**
+     * keep track of a newly built set. if another instance added one under the same key
+     * in the meantime, that one is returned instead and should be used
+     */
+    std::shared_ptr<const SharedModelSet> add(const std::string& key, std::shared_ptr<const SharedModelSet> set);
+
+private:
+    SharedModelRegistry() = default;
+
+    std::mutex mtx;
+    std::map<std::string, std::weak_ptr<const SharedModelSet>> sets;
+};
@@ -0,0 +1,66 @@
+#include "SharedModelRegistry.h"
+#include "MarkovModelCPP/src/MarkovManager.h"
+#include <iostream>
+#include <string>
+#include <assert.h>
+
+int main()
+{
+    // what one instance parses from a file
+    const std::string fileData = "not really a model file";
+    const std::string key = SharedModelRegistry::makeKey("shared.model", fileData);
+    auto parsed = std::make_shared<SharedModelSet>();
+    parsed->chains.resize(2);
+    for (int i = 0; i < 5000; ++i)
+    {
+        parsed->chains[0].addObservationAllOrders({std::to_string(i % 13), std::to_string((i * 7) % 11)}, std::to_string((i * 31) % 40));
+        parsed->chains[1].addObservationAllOrders({std::to_string(i % 5)}, std::to_string((i * 3) % 17));
+    }
+    for (MarkovChain& chain : parsed->chains)
+        chain.prepareForSharing();
+    std::shared_ptr<const SharedModelSet> first = SharedModelRegistry::instance().add(key, parsed);
+    parsed.reset();
+
+    // a second instance loading the same file gets the same set
+    std::shared_ptr<const SharedModelSet> second = SharedModelRegistry::instance().find(key);
+    assert(second != nullptr && second == first);
+
+    // each instance loads it into a few voices, as the plugin does with learning on
+    std::vector<std::unique_ptr<MarkovManager>> voices;
+    for (int v = 0; v < 4; ++v)
+    {
+        const SharedModelSet& set = (v % 2 == 0) ? *first : *second;
+        for (size_t i = 0; i < set.chains.size(); ++i)
+        {
+            voices.push_back(std::make_unique<MarkovManager>(2));
+            voices.back()->shareModelFrom(set.chains[i]);
+            voices.back()->seed(static_cast<unsigned int>(voices.size()));
+            voices.back()->makeModelPrivate();
+        }
+    }
+
+    // playing doesn't copy any of the shared pages
+    state_sequence events;
+    for (int block = 0; block < 200; ++block)
+        for (auto& voice : voices)
+            voice->getEvents(events, 4, false);
+    for (size_t m = 0; m < voices.size(); ++m)
+    {
+        const MarkovChain& loaded = first->chains[m % first->chains.size()];
+        assert(voices[m]->getCopyOfModel().pagesNotSharedWith(loaded) == 0);
+    }
+
+    // learning still copies, and only into the voice that learned
+    voices[0]->putEvent("1");
+    voices[0]->putEvent("2");
+    assert(voices[0]->getCopyOfModel().pagesNotSharedWith(first->chains[0]) > 0);
+    assert(voices[2]->getCopyOfModel().pagesNotSharedWith(first->chains[0]) == 0);
+
+    // the registry only holds on to sets someone is using
+    voices.clear();
+    first.reset();
+    second.reset();
+    assert(SharedModelRegistry::instance().find(key) == nullptr);
+
+    std::cout << "SharedModelRegistry tests passed" << std::endl;
+}
@@ -0,0 +1,43 @@
+#include "SoundingNotes.h"
+
+SoundingNotes::SoundingNotes()
+{
+    clear();
+}
+
+void SoundingNotes::noteOn(int channel, int note)
+{
+    if (valid(channel, note)) notes[channel - 1].set(note);
+}
+
+void SoundingNotes::noteOff(int channel, int note)
+{
+    if (valid(channel, note)) notes[channel - 1].reset(note);
+}
+
+void SoundingNotes::allNotesOff(int channel)
+{
+    if (valid(channel, 0)) notes[channel - 1].reset();
+}
+
+bool SoundingNotes::isSounding(int channel, int note) const
+{
+    return valid(channel, note) && notes[channel - 1].test(note);
+}
+
+bool SoundingNotes::any() const
+{
+    for (const auto& ch : notes)
+        if (ch.any()) return true;
+    return false;
+}
+
+void SoundingNotes::clear()
+{
+    for (auto& ch : notes) ch.reset();
+}
+
+bool SoundingNotes::valid(int channel, int note)
+{
+    return channel >= 1 && channel <= 16 && note >= 0 && note < 128;
+}
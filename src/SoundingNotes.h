@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+
+/**
+ * Keeps track of which notes are sounding on each of the 16 midi channels, 
+ * so a panic only needs to send offs for the notes that are actually held.
+ */
+class SoundingNotes{
+    public:
+        SoundingNotes();
+        /** a note on went out. channel is 1-16 */
+        void noteOn(int channel, int note);
+        /** a note off (or note on with velocity 0) went out */
+        void noteOff(int channel, int note);
+        /** all notes off/ all sound off went out on this channel */
+        void allNotesOff(int channel);
+        bool isSounding(int channel, int note) const;
+        /** true if anything is sounding on any channel */
+        bool any() const;
+        /** call f(channel, note) for each sounding note */
+        template <typename F>
+        void forEachSounding(F&& f) const
+        {
+            for (int ch = 0; ch < 16; ++ch)
+            {
+                if (notes[ch].none()) continue;
+                for (int note = 0; note < 128; ++note)
+                    if (notes[ch].test(note)) f(ch + 1, note);
+            }
+        }
+        void clear();
+    private:
+        static bool valid(int channel, int note);
+        std::array<std::bitset<128>, 16> notes;
+};
@@ -0,0 +1,38 @@
+#include "TelemetryRing.h"
+
+TelemetryRing::TelemetryRing(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    slots.resize(size);
+    mask = size - 1;
+}
+
+bool TelemetryRing::push(const TelemetryEvent& event)
+{
+    const size_t write = writeIndex.load(std::memory_order_relaxed);
+    if (write - readIndex.load(std::memory_order_acquire) >= slots.size())
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    slots[write & mask] = event;
+    writeIndex.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+size_t TelemetryRing::pop(TelemetryEvent* dest, size_t maxEvents)
+{
+    const size_t read = readIndex.load(std::memory_order_relaxed);
+    const size_t available = writeIndex.load(std::memory_order_acquire) - read;
+    const size_t count = available < maxEvents ? available : maxEvents;
+    for (size_t i = 0; i < count; ++i)
+        dest[i] = slots[(read + i) & mask];
+    readIndex.store(read + count, std::memory_order_release);
+    return count;
+}
+
+uint32_t TelemetryRing::getDroppedCount() const
+{
+    return dropped.load(std::memory_order_relaxed);
+}
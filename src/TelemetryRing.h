@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/** one record in the telemetry stream from the audio thread to the GUI */
+struct TelemetryEvent
+{
+    enum class Type : uint8_t
+    {
+        midiIn, midiOut, clockTick, avoidTransposition, slomoScalar,
+        overpolyExtra, callResponseEnergy, callResponsePhase, modelStatus
+    };
+    Type type;
+    uint8_t channel;   // midi events
+    uint8_t note;      // midi events, or which model for modelStatus (0 pitch, 1 ioi, 2 duration)
+    uint8_t velocity;  // midi events, 0 for note off
+    int32_t value1;    // transposition, extra note count, call/response enabled, model size
+    int32_t value2;    // call/response in response, model order
+    float scalar;      // slow-mo scalar, call/response energy
+};
+
+/**
+ * Wait free single producer/ single consumer ring of TelemetryEvents. 
+ * The audio thread pushes, the GUI timer drains it in batches. If the GUI falls behind,
+ * new events are dropped (and counted) rather than ever making the producer wait.
+ */
+class TelemetryRing{
+    public:
+        /** capacity is rounded up to a power of two */
+        TelemetryRing(size_t capacity = 8192);
+        /** producer side. returns false if the ring was full and the event was dropped */
+        bool push(const TelemetryEvent& event);
+        /** consumer side. copies up to maxEvents into dest, oldest first, and returns how many */
+        size_t pop(TelemetryEvent* dest, size_t maxEvents);
+        /** how many events have been dropped because the ring was full */
+        uint32_t getDroppedCount() const;
+    private:
+        std::vector<TelemetryEvent> slots;
+        size_t mask;
+        // both only ever increase, the slot is index & mask
+        std::atomic<size_t> writeIndex { 0 };
+        std::atomic<size_t> readIndex { 0 };
+        std::atomic<uint32_t> dropped { 0 };
+};
@@ -0,0 +1,48 @@
+#include "TelemetryRing.h"
+#include <iostream>
+#include <thread>
+#include <assert.h>
+
+int main()
+{
+    TelemetryRing ring {5};
+    TelemetryEvent batch[16];
+
+    // capacity rounds up to 8, the ninth push is dropped
+    for (int i = 0; i < 9; ++i)
+    {
+        TelemetryEvent e {};
+        e.type = TelemetryEvent::Type::midiOut;
+        e.note = static_cast<uint8_t>(i);
+        ring.push(e);
+    }
+    assert(ring.getDroppedCount() == 1);
+    assert(ring.pop(batch, 3) == 3);
+    assert(batch[0].note == 0 && batch[2].note == 2);
+    assert(ring.pop(batch, 16) == 5);
+    assert(batch[4].note == 7);
+    assert(ring.pop(batch, 16) == 0);
+
+    // one thread pushes, one drains: everything arrives in order
+    TelemetryRing shared {64};
+    const int total = 200000;
+    std::thread producer([&shared]()
+    {
+        for (int i = 0; i < total; ++i)
+        {
+            TelemetryEvent e {};
+            e.type = TelemetryEvent::Type::modelStatus;
+            e.value1 = i;
+            while (!shared.push(e)) std::this_thread::yield();
+        }
+    });
+    int expected = 0;
+    while (expected < total)
+    {
+        const size_t n = shared.pop(batch, 16);
+        for (size_t i = 0; i < n; ++i)
+            assert(batch[i].value1 == expected++);
+    }
+    producer.join();
+    std::cout << "TelemetryRing tests passed" << std::endl;
+}
@@ -0,0 +1,150 @@
+/*
+  Drives a MidiMarkovProcessor from a PerformanceTrace, checks that it sends out exactly
+  the midi that was recorded and reports how long the processing took.
+
+  usage: midi-markov-replay trace.mmtrace [repeats]
+
+  Each repeat starts from a freshly constructed processor, and the fastest run is reported,
+  so two builds can be compared on the same workload.
+*/
+
+#include "PluginProcessor.h"
+#include "PerformanceTrace.h"
+#include <iostream>
+#include <limits>
+
+/** hands the processor the transport recorded for the current block */
+class TracePlayHead : public juce::AudioPlayHead
+{
+public:
+    const PerformanceTrace::Block* block { nullptr };
+
+    juce::Optional<PositionInfo> getPosition() const override
+    {
+        if (block == nullptr || (block->flags & PerformanceTrace::transportKnown) == 0)
+            return {};
+        PositionInfo info;
+        info.setIsPlaying((block->flags & PerformanceTrace::transportPlaying) != 0);
+        info.setIsRecording((block->flags & PerformanceTrace::transportRecording) != 0);
+        if (block->flags & PerformanceTrace::hasPpq) info.setPpqPosition(block->ppqPosition);
+        if (block->flags & PerformanceTrace::hasBpm) info.setBpm(block->bpm);
+        if (block->flags & PerformanceTrace::hasTimeInSamples) info.setTimeInSamples(block->timeInSamples);
+        return info;
+    }
+};
+
+static bool sameEvent(const juce::MidiMessageMetadata& got, const PerformanceTrace::MidiEvent& want)
+{
+    if (got.samplePosition != want.samplePos || got.numBytes != want.size)
+        return false;
+    for (int i = 0; i < got.numBytes; ++i)
+        if (got.data[i] != want.bytes[i])
+            return false;
+    return true;
+}
+
+/** replays the whole trace once. returns the number of blocks whose output differed */
+static size_t replay(const PerformanceTrace& trace, double& seconds)
+{
+    MidiMarkovProcessor processor;
+    TracePlayHead playHead;
+    processor.seedRandom(trace.seed);
+    processor.setPlayHead(&playHead);
+    processor.setRateAndBufferSizeDetails(trace.sampleRate, trace.maxBlockSize);
+    processor.prepareToPlay(trace.sampleRate, trace.maxBlockSize);
+
+    const int channels = juce::jmax(1, processor.getTotalNumOutputChannels());
+    juce::AudioBuffer<float> audio(channels, trace.maxBlockSize);
+    juce::MidiBuffer midi;
+    size_t mismatchedBlocks = 0;
+
+    const auto start = juce::Time::getHighResolutionTicks();
+    for (size_t b = 0; b < trace.blocks.size(); ++b)
+    {
+        const PerformanceTrace::Block& block = trace.blocks[b];
+        for (uint32_t i = 0; i < block.numParams; ++i)
+        {
+            const auto& change = trace.params[block.firstParam + i];
+            processor.applyTracedParameter(change.index, change.value);
+        }
+        if (block.flags & PerformanceTrace::resetRequested)
+            processor.resetModel();
+        if (block.flags & PerformanceTrace::undoRequested)
+            processor.undoModelChange();
+        if (block.flags & PerformanceTrace::redoRequested)
+            processor.redoModelChange();
+        if (block.flags & PerformanceTrace::allNotesOff)
+            processor.sendAllNotesOff();
+        processor.setNonRealtime((block.flags & PerformanceTrace::nonRealtime) != 0);
+        playHead.block = &block;
+
+        midi.clear();
+        for (uint32_t i = 0; i < block.numMidiIn; ++i)
+        {
+            const auto& event = trace.midiIn[block.firstMidiIn + i];
+            midi.addEvent(event.bytes, event.size, event.samplePos);
+        }
+        audio.setSize(channels, static_cast<int>(block.numSamples), false, false, true);
+        processor.processBlock(audio, midi);
+
+        bool same = static_cast<uint32_t>(midi.getNumEvents()) == block.numMidiOut;
+        uint32_t i = 0;
+        for (const auto metadata : midi)
+        {
+            if (!same) break;
+            same = sameEvent(metadata, trace.midiOut[block.firstMidiOut + i++]);
+        }
+        if (!same)
+        {
+            if (mismatchedBlocks == 0)
+                std::cout << "first difference in block " << b << std::endl;
+            ++mismatchedBlocks;
+        }
+    }
+    seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+    processor.releaseResources();
+    return mismatchedBlocks;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "usage: midi-markov-replay trace.mmtrace [repeats]" << std::endl;
+        return 2;
+    }
+    juce::ScopedJuceInitialiser_GUI juceInit;
+
+    PerformanceTrace trace;
+    if (!trace.load(argv[1]))
+    {
+        std::cout << "could not read a trace from " << argv[1] << std::endl;
+        return 2;
+    }
+    const int repeats = argc > 2 ? juce::jmax(1, std::atoi(argv[2])) : 1;
+
+    double totalSamples = 0.0;
+    for (const auto& block : trace.blocks)
+        totalSamples += block.numSamples;
+    const double audioSeconds = trace.sampleRate > 0.0 ? totalSamples / trace.sampleRate : 0.0;
+
+    double best = std::numeric_limits<double>::max();
+    size_t mismatches = 0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        double seconds = 0.0;
+        mismatches += replay(trace, seconds);
+        best = juce::jmin(best, seconds);
+    }
+
+    std::cout << trace.blocks.size() << " blocks, " << audioSeconds << "s of audio at " << trace.sampleRate << "Hz" << std::endl;
+    std::cout << "best of " << repeats << ": " << best * 1000.0 << "ms, "
+              << (best > 0.0 ? audioSeconds / best : 0.0) << "x realtime" << std::endl;
+    if (mismatches > 0)
+    {
+        std::cout << mismatches << " blocks did not match the recorded output" << std::endl;
+        return 1;
+    }
+    std::cout << "output matches the recording" << std::endl;
+    return 0;
+}
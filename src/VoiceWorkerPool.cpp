@@ -0,0 +1,84 @@
+#include "VoiceWorkerPool.h"
+
+VoiceWorkerPool::VoiceWorkerPool(size_t workerCount) : wake{static_cast<int>(workerCount)}
+{
+    workers.reserve(workerCount);
+    for (size_t i = 0; i < workerCount; ++i)
+        workers.emplace_back([this]{ workerLoop(); });
+}
+
+VoiceWorkerPool::~VoiceWorkerPool()
+{
+    stopping.store(true, std::memory_order_release);
+    wake.post(static_cast<int>(workers.size()));
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+size_t VoiceWorkerPool::getWorkerCount() const
+{
+    return workers.size();
+}
+
+void VoiceWorkerPool::runErased(size_t jobCount, JobFunction function, void* context)
+{
+    if (jobCount == 0)
+        return;
+    if (jobCount == 1 || workers.empty())
+    {
+        for (size_t i = 0; i < jobCount; ++i)
+            function(context, i);
+        return;
+    }
+
+    // from here on a worker that woke late for the last batch can't claim anything, even if
+    // it goes on to read this batch's function with the last batch's number
+    const uint32_t id = batch.load(std::memory_order_relaxed) + 1;
+    claim.store(static_cast<uint64_t>(id) << 32, std::memory_order_relaxed);
+    batchFunction.store(function, std::memory_order_release);
+    batchContext.store(context, std::memory_order_release);
+    batchSize.store(jobCount, std::memory_order_release);
+    // the last batch's jobs were all done before it returned, so nobody else touches this now
+    jobsDone.store(0, std::memory_order_relaxed);
+    batch.store(id, std::memory_order_release);
+    wake.post(static_cast<int>(workers.size()));
+
+    runJobs(id, function, context, jobCount);
+    // whatever is left is already running on a worker
+    while (jobsDone.load(std::memory_order_acquire) < jobCount)
+        std::this_thread::yield();
+}
+
+void VoiceWorkerPool::workerLoop()
+{
+    uint32_t seenBatch = 0;
+    while (true)
+    {
+        wake.wait();
+        if (stopping.load(std::memory_order_acquire))
+            return;
+        const uint32_t id = batch.load(std::memory_order_acquire);
+        // a spare wake up from a batch this worker has already been through
+        if (id == seenBatch)
+            continue;
+        seenBatch = id;
+        // if any of these came from a later batch, its number is already in claim, so nothing is claimed
+        JobFunction function = batchFunction.load(std::memory_order_acquire);
+        void* context = batchContext.load(std::memory_order_acquire);
+        const size_t jobCount = batchSize.load(std::memory_order_acquire);
+        runJobs(id, function, context, jobCount);
+    }
+}
+
+void VoiceWorkerPool::runJobs(uint32_t id, JobFunction function, void* context, size_t jobCount)
+{
+    uint64_t current = claim.load(std::memory_order_acquire);
+    while ((current >> 32) == id && (current & 0xffffffffu) < jobCount)
+    {
+        if (!claim.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            continue;
+        function(context, static_cast<size_t>(current & 0xffffffffu));
+        jobsDone.fetch_add(1, std::memory_order_acq_rel);
+        ++current;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "LightweightSemaphore.h"
+
+/**
+ * A few worker threads that run a batch of independent jobs (one per voice) alongside the
+ * calling thread. run() returns when every job in the batch is done. The caller always works
+ * on the batch too, so a batch finishes even if the workers are slow to wake up.
+ * run takes no locks: the batch is published through atomics and the workers are woken with a
+ * LightweightSemaphore, so it is safe to call from the audio thread.
+ * Only one thread may call run at a time.
+ */
+class VoiceWorkerPool{
+    public:
+        /**
+         * @brief Construct a new Voice Worker Pool
+         *
+         * @param workerCount: threads started on top of the caller's. 0 runs everything inline
+         */
+        VoiceWorkerPool(size_t workerCount = 3);
+        ~VoiceWorkerPool();
+        VoiceWorkerPool(const VoiceWorkerPool&) = delete;
+        VoiceWorkerPool& operator=(const VoiceWorkerPool&) = delete;
+        /**
+         * @brief call job(i) for every i in [0, jobCount), spread over the workers and the caller
+         *
+         * @param job: called with a size_t. must be safe to run in parallel with itself
+         */
+        template <typename Job>
+        void run(size_t jobCount, Job&& job)
+        {
+            runErased(jobCount, [](void* context, size_t index){ (*static_cast<Job*>(context))(index); }, &job);
+        }
+        size_t getWorkerCount() const;
+    private:
+        using JobFunction = void (*)(void* context, size_t index);
+        void runErased(size_t jobCount, JobFunction function, void* context);
+        void workerLoop();
+        /** claim and run jobs from the sent batch until there are none left, or it has been replaced */
+        void runJobs(uint32_t id, JobFunction function, void* context, size_t jobCount);
+
+        std::vector<std::thread> workers;
+        LightweightSemaphore wake;
+        std::atomic<bool> stopping { false };
+        // the batch being run. runErased writes these, then publishes them by storing batch
+        std::atomic<uint32_t> batch { 0 };
+        std::atomic<JobFunction> batchFunction { nullptr };
+        std::atomic<void*> batchContext { nullptr };
+        std::atomic<size_t> batchSize { 0 };
+        // the batch number in the top half and the next job to claim in the bottom. a job is
+        // claimed by swapping both at once, so a worker still holding an earlier batch's 
+        // function can't claim a job from a later one
+        std::atomic<uint64_t> claim { 0 };
+        std::atomic<size_t> jobsDone { 0 };
+};
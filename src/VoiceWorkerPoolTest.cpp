@@ -0,0 +1,46 @@
+#include "VoiceWorkerPool.h"
+#include <iostream>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <assert.h>
+
+int main()
+{
+    VoiceWorkerPool pool {3};
+
+    // every job runs exactly once, and results are visible when run returns
+    for (int round = 0; round < 2000; ++round)
+    {
+        int results[4] = {0, 0, 0, 0};
+        const size_t jobs = 1 + static_cast<size_t>(round % 4);
+        pool.run(jobs, [&](size_t i){ results[i] += static_cast<int>(i) + round; });
+        for (size_t i = 0; i < 4; ++i)
+            assert(results[i] == (i < jobs ? static_cast<int>(i) + round : 0));
+    }
+
+    // back to back batches, with workers still waking for earlier ones
+    std::atomic<int> total { 0 };
+    for (int round = 0; round < 20000; ++round)
+        pool.run(4, [&](size_t i){ total.fetch_add(static_cast<int>(i) + 1, std::memory_order_relaxed); });
+    assert(total.load() == 20000 * 10);
+
+    // slow jobs get spread over more than one thread
+    std::mutex m;
+    std::set<std::thread::id> threads;
+    pool.run(4, [&](size_t){
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::lock_guard<std::mutex> lock(m);
+        threads.insert(std::this_thread::get_id());
+    });
+    assert(threads.size() > 1);
+
+    // no workers: everything runs on the caller
+    VoiceWorkerPool inlinePool {0};
+    int sum = 0;
+    inlinePool.run(4, [&](size_t i){ sum += static_cast<int>(i); });
+    assert(sum == 6);
+
+    std::cout << "VoiceWorkerPool tests passed" << std::endl;
+}